@@ -11,76 +11,1326 @@
 #define ATLAAS_HPP
 
 #include <array> // C++11
+#include <algorithm> // std::fill, std::max
+#include <cmath> // std::ceil
 #include <memory> // unique_ptr C++11
+#include <atomic> // C++11
+#include <mutex> // C++11
+#include <thread> // C++11
+#include <chrono> // C++11
+#include <cstdint> // C++11
+#include <cstdlib> // labs
+#include <exception> // exception_ptr C++11
+#include <functional> // C++11
 #include <map>
+#include <limits> // numeric_limits
 #include <ctime> // std::time
 #include <vector>
 #include <string>
 #include <sstream> // ostringstream
+#include <stdexcept> // logic_error
 #include <sys/stat.h> // stat
 
 #include <gdalwrap/gdal.hpp>
 
-#define DYNAMIC_MERGE
+namespace atlaas {
+
+static const std::vector<std::string> MAP_NAMES =
+     {"N_POINTS", "Z_MIN", "Z_MAX", "Z_MEAN", "VARIANCE", "LAST_UPDATE"};
+enum { N_POINTS,   Z_MIN,   Z_MAX,   Z_MEAN,   VARIANCE,   LAST_UPDATE,   N_RASTER};
+// internal use only
+enum { W_SUM=N_RASTER, N_INTERNAL}; // sum of weights (AGGREGATE_WEIGHTED)
+
+typedef std::array<double, 2> point_xy_t;   // XY (for UTM frame)
+typedef std::array<float,  3> point_xyz_t;  // XYZ (custom frame)
+typedef std::array<double, 16> matrix;      // transformation matrix
+typedef std::array<double, 6> pose6d;       // yaw,pitch,roll,x,y,z
+typedef std::vector<point_xyz_t> points;    // PointsXYZ
+typedef std::vector<double> stamps_t;       // per point time
+typedef std::vector<std::pair<double, matrix>> trajectory_t; // timed poses
+typedef std::array<float, N_INTERNAL> cell_info_t;
+typedef std::vector<cell_info_t> cells_info_t;
+typedef std::vector<bool> vbool_t; // altitude state (vertical or not)
+typedef std::array<int, 2> map_id_t; // submodels location
+typedef std::map<map_id_t, matrix> corrections_t; // per submodel correction
+typedef std::array<double, 4> roi_t; // x_min, y_min, x_max, y_max
+
+/**
+ * Merge policies, selected per instance (see atlaas::set_merge_policy)
+ */
+enum merge_policy_t {
+    STATIC_MERGE,   // points merged directly in internal
+    DYNAMIC_MERGE   // per scan merge with vertical/flat state (default)
+};
+struct static_merge;
+struct dynamic_merge;
+
+/**
+ * Aggregation policies, selected per instance (see atlaas::set_aggregate):
+ * how points are merged in a cell and how cells are combined.
+ *
+ * N_POINTS, Z_MIN and Z_MAX are always maintained, Z_MEAN holds the height
+ * the policy stands for. VARIANCE accumulates the sum of squared deviations
+ * until `finalize` turns it into the variance (see atlaas::variance_mean).
+ * Policies with `raw` cells only hold sums until finalized, whatever the
+ * number of points.
+ */
+enum aggregate_t {
+    AGGREGATE_MEAN,     // mean height (default)
+    AGGREGATE_MIN,      // lowest point, for ground estimation
+    AGGREGATE_MAX,      // highest point, for obstacle checks
+    AGGREGATE_LAST,     // latest point, for dynamic scenes
+    AGGREGATE_WEIGHTED, // mean weighted by 1/range^2 (range floored at 1m)
+    AGGREGATE_MOMENTS   // mean from raw moments, per scan (see below)
+};
+
+struct mean_aggregate {
+    static const bool weighted = false;
+    static const bool raw = false;
+
+    static void add(cell_info_t& info, float new_z, float) {
+        float z_mean, n_pts = info[N_POINTS];
+        if (n_pts < 1) {
+            info[N_POINTS] = 1;
+            info[Z_MAX]  = new_z;
+            info[Z_MIN]  = new_z;
+            info[Z_MEAN] = new_z;
+            info[VARIANCE] = 0;
+        } else {
+            z_mean = info[Z_MEAN];
+            // increment N_POINTS
+            info[N_POINTS]++;
+            // update Z_MAX
+            if (new_z > info[Z_MAX])
+                info[Z_MAX] = new_z;
+            // update Z_MIN
+            if (new_z < info[Z_MIN])
+                info[Z_MIN] = new_z;
+
+            /* Incremental mean and variance updates (according to Knuth's
+               bible, Vol. 2, section 4.2.2). The actual variance will later
+               be divided by the number of samples plus 1. */
+            info[Z_MEAN]    = (z_mean * n_pts + new_z) / info[N_POINTS];
+            info[VARIANCE] += (new_z - z_mean) * (new_z - info[Z_MEAN]);
+        }
+    }
+
+    static void combine(cell_info_t& dst, const cell_info_t& src) {
+        if ( dst[N_POINTS] < 1 ) {
+            dst = src;
+            return;
+        }
+        float z_mean, new_n_pts;
+
+        new_n_pts = src[N_POINTS] + dst[N_POINTS];
+        z_mean = dst[Z_MEAN];
+
+        if (dst[Z_MAX] < src[Z_MAX])
+            dst[Z_MAX] = src[Z_MAX];
+        if (dst[Z_MIN] > src[Z_MIN])
+            dst[Z_MIN] = src[Z_MIN];
+
+        dst[Z_MEAN] = ( (z_mean * dst[N_POINTS])
+                      + (src[Z_MEAN] * src[N_POINTS]) ) / new_n_pts;
+        // XXX compute the variance
+        //float d_mean = dst[Z_MEAN] - z_mean;
+        dst[VARIANCE] = ( src[VARIANCE] * src[VARIANCE] * src[N_POINTS]
+                        + dst[VARIANCE] * dst[VARIANCE] * dst[N_POINTS]
+        //              + d_mean * d_mean * src[N_POINTS] * dst[N_POINTS]
+        //                / new_n_pts
+                        ) / new_n_pts;
+        dst[N_POINTS] = new_n_pts;
+    }
+
+    static void finalize(cell_info_t& info) {
+        /* compute the real variance (according to Knuth's bible) */
+        info[VARIANCE] /= info[N_POINTS] - 1;
+    }
+};
+
+/**
+ * Height selected among the points (min, max, last), the variance is
+ * estimated from the spread as for a uniform distribution.
+ */
+template <class Select>
+struct select_aggregate {
+    static const bool weighted = false;
+    static const bool raw = false;
+
+    static void add(cell_info_t& info, float new_z, float) {
+        if (info[N_POINTS] < 1) {
+            info[N_POINTS] = 1;
+            info[Z_MAX]  = new_z;
+            info[Z_MIN]  = new_z;
+            info[Z_MEAN] = new_z;
+            info[VARIANCE] = 0;
+            return;
+        }
+        info[N_POINTS]++;
+        if (new_z > info[Z_MAX])
+            info[Z_MAX] = new_z;
+        if (new_z < info[Z_MIN])
+            info[Z_MIN] = new_z;
+        info[Z_MEAN] = Select::select(info[Z_MEAN], new_z);
+    }
+
+    static void combine(cell_info_t& dst, const cell_info_t& src) {
+        if ( dst[N_POINTS] < 1 ) {
+            dst = src;
+            return;
+        }
+        dst[N_POINTS] += src[N_POINTS];
+        if (dst[Z_MAX] < src[Z_MAX])
+            dst[Z_MAX] = src[Z_MAX];
+        if (dst[Z_MIN] > src[Z_MIN])
+            dst[Z_MIN] = src[Z_MIN];
+        dst[Z_MEAN] = Select::select(dst[Z_MEAN], src[Z_MEAN]);
+        finalize(dst);
+    }
+
+    static void finalize(cell_info_t& info) {
+        float spread = info[Z_MAX] - info[Z_MIN];
+        info[VARIANCE] = spread * spread / 12;
+    }
+};
+
+struct min_select {
+    static float select(float current, float new_z) {
+        return (new_z < current) ? new_z : current;
+    }
+};
+struct max_select {
+    static float select(float current, float new_z) {
+        return (new_z > current) ? new_z : current;
+    }
+};
+struct last_select {
+    static float select(float, float new_z) {
+        return new_z;
+    }
+};
+typedef select_aggregate<min_select>  min_aggregate;
+typedef select_aggregate<max_select>  max_aggregate;
+typedef select_aggregate<last_select> last_aggregate;
+
+/**
+ * Weighted mean and variance (West's incremental algorithm), W_SUM holds
+ * the sum of weights (N_POINTS for cells merged without weights).
+ */
+struct weighted_aggregate {
+    static const bool weighted = true;
+    static const bool raw = false;
+
+    /**
+     * weight of a point from its squared range to the sensor
+     */
+    static float weight(float range2) {
+        return 1 / ( (range2 > 1) ? range2 : 1 );
+    }
+
+    static float weight_sum(const cell_info_t& info) {
+        return (info[W_SUM] > 0) ? info[W_SUM] : info[N_POINTS];
+    }
+
+    static void add(cell_info_t& info, float new_z, float weight) {
+        if (info[N_POINTS] < 1) {
+            info[N_POINTS] = 1;
+            info[W_SUM]  = weight;
+            info[Z_MAX]  = new_z;
+            info[Z_MIN]  = new_z;
+            info[Z_MEAN] = new_z;
+            info[VARIANCE] = 0;
+            return;
+        }
+        float z_mean = info[Z_MEAN];
+        float w_sum = weight_sum(info) + weight;
+        info[N_POINTS]++;
+        info[W_SUM] = w_sum;
+        if (new_z > info[Z_MAX])
+            info[Z_MAX] = new_z;
+        if (new_z < info[Z_MIN])
+            info[Z_MIN] = new_z;
+        info[Z_MEAN]    = z_mean + (new_z - z_mean) * weight / w_sum;
+        info[VARIANCE] += weight * (new_z - z_mean) * (new_z - info[Z_MEAN]);
+    }
+
+    static void combine(cell_info_t& dst, const cell_info_t& src) {
+        if ( dst[N_POINTS] < 1 ) {
+            dst = src;
+            return;
+        }
+        float w_dst = weight_sum(dst), w_src = weight_sum(src);
+        float w_sum = w_dst + w_src;
+        float d_mean = src[Z_MEAN] - dst[Z_MEAN];
+        if (dst[Z_MAX] < src[Z_MAX])
+            dst[Z_MAX] = src[Z_MAX];
+        if (dst[Z_MIN] > src[Z_MIN])
+            dst[Z_MIN] = src[Z_MIN];
+        // pooled variance of the two (finalized) cells
+        dst[VARIANCE] = ( dst[VARIANCE] * w_dst + src[VARIANCE] * w_src )
+                      / w_sum + d_mean * d_mean * w_dst * w_src / (w_sum * w_sum);
+        dst[Z_MEAN] += d_mean * w_src / w_sum;
+        dst[N_POINTS] += src[N_POINTS];
+        dst[W_SUM] = w_sum;
+    }
+
+    static void finalize(cell_info_t& info) {
+        info[VARIANCE] *= info[N_POINTS]
+                        / (weight_sum(info) * (info[N_POINTS] - 1));
+    }
+};
+
+/**
+ * Exact sums of the heights of a cell and of their squares, in quanta of
+ * moments_aggregate::QUANTUM, kept aside of the float cells of a scan
+ * buffer (see cell_grid::sums_write)
+ */
+struct cell_moments_t {
+    int64_t sum;
+    int64_t sum2;
+};
+
+/**
+ * Mean and variance from raw moments: the cells of a scan buffer count
+ * the points (and their min and max), the sums of the heights and of
+ * their squares are integers in fixed point, aside. Adding a point has no
+ * division, and integer sums do not depend on the order of the points:
+ * a scan gives bit-identical cells whatever its order. Z_MEAN and
+ * VARIANCE are materialized once per cell by `finalize`, cells are then
+ * combined finalized (pooled variance, Chan et al.) in internal.
+ *
+ * Heights are rounded to the quantum (about 1mm), the sums hold 8M
+ * points per cell and per scan buffer for heights within 1km.
+ */
+struct moments_aggregate {
+    static const bool weighted = false;
+    static const bool raw = true;
+    static constexpr float QUANTUM = 1.0f / 1024; // meters, power of two
+
+    static void add(cell_info_t& info, cell_moments_t& sums, float new_z) {
+        if (info[N_POINTS] < 1) {
+            info[N_POINTS] = 1;
+            info[Z_MAX]  = new_z;
+            info[Z_MIN]  = new_z;
+            info[Z_MEAN] = 0;
+            info[W_SUM]  = 0;
+            info[VARIANCE] = 0;
+        } else {
+            info[N_POINTS]++;
+            if (new_z > info[Z_MAX])
+                info[Z_MAX] = new_z;
+            if (new_z < info[Z_MIN])
+                info[Z_MIN] = new_z;
+        }
+        int64_t q = std::llround(new_z / QUANTUM);
+        sums.sum  += q;
+        sums.sum2 += q * q;
+    }
+
+    /**
+     * sum of squared deviations of a finalized cell (the variance is not
+     * divided below 3 points, see atlaas::variance_mean)
+     */
+    static float deviations(const cell_info_t& info) {
+        return (info[N_POINTS] > 2) ? info[VARIANCE] * (info[N_POINTS] - 1)
+                                    : info[VARIANCE];
+    }
+
+    static void combine(cell_info_t& dst, const cell_info_t& src) {
+        if ( dst[N_POINTS] < 1 ) {
+            dst = src;
+            return;
+        }
+        float n_dst = dst[N_POINTS], n_src = src[N_POINTS];
+        float n_pts = n_dst + n_src;
+        float d_mean = src[Z_MEAN] - dst[Z_MEAN];
+        if (dst[Z_MAX] < src[Z_MAX])
+            dst[Z_MAX] = src[Z_MAX];
+        if (dst[Z_MIN] > src[Z_MIN])
+            dst[Z_MIN] = src[Z_MIN];
+        float m2 = deviations(dst) + deviations(src)
+                 + d_mean * d_mean * n_dst * n_src / n_pts;
+        dst[Z_MEAN] += d_mean * n_src / n_pts;
+        dst[N_POINTS] = n_pts;
+        dst[VARIANCE] = (n_pts > 2) ? m2 / (n_pts - 1) : m2;
+    }
+
+    /**
+     * materialize Z_MEAN and VARIANCE, and reset the sums
+     *
+     * With sum = a n + r, the deviations from a are an exact integer, the
+     * remainder r only comes in the last (floating point) correction.
+     */
+    static void finalize(cell_info_t& info, cell_moments_t& sums) {
+        int64_t n = info[N_POINTS];
+        int64_t a = sums.sum / n, r = sums.sum % n;
+        int64_t m2a = sums.sum2 - a * (sums.sum + r);
+        double m2 = (double(m2a) - double(r) * r / n) * QUANTUM * QUANTUM;
+        info[Z_MEAN] = (a + double(r) / n) * QUANTUM;
+        info[VARIANCE] = (n > 2) ? m2 / (n - 1) : m2;
+        sums = cell_moments_t();
+    }
+};
+
+/**
+ * Organized scan geometry (range image of rings x columns)
+ * precomputed once per sensor, angles in radians
+ */
+struct scan_tables {
+    size_t rings;
+    size_t columns;
+    std::vector<float> cos_el, sin_el; // per ring
+    std::vector<float> cos_az, sin_az; // per column
+
+    scan_tables(const std::vector<float>& elevations,
+                const std::vector<float>& azimuths) :
+            rings(elevations.size()), columns(azimuths.size()) {
+        for (float el : elevations) {
+            cos_el.push_back( std::cos(el) );
+            sin_el.push_back( std::sin(el) );
+        }
+        for (float az : azimuths) {
+            cos_az.push_back( std::cos(az) );
+            sin_az.push_back( std::sin(az) );
+        }
+    }
+};
+
+/**
+ * internal cells are grouped in square blocks of BLOCK_SIZE^2 cells
+ * (row-major blocks, edge blocks may be partial)
+ */
+const size_t BLOCK_SIZE = 64;
+
+/**
+ * Cells of a window, row-major
+ *
+ * Either a single allocation, or (blocked) bands of BLOCK_SIZE rows
+ * allocated independently, for very large windows. Rows are contiguous
+ * in both modes, and a vertical shift by whole bands only rotates them.
+ *
+ * Blocked bands are sparse: allocated (zeros) on first write access
+ * (at_write, row_write), from a pool of the bands released when cleared,
+ * so that unobserved regions cost no memory. Reads (operator[], row) see
+ * zeros in the absent bands and never allocate, and full passes skip
+ * them (see allocated).
+ */
+class cell_grid {
+    size_t width;
+    size_t height;
+    size_t band_rows;  // rows per band
+    size_t band_cells; // cells per band
+    bool sparse;       // bands allocated on first write access
+    std::vector<cells_info_t> bands; // empty if absent
+    std::vector<cells_info_t> pool;  // released bands, to reuse
+    cells_info_t zeros;              // a row, read in the absent bands
+    std::vector<cell_moments_t> sums; // moments_aggregate, dense if used
+    std::unique_ptr<std::mutex> allocating; // bands and pool
+    // bands[b].data(), NULL if absent, what the concurrent readers see
+    std::unique_ptr<std::atomic<cell_info_t*>[]> published;
+
+    const cell_info_t* cells(size_t b) const {
+        return published[b].load(std::memory_order_acquire);
+    }
+    void publish(size_t b) {
+        // data() of an empty vector is not necessarily NULL
+        published[b].store(bands[b].empty() ? NULL : bands[b].data(),
+                           std::memory_order_release);
+    }
+    void publish_all() {
+        published.reset( new std::atomic<cell_info_t*>[bands.size()] );
+        for (size_t b = 0; b < bands.size(); b++)
+            publish(b);
+    }
+
+    /**
+     * band b, allocated if absent (a band is zeroed before being
+     * published, for the concurrent readers)
+     */
+    cells_info_t& band(size_t b) {
+        if (sparse && cells(b) == NULL)
+            acquire(b);
+        return bands[b];
+    }
+    void acquire(size_t b);
+    void release(size_t b);
+
+public:
+    cell_grid() : width(0), height(0), band_rows(1), band_cells(0),
+                  sparse(false), allocating(new std::mutex) {}
+    cell_grid(const cell_grid& other) : width(other.width),
+            height(other.height), band_rows(other.band_rows),
+            band_cells(other.band_cells), sparse(other.sparse),
+            bands(other.bands), zeros(other.zeros), sums(other.sums),
+            allocating(new std::mutex) {
+        publish_all();
+    }
+    cell_grid(cell_grid&& other) = default;
+    cell_grid& operator=(const cell_grid& other) {
+        cell_grid copy(other);
+        return *this = std::move(copy);
+    }
+    cell_grid& operator=(cell_grid&& other) = default;
+
+    /**
+     * (re)allocate, all cells zeros
+     */
+    void assign(size_t w, size_t h, bool blocked = false) {
+        width  = w;
+        height = h;
+        band_rows  = blocked ? BLOCK_SIZE : std::max<size_t>(h, 1);
+        band_cells = band_rows * w;
+        sparse = blocked;
+        cell_info_t zero{}; // value-initialization w/empty initializer
+        zeros.assign(w, zero);
+        bands.clear();
+        pool.clear();
+        sums.clear();
+        bands.resize( (h + band_rows - 1) / band_rows );
+        if ( ! sparse )
+            for (auto& band : bands)
+                band.assign(band_cells, zero);
+        publish_all();
+    }
+
+    /**
+     * release the memory
+     */
+    void clear() {
+        width = height = band_cells = 0;
+        std::vector<cells_info_t>().swap(bands);
+        std::vector<cells_info_t>().swap(pool);
+        std::vector<cell_moments_t>().swap(sums);
+        published.reset();
+    }
+
+    size_t size() const {
+        return width * height;
+    }
+
+    /**
+     * the cells as one row-major vector, unless blocked (then throws
+     * std::logic_error)
+     */
+    const cells_info_t& contiguous() const {
+        static const cells_info_t none;
+        if (sparse)
+            throw std::logic_error("cell_grid: blocked, not contiguous");
+        return bands.empty() ? none : bands[0];
+    }
+
+    size_t get_width() const {
+        return width;
+    }
+
+    size_t get_height() const {
+        return height;
+    }
+
+    /**
+     * whether the band of row y is allocated, rows of absent bands are
+     * zeros (always true unless blocked)
+     */
+    bool allocated(size_t y) const {
+        return cells(y / band_rows) != NULL;
+    }
+
+    /**
+     * number of cells allocated (in use, not counting the pool)
+     */
+    size_t get_allocated() const {
+        size_t count = 0;
+        for (const auto& band : bands)
+            count += band.size();
+        return count;
+    }
+
+    const cell_info_t& operator[](size_t index) const {
+        if ( ! sparse )
+            return bands[0][index];
+        const cell_info_t* band = cells(index / band_cells);
+        return band ? band[index % band_cells] : zeros[0];
+    }
+
+    const cell_info_t* row(size_t y) const {
+        const cell_info_t* band = cells(y / band_rows);
+        return band ? band + (y % band_rows) * width : zeros.data();
+    }
+
+    /**
+     * cell or row to be written, allocating its band if absent
+     */
+    cell_info_t& at_write(size_t index) {
+        if ( ! sparse )
+            return bands[0][index];
+        return band(index / band_cells)[index % band_cells];
+    }
+    cell_info_t* row_write(size_t y) {
+        return &band(y / band_rows)[(y % band_rows) * width];
+    }
+
+    /**
+     * exact sums of a cell (moments_aggregate), allocated for the whole
+     * grid on first use, moved and cleared along with the cells
+     */
+    cell_moments_t& sums_write(size_t index) {
+        if ( sums.empty() )
+            sums.resize(width * height, cell_moments_t());
+        return sums[index];
+    }
+
+    void fill(const cell_info_t& value);
+
+    /**
+     * allocate every band, before writing from several threads
+     */
+    void allocate() {
+        for (size_t b = 0; b < bands.size(); b++)
+            band(b);
+    }
+
+    /**
+     * release the bands without any observed cell (N_POINTS)
+     */
+    void trim();
+
+    /**
+     * move the cells by (-dx, -dy), as for a window moving by (dx, dy),
+     * cells moved in are zeros
+     */
+    void shift(long dx, long dy);
+};
+
+/**
+ * add a point to a cell of a scan buffer, and finalize the cell, for any
+ * aggregation policy (moments_aggregate keeps its sums aside)
+ */
+template <class Aggregate>
+inline void add_point(cell_grid& cells, size_t index, float z,
+                      float weight) {
+    Aggregate::add(cells.at_write(index), z, weight);
+}
+template <>
+inline void add_point<moments_aggregate>(cell_grid& cells, size_t index,
+                                         float z, float) {
+    moments_aggregate::add(cells.at_write(index), cells.sums_write(index),
+                           z);
+}
+template <class Aggregate>
+inline void finalize_cell(cell_grid&, size_t, cell_info_t& info) {
+    Aggregate::finalize(info);
+}
+template <>
+inline void finalize_cell<moments_aggregate>(cell_grid& cells,
+        size_t index, cell_info_t& info) {
+    moments_aggregate::finalize(info, cells.sums_write(index));
+}
+
+/**
+ * Per block seqlocks over the internal cells
+ *
+ * Writers hold the block mutex and keep the version odd while writing.
+ * Readers copy optimistically and retry if the version changed, so they
+ * never block writers and only retry when they overlap a write.
+ * Also BasicLockable on all the blocks (in order), for whole map moves.
+ */
+class block_locks {
+    size_t count;
+    unsigned epoch; // number of resizes
+    std::unique_ptr<std::mutex[]> mutexes;
+    std::unique_ptr<std::atomic<unsigned>[]> versions;
+
+public:
+    block_locks() : count(0), epoch(0) {}
+
+    /**
+     * (re)allocate, not thread-safe
+     */
+    void resize(size_t n) {
+        count = n;
+        epoch++;
+        mutexes.reset( new std::mutex[n] );
+        versions.reset( new std::atomic<unsigned>[n] );
+        for (size_t block = 0; block < n; block++)
+            versions[block] = 0;
+    }
+
+    void lock(size_t block) {
+        mutexes[block].lock();
+        versions[block].store( versions[block].load(
+            std::memory_order_relaxed) + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void unlock(size_t block) {
+        versions[block].store( versions[block].load(
+            std::memory_order_relaxed) + 1, std::memory_order_release );
+        mutexes[block].unlock();
+    }
+
+    void lock() {
+        for (size_t block = 0; block < count; block++)
+            lock(block);
+    }
+
+    void unlock() {
+        for (size_t block = count; block-- > 0; )
+            unlock(block);
+    }
+
+    /**
+     * version to read the block at, waits for the writer if any
+     */
+    unsigned read_begin(size_t block) const {
+        unsigned version;
+        while ( (version = versions[block].load(
+                    std::memory_order_acquire)) & 1 )
+            std::this_thread::yield();
+        return version;
+    }
+
+    /**
+     * whether the block did not change since read_begin
+     */
+    bool read_end(size_t block, unsigned version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return versions[block].load(std::memory_order_relaxed) == version;
+    }
+
+    /**
+     * current version of the block, changes with every write (and slide)
+     */
+    unsigned version(size_t block) const {
+        return versions[block].load(std::memory_order_acquire);
+    }
+
+    /**
+     * changes with every (re)allocation, versions restart from zero
+     */
+    unsigned get_epoch() const {
+        return epoch;
+    }
+};
+
+/**
+ * Holds the lock of one block at a time, for ingestion loops: points of
+ * a scan are spatially coherent, the lock changes hands once per run.
+ * Released before anything that may wait on another block (the snapshot
+ * copy-on-write, see atlaas::_enter), so it cannot deadlock with writers
+ * locking several blocks in order.
+ */
+class block_guard {
+    block_locks& locks;
+    size_t held;
+
+public:
+    block_guard(block_locks& locks) : locks(locks),
+        held(std::numeric_limits<size_t>::max()) {}
+
+    ~block_guard() {
+        release();
+    }
+
+    bool holds(size_t block) const {
+        return block == held;
+    }
+
+    void enter(size_t block) {
+        if (block == held)
+            return;
+        release();
+        locks.lock(block);
+        held = block;
+    }
+
+    void release() {
+        if (held == std::numeric_limits<size_t>::max())
+            return;
+        locks.unlock(held);
+        held = std::numeric_limits<size_t>::max();
+    }
+};
+
+class tile_store; // see tile_store.hpp
+
+/**
+ * Per block ingestion statistics (see atlaas::set_heatmap)
+ *
+ * Points merged are counted per block, and the merge time is charged to
+ * the block of each run of consecutive points falling in the same block,
+ * so the clock is read once per run, not once per point.
+ */
+class heatmap {
+    size_t bw; // blocks per row
+    size_t bh; // blocks per column
+    std::vector<uint64_t> hits; // points merged
+    std::vector<uint64_t> cost; // nanoseconds
+    size_t run; // block of the current run
+    std::chrono::steady_clock::time_point start; // of the current run
+
+    void charge(std::chrono::steady_clock::time_point now) {
+        if (run != std::numeric_limits<size_t>::max())
+            cost[run] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                now - start).count();
+    }
+
+public:
+    heatmap() : bw(0), bh(0), run(std::numeric_limits<size_t>::max()) {}
+
+    /**
+     * (re)allocate, counters zeros
+     */
+    void resize(size_t w, size_t h) {
+        bw = w;
+        bh = h;
+        hits.assign(bw * bh, 0);
+        cost.assign(bw * bh, 0);
+    }
+
+    void reset() {
+        std::fill(hits.begin(), hits.end(), 0);
+        std::fill(cost.begin(), cost.end(), 0);
+    }
+
+    /**
+     * to be called before and after a merge loop
+     */
+    void begin() {
+        run = std::numeric_limits<size_t>::max();
+    }
+    void end() {
+        charge( std::chrono::steady_clock::now() );
+        run = std::numeric_limits<size_t>::max();
+    }
+
+    /**
+     * a point is about to be merged in the block
+     */
+    void hit(size_t block) {
+        if (block != run) {
+            auto now = std::chrono::steady_clock::now();
+            charge(now);
+            run = block;
+            start = now;
+        }
+        hits[block]++;
+    }
+
+    /**
+     * move the counters by (-dx, -dy) blocks, as for the window moving
+     */
+    void shift(long dx, long dy);
+
+    /**
+     * save as a raster of bw x bh pixels (one per block), georeferenced
+     * after the map: HITS (points), TIME (total ms), COST (ns per point)
+     */
+    void save(const std::string& filepath, const gdalwrap::gdal& map) const;
+
+    size_t get_width() const {
+        return bw;
+    }
+
+    size_t get_height() const {
+        return bh;
+    }
+
+    uint64_t get_hits(size_t block) const {
+        return hits[block];
+    }
+
+    uint64_t get_cost(size_t block) const {
+        return cost[block];
+    }
+};
+
+/**
+ * Cluster of 8-connected frontier cells (see atlaas::frontier_segments)
+ */
+struct frontier_segment_t {
+    std::vector<size_t> cells; // indices in the window
+    point_xy_t centroid;       // custom frame
+};
+
+/**
+ * Exploration frontier of the window (see atlaas::set_frontier): observed
+ * cells with an unknown 4-neighbour in the window
+ *
+ * Only the cells first observed by a merge and their neighbours can change
+ * state, so they are recorded while merging and re-evaluated on update.
+ * The frontier cells are kept in a list with their position in it per
+ * cell, for constant time insertion and removal. Wholesale changes of the
+ * window (load, slide, write_region) mark it stale, rebuilt on update.
+ */
+class frontier {
+    size_t width;
+    size_t height;
+    std::vector<size_t> position; // in cells, NONE if not a frontier cell
+    std::vector<size_t> cells;    // frontier cells, unordered
+    std::vector<size_t> seen;     // first observed since the last update
+    std::atomic<bool> stale;
+
+    void evaluate(const cell_grid& internal, size_t index);
+
+public:
+    static const size_t NONE = std::numeric_limits<size_t>::max();
+
+    frontier() : width(0), height(0), stale(true) {}
+
+    /**
+     * (re)allocate for a window of w x h cells, stale
+     */
+    void resize(size_t w, size_t h) {
+        width = w;
+        height = h;
+        position.assign(width * height, NONE);
+        cells.clear();
+        seen.clear();
+        stale = true;
+    }
+
+    /**
+     * a cell is about to get its first point
+     */
+    void observed(size_t index) {
+        seen.push_back(index);
+    }
+
+    /**
+     * the window changed wholesale, thread safe
+     */
+    void invalidate() {
+        stale = true;
+    }
+
+    /**
+     * apply the cells observed since the last update, or rebuild if stale
+     */
+    void update(const cell_grid& internal);
+
+    /**
+     * 8-connected clusters of at least min_size cells, O(frontier size)
+     */
+    std::vector<std::vector<size_t>> clusters(size_t min_size) const;
+
+    bool contains(size_t index) const {
+        return position[index] != NONE;
+    }
+
+    const std::vector<size_t>& get_cells() const {
+        return cells;
+    }
+};
+
+/**
+ * Statistics of a region of the window (see atlaas::region_stats)
+ */
+struct region_stats_t {
+    size_t cells;    // in the window
+    size_t observed; // cells with points
+    float z_min;     // of Z_MIN, NAN if none observed
+    float z_max;     // of Z_MAX, NAN if none observed
+    float z_mean;    // mean of Z_MEAN, NAN if none observed
+};
+
+class atlaas; // below
+
+/**
+ * Rectangle statistics tables (see atlaas::set_region_stats)
+ *
+ * Sums (observed cells, Z_MEAN) are prefix sums split in four terms:
+ * a summed-area table over the block totals, per block row and per block
+ * column the running sums of the block rows (columns), and a summed-area
+ * table within the block. Min and max are 2^k x 2^k square tables (up to
+ * BLOCK_SIZE), a rectangle being covered by a few, overlapping, squares
+ * of its smaller side. A block is recomputed when it or its right, lower
+ * and lower right neighbours changed (block versions), the squares
+ * reaching into them.
+ */
+class region_index {
+public:
+    static const size_t LEVELS = 7; // squares of 1 to BLOCK_SIZE cells
+
+private:
+    struct sums_t {
+        double count; // observed cells
+        double sum;   // of Z_MEAN
+    };
+    static const size_t SIDE = BLOCK_SIZE + 1; // of the prefix tables
+
+    size_t width;
+    size_t height;
+    size_t bw; // blocks per row
+    size_t bh; // blocks per column
+    unsigned epoch;   // of the block versions in the stamps
+    map_id_t current; // window the tables are in
+    std::vector<uint64_t> stamps;     // per block, 0 if not computed
+    std::vector<sums_t> local;        // per block, SIDE x SIDE
+    std::vector<sums_t> row_sums;     // per block row, SIDE x (bw + 1)
+    std::vector<sums_t> col_sums;     // per block column, SIDE x (bh + 1)
+    std::vector<sums_t> block_sums;   // (bh + 1) x (bw + 1)
+    std::vector<std::vector<float>> lows;  // per level, window
+    std::vector<std::vector<float>> highs; // per level, window
+
+    void reset(const atlaas& map);
+    sums_t prefix(size_t x, size_t y) const;
+
+public:
+    region_index() : width(0), height(0), bw(0), bh(0), epoch(0),
+                     current({{0, 0}}) {}
+
+    /**
+     * recompute the blocks changed since the last update, from the
+     * mapping thread
+     */
+    void update(const atlaas& map, size_t n_threads);
+
+    /**
+     * statistics of the cells [x, x + w) x [y, y + h) of the window, as of
+     * the last update: sums in constant time, min and max in
+     * ceil(w / s) * ceil(h / s) lookups, s being the side of the largest
+     * square fitting in (a power of two, up to BLOCK_SIZE), that is about
+     * the aspect ratio for footprints, but growing with the area beyond
+     * BLOCK_SIZE
+     */
+    region_stats_t stats(size_t x, size_t y, size_t w, size_t h) const;
+
+    /**
+     * add the statistics of a region to a total
+     */
+    static void combine(region_stats_t& total, const region_stats_t& part);
+};
+
+/**
+ * Copy-on-write snapshot of the internal cells, at block granularity
+ *
+ * Taking the snapshot is instant. A block is copied the first time it is
+ * either about to be modified (`touch`) or read (`read`), whichever comes
+ * first, so the reader always sees the content at snapshot time.
+ */
+class snapshot {
+    const cell_grid& cells;
+    const block_locks& locks;
+    size_t width;
+    size_t height;
+    size_t bw; // blocks per row
+    std::vector<cells_info_t> blocks; // copied blocks
+    std::unique_ptr<std::atomic<bool>[]> pending; // wanted, not yet copied
+    std::mutex mutex; // blocks and pending, never held while copying
+
+    void copy(size_t block, bool locked);
+
+public:
+    /**
+     * @param cells   live internal cells (must outlive the snapshot)
+     * @param locks   blocks seqlocks, blocks are copied as readers
+     * @param width   map width in cells
+     * @param height  map height in cells
+     * @param wanted  blocks belonging to the snapshot
+     */
+    snapshot(const cell_grid& cells, const block_locks& locks,
+             size_t width, size_t height, const std::vector<char>& wanted);
+
+    /**
+     * to be called by the writer before modifying a block
+     */
+    void touch(size_t block) {
+        if ( pending[block] )
+            copy(block, false);
+    }
+
+    /**
+     * same, the writer holding the lock of the block
+     */
+    void touch_locked(size_t block) {
+        if ( pending[block] )
+            copy(block, true);
+    }
+
+    /**
+     * read n cells of row y from column x, as they were at snapshot time
+     */
+    void read(size_t x, size_t y, size_t n, cell_info_t* out);
+};
+
+/**
+ * Custom frame -> pixel transform of the window, published to the sensor
+ * and preview threads (see atlaas::accumulate, atlaas::get_frame)
+ */
+struct sensor_frame_t {
+    point_xy_t origin; // pixel of the custom origin
+    double scale_x, scale_y;
+    map_id_t current; // window the pixels are in
+};
+
+/**
+ * Per sensor accumulation context (see atlaas::add_sensor)
+ *
+ * The sensor thread fills `filling` without locking. Every `merge_every`
+ * scans the batch is handed over to `ready` if the mapping thread is not
+ * busy with it (try_lock), otherwise the sensor keeps filling.
+ */
+struct sensor_context {
+    struct batch_t {
+        cell_grid cells;
+        map_id_t current; // window the cells are indexed in
+        point_xy_t pose;  // latest sensor position (custom frame)
+        size_t scans;
+    };
+    float variance_factor; // vertical threshold, times the variance mean
+    float noise;           // height noise (std dev, meters)
+    size_t merge_every;    // scans per batch
+    batch_t filling;       // owned by the sensor thread
+    batch_t ready;         // owned by whoever holds the mutex
+    std::mutex mutex;
+};
+
+/**
+ * Part of an export for one block of the window (see atlaas::export_mesh)
+ */
+struct geometry_block_t {
+    size_t block;        // in the window, row-major
+    size_t first_vertex; // in the vertex buffer
+    size_t n_vertices;
+    size_t first_index;  // in the index buffer
+    size_t n_indices;    // triangles, indices relative to first_vertex
+};
+
+/**
+ * Blocks versions already exported, one per viewer and per kind of export
+ */
+struct export_state {
+    unsigned epoch;
+    std::vector<unsigned> versions;
+
+    export_state() : epoch(0) {}
+};
+
+/**
+ * Neighbourhood of a cell, for derived layer kernels (see atlaas::add_layer)
+ */
+class stencil {
+    const cell_info_t* cells; // region read, row-major
+    long stride, rows;
+    long x, y;                // of the cell in the region
+    long margin;
+
+public:
+    stencil(const cell_info_t* _cells, size_t _stride, size_t _rows,
+            size_t _x, size_t _y, size_t _margin) : cells(_cells),
+        stride(_stride), rows(_rows), x(_x), y(_y), margin(_margin) {}
+
+    const cell_info_t& operator*() const {
+        return cells[y * stride + x];
+    }
+
+    /**
+     * neighbour (dx, dy) cells away, NULL beyond the window or the margin
+     */
+    const cell_info_t* at(long dx, long dy) const {
+        long nx = x + dx, ny = y + dy;
+        if ( std::labs(dx) > margin || std::labs(dy) > margin ||
+             nx < 0 || nx >= stride || ny < 0 || ny >= rows )
+            return NULL;
+        return cells + ny * stride + nx;
+    }
+};
+
+/**
+ * Value of a derived layer for a cell, called in parallel
+ */
+typedef std::function<float(const stencil&)> layer_kernel_t;
+
+/**
+ * Derived layer values over the window, computed per block on read
+ */
+struct derived_layer {
+    std::string name;
+    layer_kernel_t kernel;
+    size_t margin;              // reach of the kernel, in cells
+    std::vector<float> values;  // window, row-major
+    std::vector<uint64_t> stamps; // per block, 0 if not computed
+    unsigned epoch;             // of the block versions in the stamps
+    map_id_t current;           // window the values are in
+    std::mutex mutex;
+};
+
+/**
+ * Apply the transformation matrix to the point cloud (in place)
+ */
+void transform(points& cloud, const matrix& tr);
+
+/**
+ * atlaas
+ */
+class atlaas {
+    friend struct static_merge;
+    friend struct dynamic_merge;
+    friend struct static_scan_merge;
+    friend class region_index;
+
+    /**
+     * I/O data model
+     */
+    gdalwrap::gdal map;
+
+    /**
+     * internal data model
+     */
+    cell_grid     internal; // to merge dyninter
+    merge_policy_t policy; // dyninter, gndinter, vertical for DYNAMIC_MERGE
+    aggregate_t aggregate; // how points and cells are combined
+    cell_grid     gndinter; // ground info for vertical/flat unknown state
+    cell_grid     dyninter; // to merge point cloud
+    bool          blocked_storage; // window cells in bands of rows
+    vbool_t       vertical; // altitude state (vertical or not)
+    float         variance_factor;
+    float         vertical_slope; // tan of the ring slope threshold, 0 off
+    std::vector<char> ring_vertical; // per cell state from adjacent rings
+    bool          ring_classified; // use ring_vertical in merge()
+
+    /**
+     * current location in the submodels frame
+     */
+    map_id_t current;
+
+    /**
+     * need update I/O ?
+     */
+    std::atomic<bool> map_sync; // also cleared by regional writers
+
+    /**
+     * {x,y} map size
+     */
+    size_t width;
+    size_t height;
+
+    /**
+     * submodels data
+     */
+    size_t sw; // sub-width
+    size_t sh; // sub-height
+    std::unique_ptr<atlaas> sub;
+
+    /**
+     * single file container of the submodels, NULL for GeoTIFF files
+     * (shared with the background writer)
+     */
+    std::shared_ptr<tile_store> store;
+
+    /**
+     * submodels written, with the sequence number of their last write
+     * (see tiles_written), from the writer thread too
+     */
+    mutable std::mutex written_mutex;
+    mutable std::map<map_id_t, uint64_t> written;
+    mutable uint64_t written_seq;
+    void _written(const map_id_t& id) const;
+
+    /**
+     * {x,y} number of blocks
+     */
+    size_t bw;
+    size_t bh;
+
+    /**
+     * per block locks, for regional access concurrent with ingestion
+     */
+    block_locks locks;
+
+    /**
+     * per block ingestion statistics, NULL unless enabled (set_heatmap)
+     */
+    std::unique_ptr<heatmap> heat;
+
+    /**
+     * exploration frontier, NULL unless enabled (set_frontier)
+     */
+    std::unique_ptr<frontier> front;
 
-namespace atlaas {
+    /**
+     * rectangle statistics tables, NULL unless enabled (set_region_stats)
+     */
+    std::unique_ptr<region_index> stats_index;
 
-std::vector<std::string> MAP_NAMES =
-     {"N_POINTS", "Z_MIN", "Z_MAX", "Z_MEAN", "VARIANCE", "LAST_UPDATE"};
-enum { N_POINTS,   Z_MIN,   Z_MAX,   Z_MEAN,   VARIANCE,   LAST_UPDATE,   N_RASTER};
-// internal use only
-enum { N_INTERNAL=N_RASTER}; // enum { OTHER_FIELD=N_RASTER, N_INTERNAL};
+    /**
+     * registered derived layers (see add_layer)
+     */
+    std::vector<std::unique_ptr<derived_layer>> layers;
 
-typedef std::array<double, 2> point_xy_t;   // XY (for UTM frame)
-typedef std::array<float,  3> point_xyz_t;  // XYZ (custom frame)
-typedef std::array<double, 16> matrix;      // transformation matrix
-typedef std::array<double, 6> pose6d;       // yaw,pitch,roll,x,y,z
-typedef std::vector<point_xyz_t> points;    // PointsXYZ
-typedef std::array<float, N_INTERNAL> cell_info_t;
-typedef std::vector<cell_info_t> cells_info_t;
-typedef std::vector<bool> vbool_t; // altitude state (vertical or not)
-typedef std::array<int, 2> map_id_t; // submodels location
+    /**
+     * background save of submodels (copy-on-write snapshot), set by the
+     * mapping thread, atomic_load'ed by regional writers
+     */
+    mutable std::shared_ptr<snapshot> saving;
+    mutable std::thread writer;
+    mutable std::exception_ptr writer_error;
+    mutable std::vector<map_id_t> writing; // submodels being written
 
-/**
- * atlaas
- */
-class atlaas {
     /**
-     * I/O data model
+     * per sensor accumulation contexts, and the window transform they
+     * index their cells with
      */
-    gdalwrap::gdal map;
+    std::vector<std::unique_ptr<sensor_context>> sensors;
+    sensor_frame_t sensor_frame;
+    mutable std::mutex sensor_frame_mutex;
 
     /**
-     * internal data model
+     * publish the window transform to the sensor threads
      */
-    cells_info_t internal; // to merge dyninter
-    cells_info_t gndinter; // ground info for vertical/flat unknown state
-    cells_info_t dyninter; // to merge point cloud
-    vbool_t       vertical; // altitude state (vertical or not)
-    float         variance_factor;
+    void _publish_frame();
 
     /**
-     * current location in the submodels frame
+     * move cells indexed in the `from` window to the `to` window
      */
-    map_id_t current;
+    void _shift_cells(cell_grid& cells, const map_id_t& from,
+                      const map_id_t& to) const;
 
     /**
-     * need update I/O ?
+     * snapshot the given submodels and save them in background
      */
-    bool map_sync;
+    void save_async(const std::vector<map_id_t>& subs) const;
 
     /**
-     * {x,y} map size
+     * saved submodel backend (tile store or files): whether id is saved,
+     * load it in tile (false if none), write it (if pending, for the store,
+     * it only shows up at commit, files are written aside)
      */
-    size_t width;
-    size_t height;
+    bool sub_exists(const map_id_t& id) const;
+    bool sub_read(const map_id_t& id, atlaas& tile) const;
+    void sub_write(const map_id_t& id, const gdalwrap::gdal& tile,
+                   bool pending = false) const;
 
     /**
-     * submodels data
+     * block containing the cell at index
      */
-    int sw; // sub-width
-    int sh; // sub-height
-    std::unique_ptr<atlaas> sub;
+    size_t block_index(size_t index) const {
+        return (index / width / BLOCK_SIZE) * bw
+             + (index % width) / BLOCK_SIZE;
+    }
+
+    /**
+     * copy-on-write, to be called before modifying internal
+     */
+    void touch(size_t index) {
+        if (saving)
+            saving->touch( block_index(index) );
+    }
+    void touch(size_t x, size_t y, size_t w, size_t h);
+
+    /**
+     * copy-on-write and lock the block of a cell about to be written; the
+     * snapshot copies as a seqlock reader, waiting for the writers of the
+     * block, so no block is held meanwhile
+     */
+    void _enter(block_guard& guard, size_t index) {
+        const size_t block = block_index(index);
+        if ( guard.holds(block) )
+            return;
+        guard.release();
+        touch(index);
+        guard.enter(block);
+    }
 
     /**
      * time base
@@ -103,7 +1353,53 @@ class atlaas {
         return std::time(NULL) - time_base;
     }
 
+    /**
+     * (re)allocate the buffers needed by the merge policy
+     */
+    void _alloc_policy();
+
+    /**
+     * merge loops, instantiated per merge and aggregation policies,
+     * `_merge` dispatches on the aggregation policy
+     */
+    template <class Policy>
+    void _merge(const points& cloud, const matrix& sensor);
+    template <class Policy, class Aggregate>
+    void _merge_loop(const points& cloud, const matrix& sensor);
+    template <class Aggregate, bool copy_on_write>
+    void _merge_points(const points& cloud, cell_grid& inter,
+                       const matrix* sensor);
+    template <class Policy>
+    void _merge(const std::vector<float>& ranges, const scan_tables& tables,
+                const matrix& transformation);
+    template <class Policy, class Aggregate>
+    void _merge_loop(const std::vector<float>& ranges,
+                     const scan_tables& tables, const matrix& transformation);
+    template <class Aggregate>
+    void _merge_dynamic(cell_grid& inter, float factor, float noise);
+    void _merge_cells(cell_grid& inter, float factor, float noise);
+    void _combine_cells(cell_grid& inter);
+    template <class Aggregate>
+    void _accumulate(cell_grid& cells, const points& cloud,
+                     const sensor_frame_t& frame, const matrix& sensor);
+    template <class Aggregate>
+    float _variance_mean(cell_grid& inter);
+
+    /**
+     * slide and merge a cloud already in the custom frame
+     * (sensor being the sensor to world transformation)
+     */
+    void _merge_custom(const points& cloud, const matrix& sensor);
+
 public:
+    atlaas() : policy(DYNAMIC_MERGE), aggregate(AGGREGATE_MEAN),
+               blocked_storage(false), written_seq(1), bw(0), bh(0) {}
+
+    ~atlaas() {
+        if ( writer.joinable() )
+            writer.join();
+    }
+
     /**
      * init the georeferenced map meta-data
      * we recommend width and height being 3 times the range of the sensor
@@ -122,6 +1418,7 @@ public:
     void init(double size_x, double size_y, double scale,
               double custom_x, double custom_y, double utm_x, double utm_y,
               int utm_zone, bool utm_north = true) {
+        wait_saves();
         width  = std::ceil(size_x / scale);
         height = std::ceil(size_y / scale);
         map.set_size(N_RASTER, width, height);
@@ -130,7 +1427,14 @@ public:
         map.set_custom_origin(custom_x, custom_y);
         map.names = MAP_NAMES;
         // set internal points info structure size to map (gdal) size
-        internal.resize( width * height );
+        internal.assign(width, height, blocked_storage);
+        bw = (width  + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        bh = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        locks.resize(bw * bh);
+        if (heat)
+            heat->resize(bw, bh);
+        if (front)
+            front->resize(width, height);
         map_sync = true;
         current = {{0,0}};
         // load maplets if any
@@ -140,7 +1444,7 @@ public:
         sh = height / 3; // sub-height
         sub = std::move(std::unique_ptr<atlaas>(new atlaas));
         sub->map.copy_meta(map, sw, sh);
-        sub->internal.resize(sw * sh);
+        sub->internal.assign(sw, sh);
         sub_load(-1, -1);
         sub_load(-1,  0);
         sub_load(-1,  1);
@@ -150,14 +1454,13 @@ public:
         sub_load( 1, -1);
         sub_load( 1,  0);
         sub_load( 1,  1);
-#ifdef DYNAMIC_MERGE
-        // atlaas used for dynamic merge
-        dyninter.resize( width * height );
-        vertical.resize( width * height );
-        gndinter.resize( width * height );
+        // buffers used by the merge policy (dynamic merge)
+        _alloc_policy();
         variance_factor = 3.0;
-#endif
+        vertical_slope = 0;
+        ring_classified = false;
         time_base = std::time(NULL);
+        _publish_frame();
     }
 
     /**
@@ -172,10 +1475,186 @@ public:
         _fill_internal();
     }
 
+    /**
+     * init from a region of an exisiting (large) map
+     *
+     * Only the raster blocks covering the region are read, resampled at
+     * the given scale (nearest, GDAL uses the overviews if any), in
+     * parallel strips written straight in internal. Cells partly out of
+     * the raster are left unknown.
+     *
+     * @param filepath  georeferenced map with the atlaas bands
+     * @param roi       region of interest in the custom frame of the map
+     * @param scale     size of a pixel in meters
+     * @param n_threads number of readers (0 for hardware concurrency)
+     */
+    void init(const std::string& filepath, const roi_t& roi, double scale,
+              size_t n_threads = 0);
+
     void set_rotation(double rotation) {
         // TODO map.set_rotation(rotation);
     }
 
+    /**
+     * select how point clouds are merged, allocating only the buffers the
+     * policy needs (DYNAMIC_MERGE by default)
+     */
+    void set_merge_policy(merge_policy_t merge_policy) {
+        policy = merge_policy;
+        _alloc_policy();
+    }
+
+    merge_policy_t get_merge_policy() const {
+        return policy;
+    }
+
+    /**
+     * select how points and cells are aggregated (AGGREGATE_MEAN by default)
+     */
+    void set_aggregate(aggregate_t aggregate_policy) {
+        aggregate = aggregate_policy;
+    }
+
+    aggregate_t get_aggregate() const {
+        return aggregate;
+    }
+
+    /**
+     * Allocate the window cells in independent bands of BLOCK_SIZE rows
+     * instead of a single vector, for very large windows (100M cells).
+     * Bands are allocated on first write, so that the unobserved ones
+     * cost no memory and are skipped by update() and merge().
+     * Applies to the next init.
+     */
+    void set_blocked_storage(bool blocked) {
+        blocked_storage = blocked;
+    }
+
+    /**
+     * Save submodels in a single file container (see tile_store) instead of
+     * a GeoTIFF per submodel in the working directory, empty to go back to
+     * files. Submodels already saved are not moved from one to the other.
+     */
+    void set_tile_store(const std::string& filepath);
+
+    /**
+     * Saved submodels (tile store or working directory), to be called
+     * from the mapping thread after wait_saves
+     */
+    std::vector<map_id_t> saved_tiles() const;
+
+    /**
+     * Saved submodels written (or removed) after the sequence number
+     * `since`, which is moved to the latest one: to follow the changes
+     * without reloading every tile. Sequence numbers start after 1.
+     */
+    std::vector<map_id_t> tiles_written(uint64_t& since) const;
+
+    /**
+     * cells of a saved submodel (sw x sh, row-major), false if none
+     */
+    bool load_tile(const map_id_t& id, cells_info_t& cells) const;
+
+    /**
+     * Replace a saved submodel, and its cells in the window if it is one
+     * of the current submodels. From the mapping thread.
+     */
+    void save_tile(const map_id_t& id, const cells_info_t& cells);
+
+    /**
+     * Record per block point hits and merge time during ingestion (off by
+     * default), to see where ingestion time is spent spatially. Counters
+     * follow the window when it slides (to the nearest block if the
+     * submodel size is not a multiple of BLOCK_SIZE).
+     */
+    void set_heatmap(bool enabled) {
+        if (!enabled)
+            heat.reset();
+        else if (!heat) {
+            heat.reset(new heatmap);
+            heat->resize(bw, bh);
+        }
+    }
+
+    /**
+     * the ingestion statistics, NULL if disabled
+     */
+    const heatmap* get_heatmap() const {
+        return heat.get();
+    }
+
+    /**
+     * save the ingestion statistics as a low resolution raster (one pixel
+     * per block, see heatmap::save), next to the map
+     */
+    void save_heatmap(const std::string& filepath) const {
+        if (heat)
+            heat->save(filepath, map);
+    }
+
+    /**
+     * Maintain the exploration frontier (off by default): observed cells
+     * next to an unknown one, updated from the cells first observed by
+     * each merge, and rebuilt after a slide.
+     */
+    void set_frontier(bool enabled) {
+        if (!enabled)
+            front.reset();
+        else if (!front) {
+            front.reset(new frontier);
+            front->resize(width, height);
+            front->update(internal);
+        }
+    }
+
+    /**
+     * frontier cells (indices in the window), from the mapping thread
+     */
+    const std::vector<size_t>& get_frontier();
+
+    /**
+     * frontier segments of at least min_size cells, from the mapping
+     * thread, in O(frontier size)
+     */
+    std::vector<frontier_segment_t> frontier_segments(size_t min_size = 1);
+
+    /**
+     * Maintain tables for rectangle statistics (off by default, about 18
+     * floats per cell), for footprint checks at many candidate poses:
+     * sums in constant time, min and max in a few lookups for rectangles
+     * up to BLOCK_SIZE (see region_index::stats). Tables are brought up
+     * to date by update_region_stats, recomputing the blocks changed since.
+     */
+    void set_region_stats(bool enabled) {
+        if (!enabled)
+            stats_index.reset();
+        else if (!stats_index)
+            stats_index.reset(new region_index);
+    }
+
+    /**
+     * recompute the tables of the blocks changed since the last update
+     * (all of them after a slide), from the mapping thread
+     */
+    void update_region_stats(size_t n_threads = 0);
+
+    /**
+     * statistics of the window cells [x, x + w) x [y, y + h), as of the
+     * last update_region_stats (see region_index::stats)
+     */
+    region_stats_t region_stats(size_t x, size_t y, size_t w,
+                                size_t h) const;
+
+    /**
+     * statistics of an oriented rectangle in the custom frame (centre,
+     * yaw, length along yaw, breadth across), over the cells of a cover
+     * by axis-aligned strips of rows: conservative (the cells touched by
+     * the footprint and a few more if rotated), in a few lookups per strip
+     */
+    region_stats_t footprint_stats(double x, double y, double yaw,
+                                   double length, double breadth,
+                                   size_t strips = 8) const;
+
     void set_time_base(std::time_t base) {
         time_base = base;
     }
@@ -184,6 +1663,17 @@ public:
         variance_factor = factor;
     }
 
+    /**
+     * Classify vertical cells from the organized structure of range images
+     * instead of the variance threshold: a cell is vertical if the slope
+     * between the returns of two adjacent rings in the same column exceeds
+     * the given angle (radians). Rings of the range image must be sorted by
+     * elevation. 0 disables it (default).
+     */
+    void set_vertical_slope(float angle) {
+        vertical_slope = (angle > 0) ? std::tan(angle) : 0;
+    }
+
     /**
      * get a const ref on the map after updating its values
      */
@@ -203,11 +1693,31 @@ public:
     /**
      * get a const ref on the internal data (aligned points)
      * used for our local planner message conversion
+     *
+     * Throws std::logic_error with blocked storage, which is not
+     * contiguous: use get_internal_grid, or the copy below.
      */
     const cells_info_t& get_internal() const {
+        return internal.contiguous();
+    }
+
+    /**
+     * the internal data as stored, blocked or not
+     */
+    const cell_grid& get_internal_grid() const {
         return internal;
     }
 
+    /**
+     * copy of the internal data, row-major
+     */
+    void get_internal(cells_info_t& cells) const {
+        cells.resize(width * height);
+        for (size_t y = 0; y < height; y++)
+            std::copy(internal.row(y), internal.row(y) + width,
+                      cells.begin() + y * width);
+    }
+
     /**
      * Save Z_MEAN as a grayscale image (for display)
      */
@@ -223,6 +1733,11 @@ public:
     /**
      * merge point-cloud in internal structure
      */
+    void merge(const points& cloud, cell_grid& infos);
+    /**
+     * same in cells of the window size, row-major (copied in and out of a
+     * cell_grid, for the code written before it)
+     */
     void merge(const points& cloud, cells_info_t& infos);
 
     /**
@@ -230,33 +1745,261 @@ public:
      */
     void merge(points& cloud, const matrix& transformation);
 
+    /**
+     * deskew, merge, slide, save, load submodels
+     *
+     * For rotating sensors where a sweep spans some time, the sensor to
+     * world transformation is interpolated at each point stamp along the
+     * trajectory (sorted by time, translation lerp, rotation slerp).
+     *
+     * @param cloud       point cloud in the sensor frame
+     * @param stamps      time of each point (same base as the trajectory,
+     *                    absolute times are fine, in double)
+     * @param trajectory  sensor to world transformations during the sweep,
+     *                    throws std::runtime_error if empty
+     */
+    void merge(points& cloud, const stamps_t& stamps,
+               const trajectory_t& trajectory);
+    void merge(points& cloud, const stamps_t& stamps,
+               double start_time, const matrix& start,
+               double end_time,   const matrix& end) {
+        merge(cloud, stamps, {{ {start_time, start}, {end_time, end} }});
+    }
+
+    /**
+     * merge a range image, slide, save, load submodels
+     *
+     * Polar to cartesian conversion, transformation and cell indexing are
+     * fused in a single pass, no intermediate point cloud is built.
+     *
+     * @param ranges          range image (rings x columns, row-major),
+     *                        values <= 0 or NaN are no-returns
+     * @param tables          precomputed scan geometry
+     * @param transformation  sensor to world transformation
+     */
+    void merge(const std::vector<float>& ranges, const scan_tables& tables,
+               const matrix& transformation);
+
     /**
      * slide, save, load submodels
      */
     void slide_to(double robx, double roby);
     void sub_load(int sx, int sy);
-    void sub_save(int sx, int sy) const;
+    void sub_save(int sx, int sy) const {
+        save_async({ {{sx, sy}} });
+    }
     void save_currents() const {
-        sub_save(-1, -1);
-        sub_save(-1,  0);
-        sub_save(-1,  1);
-        sub_save( 0, -1);
-        sub_save( 0,  0);
-        sub_save( 0,  1);
-        sub_save( 1, -1);
-        sub_save( 1,  0);
-        sub_save( 1,  1);
+        save_async({ {{-1, -1}}, {{-1,  0}}, {{-1,  1}},
+                     {{ 0, -1}}, {{ 0,  0}}, {{ 0,  1}},
+                     {{ 1, -1}}, {{ 1,  0}}, {{ 1,  1}} });
+    }
+
+    /**
+     * Saves run in background on a copy-on-write snapshot of the submodels,
+     * wait for them to be written (rethrow the writer error if any).
+     */
+    void wait_saves() const;
+
+    /**
+     * re-anchor saved submodels after a trajectory correction (loop closure)
+     *
+     * Each corrected submodel is moved by its rigid correction (planar
+     * rotation, translation and Z offset, in the custom frame), resampled
+     * into the submodels it now overlaps, and merged with their content.
+     * Submodels are streamed from disk, only the affected ones are loaded,
+     * and the current window is saved before and reloaded after.
+     *
+     * @param corrections  rigid correction per submodel (absolute ids)
+     * @param n_threads    number of workers (0 for hardware concurrency)
+     */
+    void reanchor(const corrections_t& corrections, size_t n_threads = 0);
+
+    /**
+     * Regional access, concurrent with ingestion on the mapping thread
+     *
+     * Cells are in the current window (pixels), the window they were read
+     * in is returned, and a write only applies if the window did not slide
+     * meanwhile. Reads are optimistic (per block version stamps) and writes
+     * lock the blocks they cover, so both only contend with the ingestion
+     * when they overlap the cells being merged.
+     *
+     * @param x, y  top-left cell
+     * @param w, h  size of the region in cells
+     * @param cells region cells, row-major
+     */
+    map_id_t read_region(size_t x, size_t y, size_t w, size_t h,
+                         cells_info_t& cells) const;
+    bool write_region(size_t x, size_t y, size_t w, size_t h,
+                      const cells_info_t& cells, const map_id_t& window);
+
+    /**
+     * Per sensor accumulation, for multi-sensor rigs
+     *
+     * Each sensor gets its own buffer, filled from its own thread without
+     * locking (`accumulate`), and merged in internal by `merge_sensors`
+     * from the mapping thread every `merge_every` scans of the sensor.
+     * With DYNAMIC_MERGE, a cell of a batch is vertical if its variance
+     * exceeds `variance_factor` times the batch variance mean plus the
+     * sensor height noise variance.
+     *
+     * Sensors are to be added after init and before their threads start.
+     *
+     * @param variance_factor  vertical threshold (see set_variance_factor)
+     * @param noise            height noise of the sensor (std dev, meters)
+     * @param merge_every      number of scans merged as a batch
+     * @returns the sensor id
+     */
+    size_t add_sensor(float variance_factor = 3.0, float noise = 0,
+                      size_t merge_every = 1);
+
+    /**
+     * transform and accumulate a cloud in the sensor buffer
+     * (thread-safe for distinct sensors, concurrent with merge_sensors)
+     *
+     * The window only slides in merge_sensors, points outside of it at
+     * accumulation time are dropped.
+     *
+     * @param sensor          sensor id
+     * @param cloud           point cloud in the sensor frame
+     * @param transformation  sensor to world transformation
+     */
+    void accumulate(size_t sensor, points& cloud,
+                    const matrix& transformation);
+
+    /**
+     * slide and merge the batches handed over by the sensors
+     * @returns the number of batches merged
+     */
+    size_t merge_sensors();
+
+    /**
+     * the window transform as last published (thread-safe)
+     */
+    sensor_frame_t get_frame() const {
+        std::lock_guard<std::mutex> lock(sensor_frame_mutex);
+        return sensor_frame;
+    }
+
+    /**
+     * window size in cells
+     */
+    size_t get_width() const {
+        return width;
+    }
+
+    size_t get_height() const {
+        return height;
+    }
+
+    /**
+     * submodels size in cells
+     */
+    size_t get_sub_width() const {
+        return sw;
+    }
+
+    size_t get_sub_height() const {
+        return sh;
     }
 
     /**
-     * dynamic merge of cloud in custom frame
+     * Blocks changed since the last call with the same state (all of them
+     * after a slide or an init), then remember the current versions.
+     * Versions are taken before the caller reads the cells, so a write
+     * meanwhile shows up in the next call.
+     */
+    std::vector<char> changed_blocks(export_state& state) const;
+
+    /**
+     * Geometry export for display, of the blocks changed since the last
+     * export with the same state (all of them after a slide or an init)
+     *
+     * Buffers are cleared and filled with the changed blocks only, each
+     * block listed even if empty so that the viewer drops its previous
+     * geometry. Vertices are cell centres in the custom frame, Z_MEAN for
+     * the height, cells without points are left out.
+     * To be called from the mapping thread, as get().
+     *
+     * @param state     blocks exported so far, updated
+     * @param vertices  vertex buffer (x, y, z)
+     * @param blocks    per block ranges in the buffers
+     * @returns the number of blocks exported
+     */
+    size_t export_points(export_state& state, points& vertices,
+                         std::vector<geometry_block_t>& blocks) const;
+
+    /**
+     * Same as export_points, triangulated: the cell centres of a block
+     * and of the next row and column are meshed as a quadtree, a square
+     * being kept as two triangles as long as its cells are known and lie
+     * within `tolerance` (meters) of the bilinear surface of its corners.
+     * Flat areas end up with a few large triangles, T-junctions between
+     * levels leave gaps bounded by the tolerance.
+     *
+     * @param indices  index buffer, triangles counter-clockwise from above
+     */
+    size_t export_mesh(export_state& state, points& vertices,
+                       std::vector<uint32_t>& indices,
+                       std::vector<geometry_block_t>& blocks,
+                       float tolerance = 0.05) const;
+
+    /**
+     * Register a derived layer, for instance a traversability cost: the
+     * kernel gives the value of a cell from the cells up to `margin`
+     * cells away. Values are computed on read only (read_layer), per
+     * block, and cached until a block within the margin changes.
+     *
+     * @returns the layer index
+     */
+    size_t add_layer(const std::string& name, const layer_kernel_t& kernel,
+                     size_t margin = 0);
+
+    /**
+     * layer index of name, throws std::out_of_range if none
+     */
+    size_t get_layer_index(const std::string& name) const;
+
+    /**
+     * Read a region of a derived layer (row-major), computing the blocks
+     * it covers that are stale, in parallel. Thread-safe with the
+     * ingestion (cells are read as a regional reader).
+     *
+     * @param n_threads  number of workers (0 for hardware concurrency)
+     * @returns the window the values are in
+     */
+    map_id_t read_layer(size_t layer, size_t x, size_t y, size_t w, size_t h,
+                        std::vector<float>& values,
+                        size_t n_threads = 0) const;
+
+    /**
+     * Viewshed of a sensor over the window, by parallel radial sweep
+     *
+     * A cell is visible if the line of sight from the sensor to the top
+     * of the cell (height from `band`) passes above the cells in between.
+     * Unknown cells do not hide, and are seen as flat as the last known
+     * cell on the line of sight (what the sensor would see of them).
+     * Reads internal as a regional reader.
+     *
+     * @param sensor     sensor position in the custom frame
+     * @param range      max distance in meters (0 for no limit)
+     * @param visible    per cell of the window, row-major (resized)
+     * @param band       Z_MAX (obstacles tops) or Z_MEAN
+     * @param n_threads  number of workers (0 for hardware concurrency)
+     * @returns the number of visible cells
+     */
+    size_t viewshed(const point_xyz_t& sensor, double range,
+                    std::vector<char>& visible, int band = Z_MAX,
+                    size_t n_threads = 0) const;
+
+    /**
+     * dynamic merge of cloud in custom frame (DYNAMIC_MERGE policy)
      */
     void dynamic(const points& cloud);
 
     /**
      * compute real variance and return the mean
      */
-    float variance_mean(cells_info_t& inter);
+    float variance_mean(cell_grid& inter);
 
     /**
      * merge existing dtm for dynamic merge
@@ -265,6 +2008,24 @@ public:
     void merge(cell_info_t& dst, const cell_info_t& src);
 };
 
+/**
+ * Run jobs [0, n) on n_threads, the caller being one of them
+ */
+template <class Job>
+void parallel_jobs(size_t n, size_t n_threads, const Job& job) {
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t k = next++; k < n; k = next++)
+            job(k);
+    };
+    std::vector<std::thread> workers;
+    for (size_t wid = 1; wid < std::min(n_threads, n); wid++)
+        workers.push_back(std::thread(worker));
+    worker();
+    for (auto& thread : workers)
+        thread.join();
+}
+
 /**
  * Returns weither the file exists or not on POSIX systems (use <sys/stat.h>)
  */
@@ -279,6 +2040,20 @@ inline std::string sub_name(int x, int y) {
     return oss.str();
 }
 
+inline std::string sub_name(const map_id_t& id) {
+    return sub_name(id[0], id[1]);
+}
+
+/**
+ * Pixel -> custom frame (gdalwrap only provides the other way round)
+ */
+inline point_xy_t point_pix2custom(const gdalwrap::gdal& map,
+                                   double x, double y) {
+    const point_xy_t& origin = map.point_custom2pix(0, 0);
+    return {{ (x - origin[0]) * map.get_scale_x(),
+              (y - origin[1]) * map.get_scale_y() }};
+}
+
 /**
  * Transformation helpers
  */
@@ -325,6 +2100,79 @@ inline matrix pose6d_to_matrix(const pose6d& pose) {
     return pose6d_to_matrix(pose[0], pose[1], pose[2], pose[3], pose[4], pose[5]);
 }
 
+/**
+ * Interpolate between two transformations
+ * (linear for the translation, spherical for the rotation)
+ *
+ * @param ratio  0 gives `from`, 1 gives `to`
+ */
+inline matrix interpolate(const matrix& from, const matrix& to,
+                          double ratio) {
+    // rotation matrix -> quaternion (w,x,y,z)
+    auto quat = [](const matrix& m) -> std::array<double, 4> {
+        double tr = m[0] + m[5] + m[10], s;
+        if (tr > 0) {
+            s = 2 * sqrt(tr + 1);
+            return {{ s / 4, (m[9] - m[6]) / s, (m[2] - m[8]) / s,
+                      (m[4] - m[1]) / s }};
+        } else if (m[0] > m[5] && m[0] > m[10]) {
+            s = 2 * sqrt(1 + m[0] - m[5] - m[10]);
+            return {{ (m[9] - m[6]) / s, s / 4, (m[1] + m[4]) / s,
+                      (m[2] + m[8]) / s }};
+        } else if (m[5] > m[10]) {
+            s = 2 * sqrt(1 + m[5] - m[0] - m[10]);
+            return {{ (m[2] - m[8]) / s, (m[1] + m[4]) / s, s / 4,
+                      (m[6] + m[9]) / s }};
+        } else {
+            s = 2 * sqrt(1 + m[10] - m[0] - m[5]);
+            return {{ (m[4] - m[1]) / s, (m[2] + m[8]) / s,
+                      (m[6] + m[9]) / s, s / 4 }};
+        }
+    };
+    std::array<double, 4> qa = quat(from), qb = quat(to), q;
+    double dot = qa[0]*qb[0] + qa[1]*qb[1] + qa[2]*qb[2] + qa[3]*qb[3];
+    double sign = (dot < 0) ? -1 : 1, wa, wb;
+    dot *= sign;
+    if (dot > 0.9995) { // close enough for linear interpolation
+        wa = 1 - ratio;
+        wb = ratio;
+    } else {
+        double theta = acos(dot);
+        wa = sin((1 - ratio) * theta) / sin(theta);
+        wb = sin(ratio * theta) / sin(theta);
+    }
+    double norm = 0;
+    for (int i = 0; i < 4; i++) {
+        q[i] = wa * qa[i] + wb * sign * qb[i];
+        norm += q[i] * q[i];
+    }
+    norm = sqrt(norm);
+    double w = q[0] / norm, x = q[1] / norm, y = q[2] / norm, z = q[3] / norm;
+
+    matrix mat;
+    mat[0]  = 1 - 2*(y*y + z*z);
+    mat[1]  = 2*(x*y - z*w);
+    mat[2]  = 2*(x*z + y*w);
+    mat[3]  = from[3]  + ratio * (to[3]  - from[3]);
+
+    mat[4]  = 2*(x*y + z*w);
+    mat[5]  = 1 - 2*(x*x + z*z);
+    mat[6]  = 2*(y*z - x*w);
+    mat[7]  = from[7]  + ratio * (to[7]  - from[7]);
+
+    mat[8]  = 2*(x*z - y*w);
+    mat[9]  = 2*(y*z + x*w);
+    mat[10] = 1 - 2*(x*x + y*y);
+    mat[11] = from[11] + ratio * (to[11] - from[11]);
+
+    mat[12] = 0.0;
+    mat[13] = 0.0;
+    mat[14] = 0.0;
+    mat[15] = 1.0;
+
+    return mat;
+}
+
 /**
  * Matrix[16] -> Pose6d(yaw,pitch,roll,x,y,z)
  */
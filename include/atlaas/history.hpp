@@ -0,0 +1,111 @@
+/*
+ * history.hpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#ifndef ATLAAS_HISTORY_HPP
+#define ATLAAS_HISTORY_HPP
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+/**
+ * Versions of the window for after-action review, block by block with
+ * structural sharing: a version only copies the blocks changed since the
+ * previous one (all of them after a slide), the others are shared.
+ *
+ * Versions are taken as a regional reader, each block is consistent, and
+ * the whole version too when committed from the mapping thread.
+ */
+class map_history {
+    typedef std::shared_ptr<const cells_info_t> block_ptr;
+    struct version_t {
+        double time;
+        map_id_t current;        // window of the version
+        size_t width, height;    // of the window
+        size_t bw;               // blocks per row
+        std::vector<block_ptr> blocks;
+    };
+
+    std::deque<version_t> versions;
+    export_state state;          // block versions of the newest one
+    size_t max_versions;
+    double max_age;
+
+    void retain();
+
+public:
+    /**
+     * @param max_versions  versions kept, oldest dropped first (0: no limit)
+     * @param max_age       seconds kept before the newest version (0: no
+     *                      limit)
+     */
+    map_history(size_t max_versions = 0, double max_age = 0) :
+        max_versions(max_versions), max_age(max_age) {}
+
+    void set_retention(size_t _max_versions, double _max_age) {
+        max_versions = _max_versions;
+        max_age = _max_age;
+        retain();
+    }
+
+    /**
+     * add a version of the window at `time` (increasing)
+     * @returns the number of blocks copied
+     */
+    size_t commit(const atlaas& source, double time);
+
+    size_t size() const {
+        return versions.size();
+    }
+
+    double get_time(size_t version) const {
+        return versions.at(version).time;
+    }
+
+    /**
+     * the newest version at or before time, throws std::out_of_range if
+     * there is none
+     */
+    size_t find(double time) const;
+
+    /**
+     * window of a version and its size in cells
+     */
+    const map_id_t& get_window(size_t version) const {
+        return versions.at(version).current;
+    }
+
+    size_t get_width(size_t version) const {
+        return versions.at(version).width;
+    }
+
+    size_t get_height(size_t version) const {
+        return versions.at(version).height;
+    }
+
+    /**
+     * cells of a region of a version (row-major), as read_region
+     */
+    void read_region(size_t version, size_t x, size_t y, size_t w, size_t h,
+                     cells_info_t& cells) const;
+
+    /**
+     * distinct blocks held by all the versions (memory is about that times
+     * BLOCK_SIZE^2 cells)
+     */
+    size_t get_blocks() const;
+};
+
+} // namespace atlaas
+
+#endif // ATLAAS_HISTORY_HPP
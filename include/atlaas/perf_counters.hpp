@@ -0,0 +1,62 @@
+/*
+ * perf_counters.hpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#ifndef ATLAAS_PERF_COUNTERS_HPP
+#define ATLAAS_PERF_COUNTERS_HPP
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace atlaas {
+
+/**
+ * Hardware counters (see perf_counters)
+ */
+static const std::vector<std::string> PERF_NAMES = {"cycles",
+    "instructions", "llc_misses", "dtlb_misses", "branch_misses"};
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_DTLB_MISSES,
+       PERF_BRANCH_MISSES, N_PERF };
+
+typedef std::array<double, N_PERF> perf_values_t;
+
+/**
+ * Linux perf_event_open counters of the calling thread and of the threads
+ * it creates afterwards (user space only). Counters the kernel or the CPU
+ * does not provide are left out (see available), and counts are scaled
+ * when the kernel had to multiplex them. No-op on other systems.
+ */
+class perf_counters {
+    std::array<int, N_PERF> fds;
+
+public:
+    perf_counters();
+    ~perf_counters();
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool available(int counter) const {
+        return fds[counter] >= 0;
+    }
+
+    /**
+     * reset and start counting
+     */
+    void start();
+    void stop();
+
+    /**
+     * counts between start and stop, NaN if not available
+     */
+    perf_values_t read() const;
+};
+
+} // namespace atlaas
+
+#endif // ATLAAS_PERF_COUNTERS_HPP
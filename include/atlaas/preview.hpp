@@ -0,0 +1,106 @@
+/*
+ * preview.hpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#ifndef ATLAAS_PREVIEW_HPP
+#define ATLAAS_PREVIEW_HPP
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+/**
+ * Preview layers, one tile pyramid each
+ */
+static const std::vector<std::string> PREVIEW_NAMES =
+     {"height", "shade", "vertical"};
+enum { PREVIEW_HEIGHT, PREVIEW_SHADE, PREVIEW_VERTICAL, N_PREVIEW };
+
+const size_t TILE_SIZE = 256; // pixels
+
+/**
+ * Encode an RGBA image as PNG, with stored (uncompressed) deflate blocks:
+ * no compression to pay for, the encoding is a copy plus the checksums
+ */
+void png_encode(const uint8_t* rgba, size_t width, size_t height,
+                std::vector<uint8_t>& png);
+
+/**
+ * Decode a PNG written by png_encode (RGBA, stored blocks, no filter),
+ * false for any other
+ */
+bool png_decode(const std::vector<uint8_t>& png, size_t width,
+                size_t height, uint8_t* rgba);
+
+/**
+ * Live preview of the map as XYZ-style tile pyramids of PNG images,
+ * `directory/<layer>/<z>/<x>/<y>.png`, per layer:
+ *  - height: Z_MEAN colour-mapped from blue (z_min) to red (z_max)
+ *  - shade: hillshade of Z_MEAN, lit from the north-west
+ *  - vertical: cells whose height spread (Z_MAX - Z_MIN) exceeds `step`
+ * Unknown cells are transparent. The finest level (z = levels - 1) has a
+ * pixel per cell, each level above halves the resolution. Tiles are in
+ * the global grid of the submodels (as for tile_server), so they remain
+ * valid when the window slides.
+ *
+ * Only the tiles over the blocks changed since the previous render are
+ * rendered again, in parallel, each level from the one below. Tiles over
+ * the window are kept in memory for that, the parts of a tile out of the
+ * window keep the pixels they had: a tile not in memory (after a slide,
+ * or a restart) is read back from its PNG first.
+ */
+class tile_renderer {
+    typedef std::array<long, 3> tile_id_t; // level, x, y
+    typedef std::vector<uint8_t> image_t;  // RGBA
+    struct tile_t {
+        image_t layers[N_PREVIEW];
+    };
+
+    std::string directory;
+    float z_min;
+    float z_max;
+    size_t levels;
+    float step;
+    export_state state; // blocks rendered so far
+    std::map<tile_id_t, tile_t> tiles;
+
+    std::string path(const tile_id_t& id, size_t layer) const;
+    void read(const tile_id_t& id, tile_t& tile) const;
+    void write(const tile_id_t& id, const tile_t& tile) const;
+
+public:
+    /**
+     * @param directory  root of the pyramids
+     * @param z_min      height of the first colour (blue)
+     * @param z_max      height of the last colour (red)
+     * @param levels     number of levels of the pyramids
+     * @param step       vertical mask threshold (meters)
+     */
+    tile_renderer(const std::string& directory, float z_min, float z_max,
+                  size_t levels = 4, float step = 0.3);
+
+    /**
+     * render the tiles changed since the previous call, thread-safe with
+     * the ingestion (cells are read as a regional reader)
+     *
+     * @param source     the map
+     * @param n_threads  number of workers (0 for hardware concurrency)
+     * @returns the number of tiles written, all levels
+     */
+    size_t render(const atlaas& source, size_t n_threads = 0);
+};
+
+} // namespace atlaas
+
+#endif // ATLAAS_PREVIEW_HPP
@@ -0,0 +1,188 @@
+/*
+ * tile_server.hpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#ifndef ATLAAS_TILE_SERVER_HPP
+#define ATLAAS_TILE_SERVER_HPP
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "atlaas/atlaas.hpp"
+#include "atlaas/tile_store.hpp"
+
+namespace atlaas {
+
+/**
+ * Binary protocol over a Unix domain socket (host byte order, local only)
+ *
+ * A request is answered by a response header followed by its payload:
+ *  - REGION: N_RASTER bands of width x height floats (band-major), cells
+ *    in the global grid (submodel [x,y] cell [i,j] being x * sw + i,
+ *    y * sh + j), unknown cells are zeros, at most TILE_MAX_CELLS cells
+ *  - DELTA: `count` tile_change_t of the submodels changed since the
+ *    given generation
+ */
+const uint32_t TILE_MAGIC = 0x41544c53; // "ATLS"
+const uint64_t TILE_MAX_CELLS = 1 << 22; // per REGION request (~100MB)
+enum { TILE_REGION = 1, TILE_DELTA = 2 };
+enum { TILE_OK = 0, TILE_ERROR = 1 };
+
+struct tile_request_t {
+    uint32_t magic;
+    uint32_t type;
+    int32_t  x, y;          // REGION: top-left cell
+    uint32_t width, height; // REGION: size in cells
+    uint64_t since;         // DELTA: generation known by the client
+};
+
+struct tile_response_t {
+    uint32_t magic;
+    uint32_t status;
+    uint32_t width, height, n_bands; // REGION payload
+    uint32_t count;                  // DELTA payload
+    uint64_t generation;             // server generation
+};
+
+struct tile_change_t {
+    int32_t  x, y; // submodel
+    uint64_t generation;
+};
+
+/**
+ * LRU cache of submodels loaded from a directory of GeoTIFF files, or
+ * from a tile store followed read only (see atlaas::set_tile_store), kept
+ * coherent through the modification time of the files, or the sequence
+ * of the records of the store
+ */
+class tile_cache {
+    struct entry_t {
+        int64_t stamp; // modification time (ns) or sequence, 0 if removed
+        uint64_t generation;
+        gdalwrap::rasters bands; // empty if evicted or no file
+        std::list<map_id_t>::iterator lru;
+        bool cached;
+    };
+    std::string directory;
+    std::unique_ptr<tile_store> store; // NULL for a directory
+    size_t capacity;
+    size_t sw, sh; // submodels size (from the first loaded)
+    uint64_t generation;
+    std::map<map_id_t, entry_t> entries;
+    std::list<map_id_t> lru; // most recent first
+
+    std::string path(const map_id_t& id) const {
+        return directory + "/" + sub_name(id);
+    }
+    int64_t stamp(const map_id_t& id) const;
+    void scan_directory(std::map<map_id_t, int64_t>& found) const;
+    void evict();
+    void refresh(const map_id_t& id, int64_t stamp);
+
+public:
+    /**
+     * @param path  tiles directory, or tile store file
+     */
+    tile_cache(const std::string& path, size_t capacity = 64);
+
+    /**
+     * rescan the directory (or the store), bump the generation of changed
+     * submodels
+     */
+    void scan();
+
+    /**
+     * get a submodel, NULL if none (valid until the next call)
+     */
+    const gdalwrap::rasters* get(const map_id_t& id);
+
+    /**
+     * fill a region of the global grid (N_RASTER bands, band-major),
+     * throws std::length_error above TILE_MAX_CELLS
+     */
+    void region(int x, int y, size_t width, size_t height,
+                std::vector<float>& data);
+
+    /**
+     * submodels changed since the given generation
+     */
+    std::vector<tile_change_t> delta(uint64_t since) const;
+
+    uint64_t get_generation() const {
+        return generation;
+    }
+};
+
+/**
+ * Serve a tile directory (or store) over a Unix domain socket
+ *
+ * Clients are non-blocking: their requests and responses are buffered, so
+ * a slow (or stalled) client never holds the others.
+ */
+class tile_server {
+    struct client_t {
+        std::vector<char> input;  // start of the next requests
+        std::vector<char> output; // response being sent
+        size_t sent;              // bytes of output already sent
+        bool closing;             // once output is sent (bad request)
+        client_t() : sent(0), closing(false) {}
+    };
+    tile_cache cache;
+    std::string socket_path;
+    int listen_fd;
+    std::map<int, client_t> clients;
+
+    bool handle(const tile_request_t& req, std::vector<char>& output);
+    void serve(client_t& client);
+    bool receive(int fd, client_t& client);
+    bool flush(int fd, client_t& client);
+
+public:
+    tile_server(const std::string& socket_path, const std::string& path,
+                size_t cache_size = 64);
+    ~tile_server();
+
+    /**
+     * serve requests until `stop` becomes true (checked every timeout ms)
+     */
+    void run(const volatile bool& stop, int timeout = 500);
+};
+
+/**
+ * Client side of the tile protocol
+ */
+class tile_client {
+    int fd;
+
+    tile_response_t request(const tile_request_t& req);
+
+public:
+    tile_client(const std::string& socket_path);
+    ~tile_client();
+
+    /**
+     * get a region of the global grid (N_RASTER bands, band-major)
+     * @returns the server generation
+     */
+    uint64_t region(int x, int y, size_t width, size_t height,
+                    std::vector<float>& data);
+
+    /**
+     * get the submodels changed since the given generation
+     * @returns the server generation
+     */
+    uint64_t delta(uint64_t since, std::vector<tile_change_t>& changes);
+};
+
+} // namespace atlaas
+
+#endif // ATLAAS_TILE_SERVER_HPP
@@ -0,0 +1,160 @@
+/*
+ * tile_store.hpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#ifndef ATLAAS_TILE_STORE_HPP
+#define ATLAAS_TILE_STORE_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+/**
+ * File layout (host byte order): a header, then a log of records, each
+ * a store_record_t followed by its payload (8 bytes aligned)
+ *  - TILE: n_bands x width x height floats (band-major), or if SPARSE,
+ *    a mask of the blocks of BLOCK_SIZE^2 cells (a byte per block,
+ *    row-major, 4 bytes aligned), then per band the rows of the blocks
+ *    present, block after block; absent blocks are zeros
+ *  - REMOVE: no payload
+ *  - COMMIT: applies the PENDING records since the previous commit
+ * The latest record of a submodel wins. A truncated record at the end
+ * (interrupted write) is dropped when opening, and so are the PENDING
+ * records not followed by a commit (the file is compacted).
+ */
+const char STORE_MAGIC[8] = {'A', 'T', 'L', 'A', 'A', 'S', 'T', 'S'};
+const uint32_t STORE_RECORD = 0x524c5441; // "ATLR"
+enum { STORE_TILE = 1, STORE_REMOVE = 2, STORE_COMMIT = 3 };
+enum { STORE_PENDING = 1, STORE_SPARSE = 2 };
+
+struct store_header_t {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct store_record_t {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t flags;
+    int32_t  x, y;                  // submodel
+    uint32_t width, height, n_bands;
+    double   utm_x, utm_y;          // georeferencing of the tile
+    double   scale_x, scale_y;
+    uint64_t size;                  // payload bytes
+};
+
+/**
+ * Single file container of submodels, instead of a GeoTIFF per submodel
+ * (see atlaas::set_tile_store)
+ *
+ * Updates are appended, and the file is compacted (rewritten with the
+ * live records only, then renamed over) once more than half of it is
+ * stale. Records never change once written, so reads go straight through
+ * a read-only memory map of the file, remapped as it grows.
+ * Thread-safe.
+ *
+ * Another process (a tile server) may follow the file read only, see
+ * update: it applies the records as they are committed, and reopens the
+ * file once compacted.
+ */
+class tile_store {
+    struct entry_t {
+        uint64_t offset; // of the record
+        uint64_t bytes;  // record and payload, 0 for a pending removal
+        uint64_t sequence; // of the record, in the order applied
+    };
+
+    std::string filepath;
+    bool read_only;
+    int fd;
+    uint64_t inode;   // of the file opened, replaced by compaction
+    uint64_t records; // sequence of the last record applied
+    mutable const uint8_t* mapping;
+    mutable size_t mapped;
+    uint64_t end;     // end of the last record
+    uint64_t garbage; // bytes of records superseded
+    std::map<map_id_t, entry_t> index;
+    std::map<map_id_t, entry_t> staged; // pending, until commit
+    mutable std::mutex mutex;
+
+    bool scan();
+    void writable() const;
+    void append(const store_record_t& record, const void* payload,
+                entry_t& entry);
+    void replace(const map_id_t& id, entry_t entry);
+    void stage(const map_id_t& id, const entry_t& entry, bool pending);
+    const uint8_t* view(uint64_t offset, uint64_t bytes) const;
+    void unmap() const;
+    void compact_locked();
+    void compact_if_stale();
+
+public:
+    /**
+     * open, or create if it does not exist (unless read only: then the
+     * file has to exist, and is never written)
+     */
+    tile_store(const std::string& filepath, bool read_only = false);
+    ~tile_store();
+
+    /**
+     * read only: apply the records committed by the writer since, from
+     * the start once it compacted the file
+     * @returns whether the index changed
+     */
+    bool update();
+
+    /**
+     * sequence of the live record of a submodel (0 if none), changes with
+     * every write of it (and, read only, when the file is compacted)
+     */
+    uint64_t sequence(const map_id_t& id) const;
+
+    bool contains(const map_id_t& id) const;
+
+    /**
+     * read a submodel in tile: bands and transform, the other meta-data
+     * being left as they are (see gdalwrap::gdal::copy_meta)
+     * @returns false if none
+     */
+    bool read(const map_id_t& id, gdalwrap::gdal& tile) const;
+
+    /**
+     * write (or remove) a submodel, if pending it shows up at commit only
+     */
+    void write(const map_id_t& id, const gdalwrap::gdal& tile,
+               bool pending = false);
+    void remove(const map_id_t& id, bool pending = false);
+
+    /**
+     * apply the pending writes and removals, all at once (on disk too)
+     */
+    void commit();
+
+    /**
+     * drop the pending writes and removals (on disk too)
+     */
+    void discard();
+
+    /**
+     * rewrite the file with the live records only
+     */
+    void compact();
+
+    std::vector<map_id_t> list() const;
+};
+
+} // namespace atlaas
+
+#endif // ATLAAS_TILE_STORE_HPP
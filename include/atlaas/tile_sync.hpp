@@ -0,0 +1,113 @@
+/*
+ * tile_sync.hpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#ifndef ATLAAS_TILE_SYNC_HPP
+#define ATLAAS_TILE_SYNC_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+/**
+ * Byte stream between two peers (socket, serial or radio link), blocking
+ */
+class sync_transport {
+public:
+    virtual ~sync_transport() {}
+    virtual void write(const void* data, size_t size) = 0;
+    virtual void read(void* data, size_t size) = 0;
+};
+
+/**
+ * Transport over a connected file descriptor (socket, socketpair, pipe),
+ * not owned
+ */
+class fd_transport : public sync_transport {
+    int fd;
+
+public:
+    fd_transport(int _fd) : fd(_fd) {}
+    void write(const void* data, size_t size);
+    void read(void* data, size_t size);
+};
+
+typedef std::map<uint32_t, uint64_t> generations_t; // robot -> generation
+
+/**
+ * Peer-to-peer synchronization of the saved submodels (tiles) of robots
+ * sharing a map frame (same custom origin, scale and submodel size)
+ *
+ * The cells a robot added to a tile are kept apart, its layer, and the
+ * tile is the pooled merge of the layers (N_POINTS, mean, variance, min
+ * and max, see atlaas::merge(cell_info_t&, const cell_info_t&)) in robot
+ * order. Each tile carries a generation vector, the version of the layer
+ * of every robot, a robot bumping its own when the tile changed since the
+ * previous exchange (see atlaas::tiles_written): its layer then grows by
+ * what the saved tile holds in addition to the merge of the layers. Peers
+ * swap their vectors first, then only send the layers the other one lacks
+ * (empty cells run-length encoded), so that a layer is merged once however
+ * many times it is received, and peers holding the same layers hold the
+ * same tiles.
+ *
+ * Holds a tile per robot having observed it, in memory and in the saved
+ * state (see save).
+ */
+class tile_sync {
+    struct tile_state_t {
+        generations_t generations;
+        uint64_t digest; // of the tile, as saved by the last exchange
+        std::map<uint32_t, cells_info_t> layers; // robot -> its cells
+    };
+
+    atlaas& map;
+    uint32_t robot;
+    std::map<map_id_t, tile_state_t> tiles;
+    uint64_t seen; // of atlaas::tiles_written, 0 to scan every tile
+
+    void refresh();
+    cells_info_t pooled(const tile_state_t& state);
+    void send_summary(sync_transport& link) const;
+    std::map<map_id_t, generations_t> receive_summary(sync_transport& link)
+        const;
+    void send_tiles(sync_transport& link,
+                    const std::map<map_id_t, generations_t>& peer);
+    size_t receive_tiles(sync_transport& link);
+
+public:
+    tile_sync(atlaas& map, uint32_t robot);
+
+    /**
+     * Synchronize with a peer doing the same (one of them as initiator),
+     * from the mapping thread: the current submodels are saved first, and
+     * reloaded if received.
+     *
+     * @returns the number of tiles changed by the received layers
+     */
+    size_t exchange(sync_transport& link, bool initiator);
+
+    /**
+     * generation vectors and layers, to be kept across runs (load once
+     * the map is initialized, for the submodel size)
+     */
+    void save(const std::string& filepath) const;
+    void load(const std::string& filepath);
+
+    const generations_t& get_generations(const map_id_t& id) const {
+        return tiles.at(id).generations;
+    }
+};
+
+} // namespace atlaas
+
+#endif // ATLAAS_TILE_SYNC_HPP
@@ -8,11 +8,11 @@
  * license: BSD
  */
 #include <cassert>
-#include <stdexcept>        // for out_of_range
+#include <stdexcept>        // for out_of_range, runtime_error
 
 #include <fstream>          // ofstream, tmplog
-#include <algorithm>        // copy{,_backward}
-#include <cmath>            // floor
+#include <algorithm>        // copy{,_backward}, find, all_of, none_of
+#include <cmath>            // floor, lround
 
 #include "atlaas/atlaas.hpp"
 
@@ -35,6 +35,69 @@ void transform(points& cloud, const matrix& tr) {
     }
 }
 
+/**
+ * Number of transformations interpolated along a sweep
+ */
+static const size_t DESKEW_STEPS = 256;
+
+/**
+ * Apply the transformation interpolated at each point stamp (in place)
+ *
+ * The trajectory is sampled in DESKEW_STEPS transformations. Consecutive
+ * points of a sweep fall in the same step, so runs of points are
+ * transformed with a single matrix, as in the rigid case.
+ */
+void transform(points& cloud, const stamps_t& stamps,
+               const trajectory_t& trajectory) {
+    if ( cloud.size() != stamps.size() )
+        throw std::runtime_error("atlaas::merge: a stamp per point");
+    if ( trajectory.empty() )
+        throw std::runtime_error("atlaas::merge: empty trajectory");
+    double t0 = trajectory.front().first;
+    double span = trajectory.back().first - t0;
+    if ( span <= 0 ) {
+        transform(cloud, trajectory.front().second);
+        return;
+    }
+    // sample the trajectory
+    std::vector<matrix> steps(DESKEW_STEPS);
+    auto seg = trajectory.begin();
+    for (size_t k = 0; k < DESKEW_STEPS; k++) {
+        double t = t0 + span * k / (DESKEW_STEPS - 1);
+        while ( seg + 2 < trajectory.end() && (seg + 1)->first < t )
+            seg++;
+        double dt = (seg + 1)->first - seg->first;
+        double ratio = (dt > 0) ? (t - seg->first) / dt : 0;
+        steps[k] = interpolate(seg->second, (seg + 1)->second,
+                               std::min(1.0, std::max(0.0, ratio)));
+    }
+    // transform runs of points sharing the same step
+    double scale = (DESKEW_STEPS - 1) / span;
+    auto step = [&](double stamp) -> size_t {
+        double k = std::floor( (stamp - t0) * scale + 0.5 );
+        return k < 0 ? 0 : std::min(DESKEW_STEPS - 1, size_t(k));
+    };
+    float x,y,z;
+    size_t start = 0, end;
+    while (start < cloud.size()) {
+        size_t k = step(stamps[start]);
+        for (end = start + 1; end < cloud.size(); end++)
+            if ( step(stamps[end]) != k )
+                break;
+        const matrix& tr = steps[k];
+        for (auto it = cloud.begin() + start; it < cloud.begin() + end; ++it) {
+            auto& point = *it;
+            x = point[0];
+            y = point[1];
+            z = point[2];
+            point[0] = (x * tr[0]) + (y * tr[1]) + (z * tr[2])  + tr[3];
+            point[1] = (x * tr[4]) + (y * tr[5]) + (z * tr[6])  + tr[7];
+            point[2] = (x * tr[8]) + (y * tr[9]) + (z * tr[10]) + tr[11];
+        }
+        start = end;
+    }
+}
+
 /**
  * Merge point cloud in the internal model
  * with the sensor to world transformation,
@@ -46,57 +109,193 @@ void transform(points& cloud, const matrix& tr) {
 void atlaas::merge(points& cloud, const matrix& transformation) {
     // transform the cloud from sensor to custom frame
     transform(cloud, transformation);
-    // slide map if needed. transformation[{3,7}] = {x,y}
-    slide_to(transformation[3], transformation[7]);
-#ifdef DYNAMIC_MERGE
-    // use dynamic merge
-    dynamic(cloud);
-#else
-    // merge the cloud in the internal data
-    merge(cloud, internal);
-    map_sync = false;
-#endif
+    // slide around transformation[{3,7}] = {x,y}
+    _merge_custom(cloud, transformation);
+}
+
+/**
+ * Merge a sweep of a moving sensor in the internal model
+ * with the sensor to world transformations during the sweep,
+ * and slide, save, load submodels.
+ *
+ * @param cloud: point cloud in the sensor frame
+ * @param stamps: time of each point
+ * @param trajectory: sensor to world transformations, sorted by time
+ */
+void atlaas::merge(points& cloud, const stamps_t& stamps,
+                   const trajectory_t& trajectory) {
+    // deskew the cloud from sensor to custom frame
+    transform(cloud, stamps, trajectory);
+    // slide around the latest pose
+    _merge_custom(cloud, trajectory.back().second);
+}
+
+/**
+ * Merge policies
+ *
+ * A policy tells which cells the points are merged into, and what is done
+ * before and after merging a scan. Ingestion loops are instantiated per
+ * policy, so the policy specific steps are resolved at compile time.
+ */
+struct static_merge {
+    // points are merged in internal, copy-on-write per point
+    static const bool copy_on_write = true;
+    // no vertical/flat state
+    static const bool vertical_state = false;
+
+    static cell_grid& cells(atlaas& self) {
+        return self.internal;
+    }
+    static void allocate(atlaas& self) {
+        // release the dynamic merge buffers
+        self.dyninter.clear();
+        self.gndinter.clear();
+        vbool_t().swap(self.vertical);
+    }
+    static void begin(atlaas& self) {}
+    static void end(atlaas& self) {}
+};
+
+struct dynamic_merge {
+    // points are merged in dyninter, merge() does the copy-on-write
+    static const bool copy_on_write = false;
+    static const bool vertical_state = true;
+
+    static cell_grid& cells(atlaas& self) {
+        return self.dyninter;
+    }
+    static void allocate(atlaas& self) {
+        self.dyninter.assign(self.width, self.height, self.blocked_storage);
+        self.gndinter.assign(self.width, self.height, self.blocked_storage);
+        self.vertical.resize( self.internal.size() );
+    }
+    static void begin(atlaas& self) {
+        // clear the dynamic map (zeros)
+        cell_info_t zeros{}; // value-initialization w/empty initializer
+        self.dyninter.fill(zeros);
+    }
+    static void end(atlaas& self) {
+        // merge the dynamic atlaas with internal data
+        self.merge();
+    }
+};
+
+/**
+ * STATIC_MERGE with raw cells (AGGREGATE_MOMENTS), which internal cannot
+ * hold: the points of a scan go in dyninter (allocated on first use),
+ * then the cells are finalized and combined in internal
+ */
+struct static_scan_merge {
+    static const bool copy_on_write = false;
+    static const bool vertical_state = false;
+
+    static cell_grid& cells(atlaas& self) {
+        return self.dyninter;
+    }
+    static void begin(atlaas& self) {
+        if ( self.dyninter.get_width()  != self.width ||
+             self.dyninter.get_height() != self.height ) {
+            self.dyninter.assign(self.width, self.height,
+                                 self.blocked_storage);
+        } else {
+            cell_info_t zeros{}; // value-initialization w/empty initializer
+            self.dyninter.fill(zeros);
+        }
+    }
+    static void end(atlaas& self) {
+        self._combine_cells(self.dyninter);
+    }
+};
+
+void atlaas::_alloc_policy() {
+    switch (policy) {
+    case STATIC_MERGE:
+        static_merge::allocate(*this);
+        break;
+    case DYNAMIC_MERGE:
+        dynamic_merge::allocate(*this);
+        break;
+    }
+}
+
+void atlaas::_merge_custom(const points& cloud, const matrix& sensor) {
+    // slide map if needed
+    slide_to(sensor[3], sensor[7]);
+    switch (policy) {
+    case STATIC_MERGE:
+        _merge<static_merge>(cloud, sensor);
+        break;
+    case DYNAMIC_MERGE:
+        _merge<dynamic_merge>(cloud, sensor);
+        break;
+    }
+}
+
+template <class Policy>
+void atlaas::_merge(const points& cloud, const matrix& sensor) {
+    switch (aggregate) {
+    case AGGREGATE_MEAN:
+        _merge_loop<Policy, mean_aggregate>(cloud, sensor);
+        break;
+    case AGGREGATE_MIN:
+        _merge_loop<Policy, min_aggregate>(cloud, sensor);
+        break;
+    case AGGREGATE_MAX:
+        _merge_loop<Policy, max_aggregate>(cloud, sensor);
+        break;
+    case AGGREGATE_LAST:
+        _merge_loop<Policy, last_aggregate>(cloud, sensor);
+        break;
+    case AGGREGATE_WEIGHTED:
+        _merge_loop<Policy, weighted_aggregate>(cloud, sensor);
+        break;
+    case AGGREGATE_MOMENTS:
+        Policy::copy_on_write
+            ? _merge_loop<static_scan_merge, moments_aggregate>(cloud, sensor)
+            : _merge_loop<Policy, moments_aggregate>(cloud, sensor);
+        break;
+    }
+}
+
+template <class Policy, class Aggregate>
+void atlaas::_merge_loop(const points& cloud, const matrix& sensor) {
+    Policy::begin(*this);
+    _merge_points<Aggregate, Policy::copy_on_write>(cloud,
+        Policy::cells(*this), &sensor);
+    Policy::end(*this);
 }
 
 void atlaas::dynamic(const points& cloud) {
-    // clear the dynamic map (zeros)
+    assert( policy == DYNAMIC_MERGE );
+    // no sensor pose, points are not weighted
     cell_info_t zeros{}; // value-initialization w/empty initializer
-    std::fill(dyninter.begin(), dyninter.end(), zeros);
-    // merge the point-cloud
+    dyninter.fill(zeros);
     merge(cloud, dyninter);
-    // dyn->export8u("atlaas-dyn.jpg");
-    // merge the dynamic atlaas with internal data
     merge();
 }
 
 void atlaas::sub_load(int sx, int sy) {
-    std::string filepath = sub_name(current[0] + sx, current[1] + sy);
-    if ( ! file_exists( filepath ) )
-        return; // no file to load
-    sub->init(filepath);
-    auto it  = internal.begin() + sw * (sx + 1) + sh * width * (sy + 1),
-         end = it + sh * width;
-    for (auto sit = sub->internal.begin(); it < end; it += width, sit += sw) {
+    map_id_t id = {{ current[0] + sx, current[1] + sy }};
+    if ( std::find(writing.begin(), writing.end(), id) != writing.end() )
+        wait_saves(); // being written in background
+    if ( ! sub_read(id, *sub) )
+        return; // nothing saved there
+    size_t x0 = sw * size_t(sx + 1), y0 = sh * size_t(sy + 1);
+    touch(x0, y0, sw, sh);
+    for (size_t y = 0; y < sh; y++) {
         // sub to map
-        std::copy(sit, sit + sw, it);
+        const cell_info_t* sit = sub->internal.row(y);
+        if ( ! internal.allocated(y0 + y) &&
+             std::none_of(sit, sit + sw, [](const cell_info_t& info) {
+                 return info[N_POINTS] > 0; }) )
+            continue; // unobserved, left absent
+        std::copy(sit, sit + sw, internal.row_write(y0 + y) + x0);
     }
+    if (front)
+        front->invalidate();
     map_sync = false;
 }
 
-void atlaas::sub_save(int sx, int sy) const {
-    auto it  = internal.begin() + sw * (sx + 1) + sh * width * (sy + 1),
-         end = it + sh * width;
-    for (auto sit = sub->internal.begin(); it < end; it += width, sit += sw) {
-        // map to sub
-        std::copy(it, it + sw, sit);
-    }
-    sub->update();
-    const auto& utm = map.point_pix2utm( sx * sw, sy * sh);
-    // update map transform used for merging the pointcloud
-    sub->map.set_transform(utm[0], utm[1], map.get_scale_x(), map.get_scale_y());
-    sub->map.save( sub_name(current[0] + sx, current[1] + sy) );
-}
-
 /**
  * Slide, save, load submodels
  *
@@ -116,71 +315,56 @@ void atlaas::slide_to(double robx, double roby) {
     int dy = (cy < 0.33) ? -1 : (cy > 0.66) ? 1 : 0; // N/S
     cell_info_t zeros{}; // value-initialization w/empty initializer
     // reset state and ground infos used for dynamic merge
-    std::fill(gndinter.begin(), gndinter.end(), zeros);
+    gndinter.fill(zeros);
     std::fill(vertical.begin(), vertical.end(), false);
 
+    std::vector<map_id_t> subs;
     if (dx == -1) {
         // save EAST 1/3 maplets [ 1,-1], [ 1, 0], [ 1, 1]
-        sub_save( 1, -1);
-        sub_save( 1,  0);
-        sub_save( 1,  1);
+        subs = { {{ 1, -1}}, {{ 1,  0}}, {{ 1,  1}} };
         if (dy == -1) {
             // save SOUTH
-            sub_save(-1,  1);
-            sub_save( 0,  1);
+            subs.push_back({{-1,  1}});
+            subs.push_back({{ 0,  1}});
         } else if (dy == 1) {
             // save NORTH
-            sub_save(-1, -1);
-            sub_save( 0, -1);
-        }
-        // move the map to the WEST [-1 -> 0; 0 -> 1]
-        for (auto it = internal.begin(); it < internal.end(); it += width) {
-            std::copy_backward(it, it + 2 * sw, it + width);
-            // reset(it, it + sw);
-            std::fill(it, it + sw, zeros);
+            subs.push_back({{-1, -1}});
+            subs.push_back({{ 0, -1}});
         }
     } else if (dx == 1) {
         // save WEST 1/3 maplets [-1,-1], [-1, 0], [-1, 1]
-        sub_save(-1, -1);
-        sub_save(-1,  0);
-        sub_save(-1,  1);
+        subs = { {{-1, -1}}, {{-1,  0}}, {{-1,  1}} };
         if (dy == -1) {
             // save SOUTH
-            sub_save( 0,  1);
-            sub_save( 1,  1);
+            subs.push_back({{ 0,  1}});
+            subs.push_back({{ 1,  1}});
         } else if (dy == 1) {
             // save NORTH
-            sub_save( 0, -1);
-            sub_save( 1, -1);
-        }
-        // move the map to the EAST
-        for (auto it = internal.begin(); it < internal.end(); it += width) {
-            std::copy(it + sw, it + width, it);
-            // reset(it + 2 * sw, it + width);
-            std::fill(it + 2 * sw, it + width, zeros);
+            subs.push_back({{ 0, -1}});
+            subs.push_back({{ 1, -1}});
         }
     } else if (dy == -1) {
         // save SOUTH
-        sub_save(-1,  1);
-        sub_save( 0,  1);
-        sub_save( 1,  1);
+        subs = { {{-1,  1}}, {{ 0,  1}}, {{ 1,  1}} };
     } else if (dy == 1) {
         // save NORTH
-        sub_save(-1, -1);
-        sub_save( 0, -1);
-        sub_save( 1, -1);
-    }
-
-    if (dy == -1) {
-        std::copy_backward(internal.begin(), internal.end() - sh * width,
-                           internal.end());
-        // reset(internal.begin(), internal.begin() + sh * width);
-        std::fill(internal.begin(), internal.begin() + sh * width - 1, zeros);
-    } else if (dy == 1) {
-        std::copy(internal.begin() + sh * width, internal.end(), internal.begin());
-        // reset(internal.end() - sh * width, internal.end());
-        std::fill(internal.end() - sh * width, internal.end(), zeros);
+        subs = { {{-1, -1}}, {{ 0, -1}}, {{ 1, -1}} };
     }
+    // snapshot the maplets, written in background
+    save_async(subs);
+    // the whole map is about to move, copy the snapshot blocks
+    touch(0, 0, width, height);
+    // until the window moved and is loaded, for regional access
+    std::unique_lock<block_locks> moving(locks);
+
+    // move the map by one submodel, rotating whole bands of rows if
+    // blocked, and clear the cells moved in
+    internal.shift(long(sw) * dx, long(sh) * dy);
+    if (heat)
+        heat->shift(std::lround(double(sw) * dx / BLOCK_SIZE),
+                    std::lround(double(sh) * dy / BLOCK_SIZE));
+    if (front)
+        front->invalidate();
 
     // after moving, update our current center
     current[0] += dx;
@@ -226,11 +410,16 @@ void atlaas::slide_to(double robx, double roby) {
         sub_load( 0,  1);
         sub_load( 1,  1);
     }
+    moving.unlock();
+    // rebuild now, so that queries stay in O(frontier size)
+    if (front)
+        front->update(internal);
 
-    const auto& utm = map.point_pix2utm(sw * dx, sh * dy);
+    const auto& utm = map.point_pix2utm(double(sw) * dx, double(sh) * dy);
     // update map transform used for merging the pointcloud
     map.set_transform(utm[0], utm[1], map.get_scale_x(), map.get_scale_y());
     map_sync = false;
+    _publish_frame();
     tmplog << __func__ << " utm " << utm[0] << ", " << utm[1] << std::endl;
 }
 
@@ -239,59 +428,323 @@ void atlaas::slide_to(double robx, double roby) {
  *
  * @param cloud: point cloud in the custom frame
  */
-void atlaas::merge(const points& cloud, cells_info_t& inter) {
+void atlaas::merge(const points& cloud, cell_grid& inter) {
+    // copy-on-write and block locks only apply to internal
+    bool cow = (&inter == &internal);
+    switch (aggregate) {
+    case AGGREGATE_MEAN:
+        cow ? _merge_points<mean_aggregate, true>(cloud, inter, NULL)
+            : _merge_points<mean_aggregate, false>(cloud, inter, NULL);
+        break;
+    case AGGREGATE_MIN:
+        cow ? _merge_points<min_aggregate, true>(cloud, inter, NULL)
+            : _merge_points<min_aggregate, false>(cloud, inter, NULL);
+        break;
+    case AGGREGATE_MAX:
+        cow ? _merge_points<max_aggregate, true>(cloud, inter, NULL)
+            : _merge_points<max_aggregate, false>(cloud, inter, NULL);
+        break;
+    case AGGREGATE_LAST:
+        cow ? _merge_points<last_aggregate, true>(cloud, inter, NULL)
+            : _merge_points<last_aggregate, false>(cloud, inter, NULL);
+        break;
+    case AGGREGATE_WEIGHTED:
+        cow ? _merge_points<weighted_aggregate, true>(cloud, inter, NULL)
+            : _merge_points<weighted_aggregate, false>(cloud, inter, NULL);
+        break;
+    case AGGREGATE_MOMENTS:
+        if (cow) {
+            // internal is kept materialized, see static_scan_merge
+            static_scan_merge::begin(*this);
+            _merge_points<moments_aggregate, false>(cloud, dyninter, NULL);
+            static_scan_merge::end(*this);
+        } else {
+            _merge_points<moments_aggregate, false>(cloud, inter, NULL);
+        }
+        break;
+    }
+}
+
+void atlaas::merge(const points& cloud, cells_info_t& infos) {
+    if ( infos.size() != width * height )
+        throw std::out_of_range("atlaas::merge: not the window size");
+    cell_grid inter;
+    inter.assign(width, height);
+    if (aggregate == AGGREGATE_MOMENTS) {
+        // the sums do not fit in infos, the cloud is finalized apart
+        merge(cloud, inter);
+        variance_mean(inter);
+        for (size_t index = 0; index < infos.size(); index++)
+            if (inter[index][N_POINTS] > 0)
+                moments_aggregate::combine(infos[index], inter[index]);
+        return;
+    }
+    for (size_t y = 0; y < height; y++)
+        std::copy(infos.begin() + y * width, infos.begin() + (y + 1) * width,
+                  inter.row_write(y));
+    merge(cloud, inter);
+    for (size_t y = 0; y < height; y++)
+        std::copy(inter.row(y), inter.row(y) + width,
+                  infos.begin() + y * width);
+}
+
+/**
+ * Merge a point cloud following the aggregation policy
+ *
+ * @param cloud: point cloud in the custom frame
+ * @param inter: cells to merge into
+ * @param sensor: sensor to world transformation, for weights (optional)
+ *
+ * copy_on_write is for internal: snapshot and block locks
+ */
+template <class Aggregate, bool copy_on_write>
+void atlaas::_merge_points(const points& cloud, cell_grid& inter,
+                           const matrix* sensor) {
     size_t index;
-    float z_mean, n_pts, new_z;
-    // merge point-cloud in internal structure
+    float weight = 1;
+    block_guard guard(locks);
+    if (heat)
+        heat->begin();
     for (const auto& point : cloud) {
         index = map.index_custom(point[0], point[1]);
         if (index == std::numeric_limits<size_t>::max() )
             continue; // point is outside the map
+        if (heat)
+            heat->hit( block_index(index) );
+        if (copy_on_write) {
+            _enter(guard, index);
+        }
+        if (Aggregate::weighted && sensor) {
+            float dx = point[0] - (*sensor)[3],
+                  dy = point[1] - (*sensor)[7],
+                  dz = point[2] - (*sensor)[11];
+            weight = weighted_aggregate::weight(dx * dx + dy * dy + dz * dz);
+        }
+        if (copy_on_write && front && inter[ index ][N_POINTS] < 1)
+            front->observed(index);
+
+        add_point<Aggregate>(inter, index, point[2], weight);
+    }
+    if (heat)
+        heat->end();
+    map_sync = false;
+}
+
+/**
+ * Merge a range image in the internal model
+ * with the sensor to world transformation,
+ * and slide, save, load submodels.
+ */
+void atlaas::merge(const std::vector<float>& ranges, const scan_tables& tables,
+                   const matrix& transformation) {
+    assert( ranges.size() == tables.rings * tables.columns );
+    // slide first, cell indexing depends on the map transform
+    slide_to(transformation[3], transformation[7]);
+    switch (policy) {
+    case STATIC_MERGE:
+        _merge<static_merge>(ranges, tables, transformation);
+        break;
+    case DYNAMIC_MERGE:
+        ring_classified = vertical_slope > 0;
+        if (ring_classified)
+            ring_vertical.assign(width * height, false);
+        _merge<dynamic_merge>(ranges, tables, transformation);
+        ring_classified = false;
+        break;
+    }
+}
 
-        auto& info = inter[ index ];
-        new_z = point[2];
-        n_pts = info[N_POINTS];
+template <class Policy>
+void atlaas::_merge(const std::vector<float>& ranges, const scan_tables& tables,
+                    const matrix& tr) {
+    switch (aggregate) {
+    case AGGREGATE_MEAN:
+        _merge_loop<Policy, mean_aggregate>(ranges, tables, tr);
+        break;
+    case AGGREGATE_MIN:
+        _merge_loop<Policy, min_aggregate>(ranges, tables, tr);
+        break;
+    case AGGREGATE_MAX:
+        _merge_loop<Policy, max_aggregate>(ranges, tables, tr);
+        break;
+    case AGGREGATE_LAST:
+        _merge_loop<Policy, last_aggregate>(ranges, tables, tr);
+        break;
+    case AGGREGATE_WEIGHTED:
+        _merge_loop<Policy, weighted_aggregate>(ranges, tables, tr);
+        break;
+    case AGGREGATE_MOMENTS:
+        Policy::copy_on_write
+            ? _merge_loop<static_scan_merge, moments_aggregate>(ranges,
+                                                                 tables, tr)
+            : _merge_loop<Policy, moments_aggregate>(ranges, tables, tr);
+        break;
+    }
+}
 
-        if (n_pts < 1) {
-            info[N_POINTS] = 1;
-            info[Z_MAX]  = new_z;
-            info[Z_MIN]  = new_z;
-            info[Z_MEAN] = new_z;
-            info[VARIANCE] = 0;
-        } else {
-            z_mean = info[Z_MEAN];
-            // increment N_POINTS
-            info[N_POINTS]++;
-            // update Z_MAX
-            if (new_z > info[Z_MAX])
-                info[Z_MAX] = new_z;
-            // update Z_MIN
-            if (new_z < info[Z_MIN])
-                info[Z_MIN] = new_z;
-
-            /* Incremental mean and variance updates (according to Knuth's bible,
-               Vol. 2, section 4.2.2). The actual variance will later be divided
-               by the number of samples plus 1. */
-            info[Z_MEAN]    = (z_mean * n_pts + new_z) / info[N_POINTS];
-            info[VARIANCE] += (new_z - z_mean) * (new_z - info[Z_MEAN]);
+/**
+ * Merge a range image in the internal model
+ *
+ * The sensor to pixel affine transformation is folded in per column and
+ * per ring direction tables, so that a return costs two multiply-adds per
+ * coordinate in a loop over contiguous floats (auto-vectorized), before
+ * the scalar scatter in the cells.
+ *
+ * When the ring classifier is enabled, returns of the same column on
+ * adjacent rings are compared in the same pass, and both cells are marked
+ * vertical when the slope between them is steeper than `vertical_slope`.
+ *
+ * @param ranges: range image (rings x columns)
+ * @param tables: scan geometry
+ * @param tr: sensor to world (custom frame) transformation
+ */
+template <class Policy, class Aggregate>
+void atlaas::_merge_loop(const std::vector<float>& ranges,
+                         const scan_tables& tables, const matrix& tr) {
+    cell_grid& inter = Policy::cells(*this);
+    Policy::begin(*this);
+    // custom frame -> pixel: p = origin + xy / scale
+    const point_xy_t& origin = map.point_custom2pix(0, 0);
+    const double sx = 1.0 / map.get_scale_x(), sy = 1.0 / map.get_scale_y();
+    // sensor -> pixel (rows 0, 1) and sensor -> custom z (row 2)
+    const std::array<double, 12> aff = {{
+        tr[0] * sx, tr[1] * sx, tr[2]  * sx, origin[0] + tr[3] * sx,
+        tr[4] * sy, tr[5] * sy, tr[6]  * sy, origin[1] + tr[7] * sy,
+        tr[8],      tr[9],      tr[10],      tr[11] }};
+    const size_t columns = tables.columns;
+    // per column horizontal direction, per row of the affine
+    std::vector<float> hdir(3 * columns), vdir(3);
+    for (size_t row = 0; row < 3; row++)
+        for (size_t c = 0; c < columns; c++)
+            hdir[row * columns + c] = aff[row * 4]     * tables.cos_az[c]
+                                    + aff[row * 4 + 1] * tables.sin_az[c];
+    // per return pixel coordinates and height, one ring at a time
+    std::vector<float> px(columns), py(columns), pz(columns);
+    const float fw = width, fh = height;
+    // ring classifier: previous ring, steep mask, pixel to meters
+    bool classify = Policy::vertical_state && ring_classified;
+    std::vector<float> qx, qy, qz;
+    std::vector<char> steep;
+    const float mx = map.get_scale_x(), my = map.get_scale_y();
+    const float tan2 = vertical_slope * vertical_slope;
+    if (classify) {
+        qx.resize(columns);
+        qy.resize(columns);
+        qz.resize(columns);
+        steep.resize(columns);
+    }
+    auto pix_index = [&](float x, float y) -> size_t {
+        if ( x < 0 || x >= fw || y < 0 || y >= fh )
+            return std::numeric_limits<size_t>::max();
+        return size_t(x) + size_t(y) * width;
+    };
+    block_guard guard(locks);
+
+    for (size_t ring = 0; ring < tables.rings; ring++) {
+        const float ce = tables.cos_el[ring], se = tables.sin_el[ring];
+        const float* rg = &ranges[ring * columns];
+        for (size_t row = 0; row < 3; row++)
+            vdir[row] = aff[row * 4 + 2] * se;
+        const float ox = aff[3], oy = aff[7], oz = aff[11];
+        const float *hx = &hdir[0], *hy = &hdir[columns],
+                    *hz = &hdir[2 * columns];
+        // vectorizable: polar -> cartesian -> pixel
+        for (size_t c = 0; c < columns; c++) {
+            px[c] = rg[c] * (ce * hx[c] + vdir[0]) + ox;
+            py[c] = rg[c] * (ce * hy[c] + vdir[1]) + oy;
+            pz[c] = rg[c] * (ce * hz[c] + vdir[2]) + oz;
+        }
+        if (classify && ring > 0) {
+            const float* prg = &ranges[(ring - 1) * columns];
+            // vectorizable: slope with the previous ring
+            for (size_t c = 0; c < columns; c++) {
+                float dx = (px[c] - qx[c]) * mx, dy = (py[c] - qy[c]) * my,
+                      dz = pz[c] - qz[c];
+                steep[c] = (rg[c] > 0) & (prg[c] > 0) &
+                           (dz * dz > tan2 * (dx * dx + dy * dy));
+            }
+            for (size_t c = 0; c < columns; c++) {
+                if ( ! steep[c] )
+                    continue;
+                size_t index = pix_index(px[c], py[c]);
+                if (index != std::numeric_limits<size_t>::max())
+                    ring_vertical[index] = true;
+                index = pix_index(qx[c], qy[c]);
+                if (index != std::numeric_limits<size_t>::max())
+                    ring_vertical[index] = true;
+            }
+        }
+        // scatter in the cells
+        if (heat)
+            heat->begin();
+        for (size_t c = 0; c < columns; c++) {
+            if ( ! (rg[c] > 0) )
+                continue; // no return (or NaN)
+            size_t index = pix_index(px[c], py[c]);
+            if (index == std::numeric_limits<size_t>::max() )
+                continue; // point is outside the map
+            if (heat)
+                heat->hit( block_index(index) );
+            if (Policy::copy_on_write) {
+                _enter(guard, index);
+                if (front && inter[ index ][N_POINTS] < 1)
+                    front->observed(index);
+            }
+            add_point<Aggregate>(inter, index, pz[c], Aggregate::weighted ?
+                weighted_aggregate::weight(rg[c] * rg[c]) : 1);
+        }
+        if (heat)
+            heat->end(); // scatter time only
+        if (classify) {
+            px.swap(qx);
+            py.swap(qy);
+            pz.swap(qz);
         }
     }
+    Policy::end(*this);
     map_sync = false;
 }
 
 /**
  * Compute real variance and return the mean
  */
-float atlaas::variance_mean(cells_info_t& inter) {
+float atlaas::variance_mean(cell_grid& inter) {
+    switch (aggregate) {
+    case AGGREGATE_MIN:
+        return _variance_mean<min_aggregate>(inter);
+    case AGGREGATE_MAX:
+        return _variance_mean<max_aggregate>(inter);
+    case AGGREGATE_LAST:
+        return _variance_mean<last_aggregate>(inter);
+    case AGGREGATE_WEIGHTED:
+        return _variance_mean<weighted_aggregate>(inter);
+    case AGGREGATE_MOMENTS:
+        return _variance_mean<moments_aggregate>(inter);
+    default:
+        return _variance_mean<mean_aggregate>(inter);
+    }
+}
+
+template <class Aggregate>
+float atlaas::_variance_mean(cell_grid& inter) {
     size_t variance_count = 0;
     float  variance_total = 0;
 
-    for (auto& info : inter) {
-        if (info[N_POINTS] > 2) {
-            /* compute the real variance (according to Knuth's bible) */
-            info[VARIANCE] /= info[N_POINTS] - 1;
-            variance_total += info[VARIANCE];
-            variance_count++;
+    for (size_t y = 0; y < inter.get_height(); y++) {
+        if ( ! inter.allocated(y) )
+            continue; // no point there
+        cell_info_t* it = inter.row_write(y);
+        size_t index = y * inter.get_width();
+        for (cell_info_t* end = it + inter.get_width(); it < end;
+                it++, index++) {
+            cell_info_t& info = *it;
+            if (info[N_POINTS] > 2) {
+                finalize_cell<Aggregate>(inter, index, info);
+                variance_total += info[VARIANCE];
+                variance_count++;
+            } else if (Aggregate::raw && info[N_POINTS] > 0) {
+                finalize_cell<Aggregate>(inter, index, info);
+            }
         }
     }
 
@@ -305,102 +758,180 @@ float atlaas::variance_mean(cells_info_t& inter) {
  * Merge dynamic dtm
  */
 void atlaas::merge() {
-    bool is_vertical;
-    size_t index = 0;
-    float threshold = variance_factor * variance_mean(dyninter);
-    auto it = internal.begin();
-    auto st = vertical.begin();
-
-    for (auto& dyninfo : dyninter) {
-        if ( dyninfo[N_POINTS] > 0 ) {
+    _merge_cells(dyninter, variance_factor, 0);
+}
 
-            is_vertical = dyninfo[VARIANCE] > threshold;
+/**
+ * Merge cells with vertical/flat state
+ *
+ * @param inter: cells of a scan (or a batch of scans)
+ * @param factor: vertical threshold, times the variance mean of inter
+ * @param noise: height noise (std dev), its variance is added to the
+ *               threshold
+ */
+void atlaas::_merge_cells(cell_grid& inter, float factor, float noise) {
+    switch (aggregate) {
+    case AGGREGATE_MEAN:
+        _merge_dynamic<mean_aggregate>(inter, factor, noise);
+        break;
+    case AGGREGATE_MIN:
+        _merge_dynamic<min_aggregate>(inter, factor, noise);
+        break;
+    case AGGREGATE_MAX:
+        _merge_dynamic<max_aggregate>(inter, factor, noise);
+        break;
+    case AGGREGATE_LAST:
+        _merge_dynamic<last_aggregate>(inter, factor, noise);
+        break;
+    case AGGREGATE_WEIGHTED:
+        _merge_dynamic<weighted_aggregate>(inter, factor, noise);
+        break;
+    case AGGREGATE_MOMENTS:
+        _merge_dynamic<moments_aggregate>(inter, factor, noise);
+        break;
+    }
+}
 
+template <class Aggregate>
+void atlaas::_merge_dynamic(cell_grid& inter, float factor, float noise) {
+    bool is_vertical;
+    size_t index = 0;
+    float threshold = factor * _variance_mean<Aggregate>(inter)
+                    + noise * noise;
+    block_guard guard(locks);
+
+    for (size_t y = 0; y < height; y++) {
+        if ( ! inter.allocated(y) ) {
+            index += width; // no point there
+            continue;
+        }
+        const cell_info_t* dit = inter.row(y);
+        cell_info_t* it = internal.row_write(y);
+        for (size_t x = 0; x < width; x++, dit++, it++, index++) {
+            const cell_info_t& dyninfo = *dit;
+            if ( dyninfo[N_POINTS] < 1 )
+                continue;
+            _enter(guard, index);
+
+            if (ring_classified)
+                is_vertical = ring_vertical[index];
+            else
+                is_vertical = dyninfo[VARIANCE] > threshold;
+
+            auto st = vertical.begin() + index;
             if ( (*it)[N_POINTS] < 1 ) {
+                if (front)
+                    front->observed(index);
                 *st = is_vertical;
                 *it = dyninfo;
             } else if ( *st == is_vertical ) {
-                merge(*it, dyninfo);
+                Aggregate::combine(*it, dyninfo);
             } else if ( !*st ) { // was flat
-                gndinter[index] = *it;
+                gndinter.at_write(index) = *it;
                 *it = dyninfo;
                 *st = true;
             } else { // was vertical
                 *st = false;
                 *it = gndinter[index];
-                merge(*it, dyninfo);
+                Aggregate::combine(*it, dyninfo);
             }
             (*it)[LAST_UPDATE] = get_reference_time();
         }
-
-        st++;
-        it++;
-        index++;
     }
     map_sync = false;
 }
 
 void atlaas::merge(cell_info_t& dst, const cell_info_t& src) {
-    if ( dst[N_POINTS] < 1 ) {
-        dst = src;
-        return;
+    switch (aggregate) {
+    case AGGREGATE_MEAN:
+        mean_aggregate::combine(dst, src);
+        break;
+    case AGGREGATE_MIN:
+        min_aggregate::combine(dst, src);
+        break;
+    case AGGREGATE_MAX:
+        max_aggregate::combine(dst, src);
+        break;
+    case AGGREGATE_LAST:
+        last_aggregate::combine(dst, src);
+        break;
+    case AGGREGATE_WEIGHTED:
+        weighted_aggregate::combine(dst, src);
+        break;
+    case AGGREGATE_MOMENTS:
+        moments_aggregate::combine(dst, src);
+        break;
     }
-    float z_mean, d_mean, new_n_pts;
-
-    new_n_pts = src[N_POINTS] + dst[N_POINTS];
-    z_mean = dst[Z_MEAN];
-
-    if (dst[Z_MAX] < src[Z_MAX])
-        dst[Z_MAX] = src[Z_MAX];
-    if (dst[Z_MIN] > src[Z_MIN])
-        dst[Z_MIN] = src[Z_MIN];
-
-    dst[Z_MEAN] = ( (z_mean * dst[N_POINTS]) + (src[Z_MEAN] * src[N_POINTS]) )
-                   / new_n_pts;
-    // XXX compute the variance
-    //d_mean = dst[Z_MEAN] - z_mean;
-    dst[VARIANCE] = ( src[VARIANCE] * src[VARIANCE] * src[N_POINTS]
-                    + dst[VARIANCE] * dst[VARIANCE] * dst[N_POINTS]
-    //                + d_mean * d_mean * src[N_POINTS] * dst[N_POINTS] / new_n_pts
-                    ) / new_n_pts;
-    //dst[VARIANCE] = ( dst[VARIANCE] * dst[N_POINTS] + src[VARIANCE] * src[N_POINTS])
-    //               / new_n_pts;
-    dst[N_POINTS] = new_n_pts;
 }
 
 void atlaas::update() {
     // update map from internal
     // internal -> map
-    for (size_t idx = 0; idx < internal.size(); idx++) {
-        map.bands[N_POINTS][idx]    = internal[idx][N_POINTS];
-        map.bands[Z_MAX][idx]       = internal[idx][Z_MAX];
-        map.bands[Z_MIN][idx]       = internal[idx][Z_MIN];
-        map.bands[Z_MEAN][idx]      = internal[idx][Z_MEAN];
-        map.bands[VARIANCE][idx]    = internal[idx][VARIANCE];
-        map.bands[LAST_UPDATE][idx] = internal[idx][LAST_UPDATE];
+    const cell_grid& cells = internal;
+    size_t idx = 0;
+    for (size_t y = 0; y < cells.get_height(); y++) {
+        if ( ! cells.allocated(y) ) {
+            // unobserved, zeros
+            for (int band : {N_POINTS, Z_MAX, Z_MIN, Z_MEAN, VARIANCE,
+                             LAST_UPDATE})
+                std::fill(map.bands[band].begin() + idx,
+                          map.bands[band].begin() + idx + width, 0);
+            idx += width;
+            continue;
+        }
+        const cell_info_t* it = cells.row(y);
+        for (size_t x = 0; x < cells.get_width(); x++, it++, idx++) {
+            map.bands[N_POINTS][idx]    = (*it)[N_POINTS];
+            map.bands[Z_MAX][idx]       = (*it)[Z_MAX];
+            map.bands[Z_MIN][idx]       = (*it)[Z_MIN];
+            map.bands[Z_MEAN][idx]      = (*it)[Z_MEAN];
+            map.bands[VARIANCE][idx]    = (*it)[VARIANCE];
+            map.bands[LAST_UPDATE][idx] = (*it)[LAST_UPDATE];
+        }
     }
     map_sync = true;
 }
 
 void atlaas::_fill_internal() {
     assert( map.names == MAP_NAMES );
+    wait_saves();
     width  = map.get_width();  // x
     height = map.get_height(); // y
     sw = width  / 3; // sub-width
     sh = height / 3; // sub-height
+    bw = (width  + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    bh = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    locks.resize(bw * bh);
+    if (heat)
+        heat->resize(bw, bh);
+    if (front)
+        front->resize(width, height);
     // set internal size
-    internal.resize( width * height );
+    internal.assign(width, height, blocked_storage);
     // fill internal from map
     // map -> internal
-    for (size_t idx = 0; idx < internal.size(); idx++) {
-        internal[idx][N_POINTS]     = map.bands[N_POINTS][idx];
-        internal[idx][Z_MAX]        = map.bands[Z_MAX][idx];
-        internal[idx][Z_MIN]        = map.bands[Z_MIN][idx];
-        internal[idx][Z_MEAN]       = map.bands[Z_MEAN][idx];
-        internal[idx][VARIANCE]     = map.bands[VARIANCE][idx];
-        internal[idx][LAST_UPDATE]  = map.bands[LAST_UPDATE][idx];
+    size_t idx = 0;
+    for (size_t y = 0; y < height; y++) {
+        const auto points = map.bands[N_POINTS].begin() + idx;
+        if ( ! internal.allocated(y) &&
+             std::all_of(points, points + width,
+                         [](float n) { return n < 1; }) ) {
+            idx += width; // unobserved, left absent
+            continue;
+        }
+        cell_info_t* it = internal.row_write(y);
+        for (size_t x = 0; x < width; x++, it++, idx++) {
+            (*it)[N_POINTS]     = map.bands[N_POINTS][idx];
+            (*it)[Z_MAX]        = map.bands[Z_MAX][idx];
+            (*it)[Z_MIN]        = map.bands[Z_MIN][idx];
+            (*it)[Z_MEAN]       = map.bands[Z_MEAN][idx];
+            (*it)[VARIANCE]     = map.bands[VARIANCE][idx];
+            (*it)[LAST_UPDATE]  = map.bands[LAST_UPDATE][idx];
+            (*it)[W_SUM]        = map.bands[N_POINTS][idx];
+        }
     }
     map_sync = true;
+    _publish_frame();
 }
 
 } // namespace atlaas
@@ -0,0 +1,157 @@
+/*
+ * cell_grid.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cstdlib>          // labs
+#include <algorithm>        // any_of, copy{,_backward}, fill, rotate
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+void cell_grid::acquire(size_t b) {
+    std::lock_guard<std::mutex> lock(*allocating);
+    if (cells(b) != NULL)
+        return; // allocated meanwhile
+    cells_info_t fresh;
+    cell_info_t zero{}; // value-initialization w/empty initializer
+    if ( pool.empty() ) {
+        fresh.assign(band_cells, zero);
+    } else {
+        fresh.swap(pool.back());
+        pool.pop_back();
+        std::fill(fresh.begin(), fresh.end(), zero);
+    }
+    bands[b].swap(fresh);
+    publish(b); // after the zeros
+}
+
+/**
+ * not thread-safe, the band must not be written meanwhile (a reader may
+ * still copy it, the pool keeps its memory until the next assign)
+ */
+void cell_grid::release(size_t b) {
+    if (cells(b) == NULL)
+        return;
+    std::lock_guard<std::mutex> lock(*allocating);
+    published[b].store(NULL, std::memory_order_release);
+    pool.emplace_back();
+    pool.back().swap(bands[b]);
+}
+
+void cell_grid::fill(const cell_info_t& value) {
+    cell_info_t zero{}; // value-initialization w/empty initializer
+    std::fill(sums.begin(), sums.end(), cell_moments_t());
+    if (sparse && value == zero) {
+        for (size_t b = 0; b < bands.size(); b++)
+            release(b);
+        return;
+    }
+    for (size_t b = 0; b < bands.size(); b++)
+        std::fill(band(b).begin(), band(b).end(), value);
+}
+
+void cell_grid::trim() {
+    if ( ! sparse )
+        return;
+    for (size_t b = 0; b < bands.size(); b++) {
+        const cells_info_t& cells = bands[b];
+        bool observed = false;
+        for (auto it = cells.begin(); it < cells.end() && ! observed; ++it)
+            observed = (*it)[N_POINTS] > 0;
+        if ( ! observed )
+            release(b);
+    }
+}
+
+void cell_grid::shift(long dx, long dy) {
+    cell_info_t zeros{}; // value-initialization w/empty initializer
+    const long w = width, h = height;
+    if ( std::labs(dx) >= w || std::labs(dy) >= h ) {
+        fill(zeros);
+        return;
+    }
+    if ( ! sums.empty() ) {
+        // dense, cell by cell
+        std::vector<cell_moments_t> moved(sums.size(), cell_moments_t());
+        for (long y = std::max(0L, -dy); y < std::min(h, h - dy); y++)
+            for (long x = std::max(0L, -dx); x < std::min(w, w - dx); x++)
+                moved[y * w + x] = sums[(y + dy) * w + x + dx];
+        sums.swap(moved);
+    }
+    // rows of the absent bands are zeros, and stay absent if only zeros
+    // are moved in
+    std::vector<char> live(bands.size(), ! sparse);
+    bool copied = false; // row by row
+    auto observed = [&](long y) {
+        return std::any_of(row(y), row(y) + w, [](const cell_info_t& info) {
+            return info[N_POINTS] > 0; });
+    };
+    auto move_row = [&](long y, long src) {
+        if ( allocated(src) && ( ! sparse || observed(src) ) ) {
+            std::copy(row(src), row(src) + w, row_write(y));
+            live[y / band_rows] = true;
+        } else if ( allocated(y) ) {
+            std::fill(row_write(y), row_write(y) + w, zeros);
+        }
+    };
+    auto clear_row = [&](long y) {
+        if ( allocated(y) )
+            std::fill(row_write(y), row_write(y) + w, zeros);
+    };
+    if ( dy != 0 && bands.size() > 1 && height % band_rows == 0 &&
+         dy % long(band_rows) == 0 ) {
+        // whole bands, rotate and clear the ones moved in
+        long k = dy / long(band_rows);
+        long b0 = (k > 0) ? long(bands.size()) - k : 0;
+        if (k > 0)
+            std::rotate(bands.begin(), bands.begin() + k, bands.end());
+        else
+            std::rotate(bands.begin(), bands.end() + k, bands.end());
+        for (size_t b = 0; b < bands.size(); b++)
+            publish(b);
+        for (long b = b0; b < b0 + std::labs(k); b++) {
+            if (sparse)
+                release(b);
+            else
+                std::fill(bands[b].begin(), bands[b].end(), zeros);
+        }
+    } else if (dy > 0) {
+        copied = true;
+        for (long y = 0; y < h - dy; y++)
+            move_row(y, y + dy);
+        for (long y = h - dy; y < h; y++)
+            clear_row(y);
+    } else if (dy < 0) {
+        copied = true;
+        for (long y = h - 1; y >= -dy; y--)
+            move_row(y, y + dy);
+        for (long y = 0; y < -dy; y++)
+            clear_row(y);
+    }
+    if (sparse && copied)
+        for (size_t b = 0; b < bands.size(); b++)
+            if ( ! live[b] )
+                release(b);
+    if (dx == 0)
+        return;
+    for (long y = 0; y < h; y++) {
+        if ( ! allocated(y) )
+            continue;
+        cell_info_t* it = row_write(y);
+        if (dx > 0) {
+            std::copy(it + dx, it + w, it);
+            std::fill(it + w - dx, it + w, zeros);
+        } else {
+            std::copy_backward(it, it + w + dx, it + w);
+            std::fill(it, it - dx, zeros);
+        }
+    }
+}
+
+} // namespace atlaas
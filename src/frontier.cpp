@@ -0,0 +1,126 @@
+/*
+ * frontier.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <stdexcept>        // runtime_error
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+const size_t frontier::NONE;
+
+/**
+ * add or remove a cell, swapping the last one in its place
+ */
+void frontier::evaluate(const cell_grid& internal, size_t index) {
+    bool is_frontier = false;
+    if ( internal[index][N_POINTS] > 0 ) {
+        const size_t x = index % width, y = index / width;
+        is_frontier = ( x > 0          && internal[index - 1][N_POINTS] < 1 )
+                   || ( x + 1 < width  && internal[index + 1][N_POINTS] < 1 )
+                   || ( y > 0          &&
+                        internal[index - width][N_POINTS] < 1 )
+                   || ( y + 1 < height &&
+                        internal[index + width][N_POINTS] < 1 );
+    }
+    if ( is_frontier == contains(index) )
+        return;
+    if (is_frontier) {
+        position[index] = cells.size();
+        cells.push_back(index);
+    } else {
+        const size_t last = cells.back();
+        cells[ position[index] ] = last;
+        position[last] = position[index];
+        cells.pop_back();
+        position[index] = NONE;
+    }
+}
+
+void frontier::update(const cell_grid& internal) {
+    if ( stale.exchange(false) ) {
+        seen.clear();
+        cells.clear();
+        std::fill(position.begin(), position.end(), NONE);
+        for (size_t index = 0; index < width * height; index++)
+            evaluate(internal, index);
+        return;
+    }
+    for (size_t index : seen) {
+        const size_t x = index % width, y = index / width;
+        evaluate(internal, index);
+        if (x > 0)
+            evaluate(internal, index - 1);
+        if (x + 1 < width)
+            evaluate(internal, index + 1);
+        if (y > 0)
+            evaluate(internal, index - width);
+        if (y + 1 < height)
+            evaluate(internal, index + width);
+    }
+    seen.clear();
+}
+
+std::vector<std::vector<size_t>> frontier::clusters(size_t min_size) const {
+    std::vector<std::vector<size_t>> result;
+    std::vector<char> visited(cells.size(), false); // per position
+    std::vector<size_t> cluster;
+    for (size_t start = 0; start < cells.size(); start++) {
+        if ( visited[start] )
+            continue;
+        visited[start] = true;
+        cluster.assign(1, cells[start]);
+        // breadth first, the cluster is the queue
+        for (size_t next = 0; next < cluster.size(); next++) {
+            const long x = cluster[next] % width, y = cluster[next] / width;
+            for (long ny = y - 1; ny <= y + 1; ny++)
+            for (long nx = x - 1; nx <= x + 1; nx++) {
+                if ( nx < 0 || ny < 0 || nx >= long(width) ||
+                     ny >= long(height) )
+                    continue;
+                const size_t pos = position[ size_t(nx) + ny * width ];
+                if ( pos == NONE || visited[pos] )
+                    continue;
+                visited[pos] = true;
+                cluster.push_back( cells[pos] );
+            }
+        }
+        if ( cluster.size() >= min_size )
+            result.push_back(cluster);
+    }
+    return result;
+}
+
+const std::vector<size_t>& atlaas::get_frontier() {
+    if (!front)
+        throw std::runtime_error("atlaas: frontier is disabled");
+    front->update(internal);
+    return front->get_cells();
+}
+
+std::vector<frontier_segment_t> atlaas::frontier_segments(size_t min_size) {
+    get_frontier(); // up to date
+    std::vector<frontier_segment_t> segments;
+    for (auto& cluster : front->clusters(min_size)) {
+        double px = 0, py = 0;
+        for (size_t index : cluster) {
+            px += index % width;
+            py += index / width;
+        }
+        // centre of the mean cell
+        const double n = cluster.size();
+        frontier_segment_t segment;
+        segment.centroid = point_pix2custom(map, px / n + 0.5, py / n + 0.5);
+        segment.cells = std::move(cluster);
+        segments.push_back( std::move(segment) );
+    }
+    return segments;
+}
+
+} // namespace atlaas
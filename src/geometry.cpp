@@ -0,0 +1,173 @@
+/*
+ * geometry.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cmath>            // fabs
+#include <algorithm>        // min
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+std::vector<char> atlaas::changed_blocks(export_state& state) const {
+    const size_t n = bw * bh;
+    std::vector<char> changed(n, true);
+    if ( state.epoch == locks.get_epoch() && state.versions.size() == n )
+        for (size_t block = 0; block < n; block++)
+            changed[block] = ( state.versions[block] != locks.version(block) );
+    state.epoch = locks.get_epoch();
+    state.versions.resize(n);
+    for (size_t block = 0; block < n; block++)
+        state.versions[block] = locks.version(block);
+    return changed;
+}
+
+size_t atlaas::export_points(export_state& state, points& vertices,
+                             std::vector<geometry_block_t>& blocks) const {
+    const auto& changed = changed_blocks(state);
+    vertices.clear();
+    blocks.clear();
+    const point_xy_t& origin = map.point_custom2pix(0, 0);
+    const double sx = map.get_scale_x(), sy = map.get_scale_y();
+    cells_info_t cells;
+    for (size_t block = 0; block < changed.size(); block++) {
+        if ( ! changed[block] )
+            continue;
+        size_t x0 = (block % bw) * BLOCK_SIZE, y0 = (block / bw) * BLOCK_SIZE;
+        size_t w = std::min(BLOCK_SIZE, width  - x0);
+        size_t h = std::min(BLOCK_SIZE, height - y0);
+        read_region(x0, y0, w, h, cells);
+        geometry_block_t part = { block, vertices.size(), 0, 0, 0 };
+        auto it = cells.begin();
+        for (size_t y = 0; y < h; y++)
+        for (size_t x = 0; x < w; x++, it++)
+            if ( (*it)[N_POINTS] > 0 )
+                vertices.push_back({{ float((x0 + x + 0.5 - origin[0]) * sx),
+                                      float((y0 + y + 0.5 - origin[1]) * sy),
+                                      (*it)[Z_MEAN] }});
+        part.n_vertices = vertices.size() - part.first_vertex;
+        blocks.push_back(part);
+    }
+    return blocks.size();
+}
+
+/**
+ * Quadtree mesher of the cell centres of a block (see atlaas::export_mesh)
+ *
+ * Squares are between cell centres, `cells` being the block plus the next
+ * row and column (when in the window), so squares are qw x qh.
+ */
+struct block_mesher {
+    const cells_info_t& cells;
+    size_t stride;      // cells per row
+    size_t qw, qh;      // squares
+    float tolerance;
+    std::vector<uint32_t> ids; // vertex of a cell, if any
+    size_t x0, y0;      // block in the window
+    point_xy_t origin;  // pixel of the custom origin
+    double sx, sy;      // map scale
+    points& vertices;
+    std::vector<uint32_t>& indices;
+    size_t first;       // first vertex of the block
+
+    float z(size_t x, size_t y) const {
+        return cells[y * stride + x][Z_MEAN];
+    }
+
+    bool known(size_t x, size_t y) const {
+        return cells[y * stride + x][N_POINTS] > 0;
+    }
+
+    uint32_t vertex(size_t x, size_t y) {
+        uint32_t& id = ids[y * stride + x];
+        if ( id == std::numeric_limits<uint32_t>::max() ) {
+            id = vertices.size() - first;
+            vertices.push_back({{ float((x0 + x + 0.5 - origin[0]) * sx),
+                                  float((y0 + y + 0.5 - origin[1]) * sy),
+                                  z(x, y) }});
+        }
+        return id;
+    }
+
+    /**
+     * all cells known and close to the bilinear surface of the corners
+     */
+    bool flat(size_t qx, size_t qy, size_t s) const {
+        if ( qx + s > qw || qy + s > qh )
+            return false;
+        const float z00 = z(qx, qy),     z10 = z(qx + s, qy),
+                    z01 = z(qx, qy + s), z11 = z(qx + s, qy + s);
+        for (size_t j = 0; j <= s; j++)
+        for (size_t i = 0; i <= s; i++) {
+            if ( ! known(qx + i, qy + j) )
+                return false;
+            float u = float(i) / s, v = float(j) / s;
+            float bilinear = (z00 * (1 - u) + z10 * u) * (1 - v)
+                           + (z01 * (1 - u) + z11 * u) * v;
+            if ( std::fabs( z(qx + i, qy + j) - bilinear ) > tolerance )
+                return false;
+        }
+        return true;
+    }
+
+    void node(size_t qx, size_t qy, size_t s) {
+        if ( qx >= qw || qy >= qh )
+            return;
+        if ( flat(qx, qy, s) ) {
+            uint32_t a = vertex(qx, qy),     b = vertex(qx + s, qy),
+                     c = vertex(qx, qy + s), d = vertex(qx + s, qy + s);
+            // pixel rows go south, counter-clockwise seen from above
+            indices.insert(indices.end(), { a, c, b, b, c, d });
+        } else if (s > 1) {
+            size_t half = s / 2;
+            node(qx,        qy,        half);
+            node(qx + half, qy,        half);
+            node(qx,        qy + half, half);
+            node(qx + half, qy + half, half);
+        }
+    }
+};
+
+size_t atlaas::export_mesh(export_state& state, points& vertices,
+                           std::vector<uint32_t>& indices,
+                           std::vector<geometry_block_t>& blocks,
+                           float tolerance) const {
+    const auto& changed = changed_blocks(state);
+    vertices.clear();
+    indices.clear();
+    blocks.clear();
+    const point_xy_t& origin = map.point_custom2pix(0, 0);
+    const double sx = map.get_scale_x(), sy = map.get_scale_y();
+    cells_info_t cells;
+    for (size_t block = 0; block < changed.size(); block++) {
+        size_t bx = block % bw, by = block / bw;
+        // squares of the block reach the next row and column of blocks
+        bool dirty = changed[block] ||
+            (bx + 1 < bw && changed[block + 1]) ||
+            (by + 1 < bh && changed[block + bw]) ||
+            (bx + 1 < bw && by + 1 < bh && changed[block + bw + 1]);
+        if ( ! dirty )
+            continue;
+        size_t x0 = bx * BLOCK_SIZE, y0 = by * BLOCK_SIZE;
+        size_t w = std::min(BLOCK_SIZE + 1, width  - x0);
+        size_t h = std::min(BLOCK_SIZE + 1, height - y0);
+        read_region(x0, y0, w, h, cells);
+        geometry_block_t part = { block, vertices.size(), 0,
+                                  indices.size(), 0 };
+        block_mesher mesher = { cells, w, w - 1, h - 1, tolerance,
+            std::vector<uint32_t>(w * h, std::numeric_limits<uint32_t>::max()),
+            x0, y0, origin, sx, sy, vertices, indices, part.first_vertex };
+        mesher.node(0, 0, BLOCK_SIZE);
+        part.n_vertices = vertices.size() - part.first_vertex;
+        part.n_indices  = indices.size()  - part.first_index;
+        blocks.push_back(part);
+    }
+    return blocks.size();
+}
+
+} // namespace atlaas
@@ -0,0 +1,54 @@
+/*
+ * heatmap.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cstdlib>          // labs
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+static const std::vector<std::string> HEATMAP_NAMES =
+    {"HITS", "TIME", "COST"};
+
+void heatmap::shift(long dx, long dy) {
+    const long w = bw, h = bh;
+    if ( std::labs(dx) >= w || std::labs(dy) >= h ) {
+        reset();
+        return;
+    }
+    std::vector<uint64_t> old_hits(hits.size(), 0), old_cost(cost.size(), 0);
+    old_hits.swap(hits);
+    old_cost.swap(cost);
+    for (long y = std::max(0L, -dy); y < std::min(h, h - dy); y++)
+    for (long x = std::max(0L, -dx); x < std::min(w, w - dx); x++) {
+        hits[y * w + x] = old_hits[(y + dy) * w + x + dx];
+        cost[y * w + x] = old_cost[(y + dy) * w + x + dx];
+    }
+}
+
+void heatmap::save(const std::string& filepath,
+                   const gdalwrap::gdal& map) const {
+    gdalwrap::gdal raster;
+    raster.copy_meta(map, bw, bh);
+    raster.set_size(HEATMAP_NAMES.size(), bw, bh);
+    raster.names = HEATMAP_NAMES;
+    // one pixel per block, from the map top-left corner
+    raster.set_transform(map.get_utm_pose_x(), map.get_utm_pose_y(),
+                         map.get_scale_x() * BLOCK_SIZE,
+                         map.get_scale_y() * BLOCK_SIZE);
+    for (size_t block = 0; block < hits.size(); block++) {
+        raster.bands[0][block] = hits[block];
+        raster.bands[1][block] = cost[block] * 1e-6;
+        raster.bands[2][block] = hits[block] ?
+            double(cost[block]) / hits[block] : 0;
+    }
+    raster.save(filepath);
+}
+
+} // namespace atlaas
@@ -0,0 +1,105 @@
+/*
+ * history.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <set>
+#include <stdexcept>        // out_of_range
+#include <algorithm>        // min, upper_bound
+
+#include "atlaas/history.hpp"
+
+namespace atlaas {
+
+size_t map_history::commit(const atlaas& source, double time) {
+    if ( ! versions.empty() && time < versions.back().time )
+        throw std::out_of_range("map_history::commit: time goes back");
+    const size_t width = source.get_width(), height = source.get_height();
+    const size_t bw = (width  + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    // versions are taken before reading, a write meanwhile shows next time
+    const auto& changed = source.changed_blocks(state);
+    version_t version;
+    version.time = time;
+    version.current = source.get_frame().current;
+    version.width = width;
+    version.height = height;
+    version.bw = bw;
+    version.blocks.resize(changed.size());
+    const version_t* previous = versions.empty() ? NULL : &versions.back();
+    bool same = previous && previous->current == version.current &&
+                previous->blocks.size() == changed.size();
+    size_t copied = 0;
+    for (size_t block = 0; block < changed.size(); block++) {
+        if ( same && ! changed[block] ) {
+            version.blocks[block] = previous->blocks[block];
+            continue;
+        }
+        size_t x0 = (block % bw) * BLOCK_SIZE, y0 = (block / bw) * BLOCK_SIZE;
+        std::shared_ptr<cells_info_t> cells(new cells_info_t);
+        if ( source.read_region(x0, y0, std::min(BLOCK_SIZE, width - x0),
+                                std::min(BLOCK_SIZE, height - y0), *cells)
+             != version.current ) {
+            // slid in between, start over with every block
+            state = export_state();
+            return commit(source, time);
+        }
+        version.blocks[block] = cells;
+        copied++;
+    }
+    versions.push_back(std::move(version));
+    retain();
+    return copied;
+}
+
+void map_history::retain() {
+    while ( max_versions > 0 && versions.size() > max_versions )
+        versions.pop_front();
+    while ( max_age > 0 && versions.size() > 1 &&
+            versions.front().time < versions.back().time - max_age )
+        versions.pop_front();
+}
+
+size_t map_history::find(double time) const {
+    auto it = std::upper_bound(versions.begin(), versions.end(), time,
+        [](double t, const version_t& version) { return t < version.time; });
+    if ( it == versions.begin() )
+        throw std::out_of_range("map_history::find: no version then");
+    return (it - versions.begin()) - 1;
+}
+
+void map_history::read_region(size_t index, size_t x, size_t y,
+                              size_t w, size_t h, cells_info_t& cells) const {
+    const version_t& version = versions.at(index);
+    if ( x + w > version.width || y + h > version.height )
+        throw std::out_of_range("map_history::read_region");
+    cells.resize(w * h);
+    for (size_t row = y; row < y + h; row++) {
+        size_t by = row / BLOCK_SIZE, ry = row % BLOCK_SIZE;
+        for (size_t col = x; col < x + w; ) {
+            size_t bx = col / BLOCK_SIZE;
+            size_t x1 = std::min(x + w, (bx + 1) * BLOCK_SIZE);
+            const cells_info_t& block = *version.blocks[by * version.bw + bx];
+            // blocks are stored with their own width (partial at the edge)
+            size_t stride = std::min(BLOCK_SIZE,
+                                     version.width - bx * BLOCK_SIZE);
+            auto it = block.begin() + ry * stride + (col - bx * BLOCK_SIZE);
+            std::copy(it, it + (x1 - col),
+                      cells.begin() + (row - y) * w + (col - x));
+            col = x1;
+        }
+    }
+}
+
+size_t map_history::get_blocks() const {
+    std::set<const cells_info_t*> distinct;
+    for (const auto& version : versions)
+        for (const auto& block : version.blocks)
+            distinct.insert(block.get());
+    return distinct.size();
+}
+
+} // namespace atlaas
@@ -0,0 +1,119 @@
+/*
+ * layers.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <atomic>
+#include <thread>
+#include <cmath>            // NAN
+#include <stdexcept>        // out_of_range
+#include <algorithm>        // min, max
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+size_t atlaas::add_layer(const std::string& name,
+                         const layer_kernel_t& kernel, size_t margin) {
+    std::unique_ptr<derived_layer> layer(new derived_layer);
+    layer->name = name;
+    layer->kernel = kernel;
+    layer->margin = margin;
+    layer->epoch = 0;
+    layer->current = {{0, 0}};
+    layers.push_back(std::move(layer));
+    return layers.size() - 1;
+}
+
+size_t atlaas::get_layer_index(const std::string& name) const {
+    for (size_t index = 0; index < layers.size(); index++)
+        if (layers[index]->name == name)
+            return index;
+    throw std::out_of_range("atlaas::get_layer_index " + name);
+}
+
+/**
+ * A block is up to date while the versions of the blocks within the margin
+ * are the ones it was computed from: versions only increase, so their sum
+ * (the stamp) does too when any of them changes.
+ */
+map_id_t atlaas::read_layer(size_t index, size_t x, size_t y,
+                            size_t w, size_t h, std::vector<float>& values,
+                            size_t n_threads) const {
+    if ( index >= layers.size() || x + w > width || y + h > height )
+        throw std::out_of_range("atlaas::read_layer");
+    derived_layer& layer = *layers[index];
+    std::lock_guard<std::mutex> lock(layer.mutex);
+    if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    const long reach = (layer.margin + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    values.resize(w * h);
+    if (w == 0 || h == 0)
+        return layer.current;
+
+    std::atomic<bool> slid(false);
+    do {
+        const map_id_t window = get_frame().current;
+        if ( slid || layer.epoch != locks.get_epoch() ||
+             layer.current != window ||
+             layer.values.size() != width * height ) {
+            layer.values.assign(width * height, NAN);
+            layer.stamps.assign(bw * bh, 0);
+            layer.epoch = locks.get_epoch();
+            layer.current = window;
+            slid = false;
+        }
+        // stale blocks under the region, stamps taken before reading
+        std::vector<std::pair<size_t, uint64_t>> stale;
+        const long bx0 = x / BLOCK_SIZE, bx1 = (x + w - 1) / BLOCK_SIZE;
+        const long by0 = y / BLOCK_SIZE, by1 = (y + h - 1) / BLOCK_SIZE;
+        for (long by = by0; by <= by1; by++)
+        for (long bx = bx0; bx <= bx1; bx++) {
+            uint64_t stamp = 1;
+            for (long ny = std::max(0L, by - reach);
+                      ny <= std::min(long(bh) - 1, by + reach); ny++)
+            for (long nx = std::max(0L, bx - reach);
+                      nx <= std::min(long(bw) - 1, bx + reach); nx++)
+                stamp += locks.version(ny * bw + nx);
+            size_t block = by * bw + bx;
+            if (layer.stamps[block] != stamp)
+                stale.push_back({ block, stamp });
+        }
+        parallel_jobs(stale.size(), n_threads, [&](size_t job) {
+            const size_t block = stale[job].first;
+            const size_t x0 = (block % bw) * BLOCK_SIZE,
+                         y0 = (block / bw) * BLOCK_SIZE;
+            const size_t x1 = std::min(width,  x0 + BLOCK_SIZE),
+                         y1 = std::min(height, y0 + BLOCK_SIZE);
+            // the block grown by the margin, clipped to the window
+            const size_t gx = x0 - std::min(x0, layer.margin),
+                         gy = y0 - std::min(y0, layer.margin);
+            const size_t gw = std::min(width,  x1 + layer.margin) - gx,
+                         gh = std::min(height, y1 + layer.margin) - gy;
+            cells_info_t cells;
+            if ( read_region(gx, gy, gw, gh, cells) != window ) {
+                slid = true;
+                return;
+            }
+            for (size_t cy = y0; cy < y1; cy++) {
+                float* out = &layer.values[cy * width + x0];
+                for (size_t cx = x0; cx < x1; cx++, out++)
+                    *out = layer.kernel( stencil(cells.data(), gw, gh,
+                        cx - gx, cy - gy, layer.margin) );
+            }
+            layer.stamps[block] = stale[job].second;
+        });
+    } while (slid);
+
+    for (size_t row = 0; row < h; row++) {
+        auto it = layer.values.begin() + (y + row) * width + x;
+        std::copy(it, it + w, values.begin() + row * w);
+    }
+    return layer.current;
+}
+
+} // namespace atlaas
@@ -0,0 +1,205 @@
+/*
+ * load.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <atomic>
+#include <thread>
+#include <cmath>            // floor, ceil
+#include <cstdlib>          // atof
+#include <stdexcept>        // runtime_error
+#include <exception>        // exception_ptr
+#include <algorithm>        // min, max
+
+#include <gdal.h>
+#include <cpl_error.h>
+#include <ogr_srs_api.h>
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+/**
+ * GDAL dataset, closed on scope exit
+ * (a handle is not thread-safe, each reader opens its own)
+ */
+struct dataset_t {
+    GDALDatasetH handle;
+
+    dataset_t(const std::string& filepath) {
+        handle = GDALOpen(filepath.c_str(), GA_ReadOnly);
+        if (handle == NULL)
+            throw std::runtime_error("GDALOpen " + filepath + ": "
+                                     + CPLGetLastErrorMsg());
+    }
+
+    ~dataset_t() {
+        GDALClose(handle);
+    }
+};
+
+void atlaas::init(const std::string& filepath, const roi_t& roi,
+                  double scale, size_t n_threads) {
+    wait_saves();
+    GDALAllRegister();
+    dataset_t ds(filepath);
+    if ( GDALGetRasterCount(ds.handle) != N_RASTER )
+        throw std::runtime_error("not an atlaas map: " + filepath);
+    for (int band = 0; band < N_RASTER; band++) {
+        const char* name = GDALGetDescription(
+            GDALGetRasterBand(ds.handle, band + 1) );
+        if ( name && *name && MAP_NAMES[band] != name )
+            throw std::runtime_error("not an atlaas map: " + filepath);
+    }
+    double gt[6];
+    if ( GDALGetGeoTransform(ds.handle, gt) != CE_None ||
+         gt[2] != 0 || gt[4] != 0 || gt[1] <= 0 || gt[5] >= 0 )
+        throw std::runtime_error("unsupported geotransform: " + filepath);
+    auto metadata = [&](const char* key) -> double {
+        const char* value = GDALGetMetadataItem(ds.handle, key, NULL);
+        return value ? std::atof(value) : 0;
+    };
+    double custom_x = metadata("CUSTOM_X_ORIGIN");
+    double custom_y = metadata("CUSTOM_Y_ORIGIN");
+    int utm_zone = 0, utm_north = 1;
+    OGRSpatialReferenceH srs = OSRNewSpatialReference(
+        GDALGetProjectionRef(ds.handle) );
+    if (srs) {
+        utm_zone = OSRGetUTMZone(srs, &utm_north);
+        OSRDestroySpatialReference(srs);
+    }
+
+    // top-left corner of the region
+    double utm_x = custom_x + roi[0], utm_y = custom_y + roi[3];
+    width  = std::ceil((roi[2] - roi[0]) / scale);
+    height = std::ceil((roi[3] - roi[1]) / scale);
+    map.set_size(N_RASTER, width, height);
+    map.set_transform(utm_x, utm_y, scale, -scale);
+    map.set_utm(utm_zone, utm_north);
+    map.set_custom_origin(custom_x, custom_y);
+    map.names = MAP_NAMES;
+    internal.assign(width, height, blocked_storage);
+    bw = (width  + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    bh = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    locks.resize(bw * bh);
+    if (heat)
+        heat->resize(bw, bh);
+    if (front)
+        front->resize(width, height);
+    current = {{0,0}};
+    sw = width  / 3; // sub-width
+    sh = height / 3; // sub-height
+    sub = std::move(std::unique_ptr<atlaas>(new atlaas));
+    sub->map.copy_meta(map, sw, sh);
+    sub->internal.assign(sw, sh);
+    _alloc_policy();
+    variance_factor = 3.0;
+    vertical_slope = 0;
+    ring_classified = false;
+    time_base = std::time(NULL);
+    map_sync = false;
+    _publish_frame();
+
+    // raster pixel of internal cell corner (i, j): o + k * (i, j)
+    const double ox = (utm_x - gt[0]) / gt[1], kx =  scale / gt[1];
+    const double oy = (utm_y - gt[3]) / gt[5], ky = -scale / gt[5];
+    const int raster_x = GDALGetRasterXSize(ds.handle);
+    const int raster_y = GDALGetRasterYSize(ds.handle);
+    // cells entirely in the raster (up to rounding), so that the window
+    // read does not start or end out of it (and the cells keep their scale)
+    const double eps = 1e-6;
+    long i0 = std::max(0L, long(std::ceil(-ox / kx - eps)));
+    long i1 = std::min(long(width),
+                       long(std::floor((raster_x - ox) / kx + eps)));
+    long j0 = std::max(0L, long(std::ceil(-oy / ky - eps)));
+    long j1 = std::min(long(height),
+                       long(std::floor((raster_y - oy) / ky + eps)));
+    if ( i0 >= i1 || j0 >= j1 )
+        return; // region out of the map
+
+    struct job_t {
+        int band;
+        long ja, jb; // rows of internal
+    };
+    // strips of rows within a block row, contiguous in blocked storage too
+    std::vector<job_t> jobs;
+    const long rows = BLOCK_SIZE;
+    for (int band = 0; band < N_RASTER; band++)
+        for (long ja = j0; ja < j1; ja = (ja / rows + 1) * rows)
+            jobs.push_back({ band, ja,
+                             std::min(j1, (ja / rows + 1) * rows) });
+    // bands are allocated before the concurrent strips, and the ones left
+    // unobserved are released after
+    internal.allocate();
+
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors;
+    auto read = [&](GDALDatasetH handle, size_t wid) {
+        try {
+            for (size_t job = next++; job < jobs.size(); job = next++) {
+                const job_t& strip = jobs[job];
+                GDALRasterIOExtraArg arg;
+                INIT_RASTERIO_EXTRA_ARG(arg);
+                arg.bFloatingPointWindowValidity = TRUE;
+                // clamped, for the rounding
+                arg.dfXOff  = std::max(0.0, ox + i0 * kx);
+                arg.dfYOff  = std::max(0.0, oy + strip.ja * ky);
+                arg.dfXSize = std::min<double>(raster_x, ox + i1 * kx)
+                            - arg.dfXOff;
+                arg.dfYSize = std::min<double>(raster_y, oy + strip.jb * ky)
+                            - arg.dfYOff;
+                int x0 = std::max(0, int(std::floor(arg.dfXOff)));
+                int y0 = std::max(0, int(std::floor(arg.dfYOff)));
+                int x1 = std::min(raster_x,
+                                  int(std::ceil(arg.dfXOff + arg.dfXSize)));
+                int y1 = std::min(raster_y,
+                                  int(std::ceil(arg.dfYOff + arg.dfYSize)));
+                // straight in internal, interleaved with the other bands
+                float* dst = &internal.row_write(strip.ja)[i0][strip.band];
+                if ( GDALRasterIOEx(GDALGetRasterBand(handle, strip.band + 1),
+                        GF_Read, x0, y0, x1 - x0, y1 - y0, dst,
+                        i1 - i0, strip.jb - strip.ja, GDT_Float32,
+                        sizeof(cell_info_t), sizeof(cell_info_t) * width,
+                        &arg) != CE_None )
+                    throw std::runtime_error("GDALRasterIO " + filepath + ": "
+                                             + CPLGetLastErrorMsg());
+            }
+        } catch (...) {
+            errors[wid] = std::current_exception();
+        }
+    };
+
+    if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    n_threads = std::min(n_threads, jobs.size());
+    errors.resize(n_threads);
+    std::vector<std::thread> readers;
+    for (size_t wid = 1; wid < n_threads; wid++)
+        readers.push_back(std::thread([&, wid]() {
+            try {
+                dataset_t own(filepath);
+                read(own.handle, wid);
+            } catch (...) {
+                errors[wid] = std::current_exception();
+            }
+        }));
+    read(ds.handle, 0);
+    for (auto& thread : readers)
+        thread.join();
+    for (const auto& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    for (size_t y = 0; y < height; y++) {
+        cell_info_t* it = internal.row_write(y);
+        for (cell_info_t* end = it + width; it < end; it++)
+            (*it)[W_SUM] = (*it)[N_POINTS];
+    }
+    internal.trim();
+}
+
+} // namespace atlaas
@@ -0,0 +1,120 @@
+/*
+ * perf_counters.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cmath>            // NAN
+#include <cstdint>
+#include <cstring>          // memset
+
+#ifdef __linux__
+#include <unistd.h>         // syscall, read, close
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "atlaas/perf_counters.hpp"
+
+namespace atlaas {
+
+#ifdef __linux__
+
+static int perf_open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;        // threads created afterwards
+    attr.exclude_kernel = 1; // allowed with perf_event_paranoid 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cache_config(uint64_t cache, uint64_t op, uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+}
+
+perf_counters::perf_counters() {
+    fds[PERF_CYCLES] = perf_open(PERF_TYPE_HARDWARE,
+                                 PERF_COUNT_HW_CPU_CYCLES);
+    fds[PERF_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE,
+                                       PERF_COUNT_HW_INSTRUCTIONS);
+    fds[PERF_LLC_MISSES] = perf_open(PERF_TYPE_HW_CACHE,
+        cache_config(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                     PERF_COUNT_HW_CACHE_RESULT_MISS));
+    if (fds[PERF_LLC_MISSES] < 0) // generic alias
+        fds[PERF_LLC_MISSES] = perf_open(PERF_TYPE_HARDWARE,
+                                         PERF_COUNT_HW_CACHE_MISSES);
+    fds[PERF_DTLB_MISSES] = perf_open(PERF_TYPE_HW_CACHE,
+        cache_config(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                     PERF_COUNT_HW_CACHE_RESULT_MISS));
+    fds[PERF_BRANCH_MISSES] = perf_open(PERF_TYPE_HARDWARE,
+                                        PERF_COUNT_HW_BRANCH_MISSES);
+}
+
+perf_counters::~perf_counters() {
+    for (int fd : fds)
+        if (fd >= 0)
+            close(fd);
+}
+
+void perf_counters::start() {
+    for (int fd : fds)
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+void perf_counters::stop() {
+    for (int fd : fds)
+        if (fd >= 0)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+perf_values_t perf_counters::read() const {
+    perf_values_t values;
+    for (int counter = 0; counter < N_PERF; counter++) {
+        values[counter] = NAN;
+        uint64_t data[3]; // value, time enabled, time running
+        if ( fds[counter] < 0 ||
+             ::read(fds[counter], data, sizeof(data)) != sizeof(data) )
+            continue;
+        if (data[2] > 0)
+            values[counter] = double(data[0]) * data[1] / data[2];
+        else if (data[1] == 0)
+            values[counter] = 0; // never enabled
+    }
+    return values;
+}
+
+#else
+
+perf_counters::perf_counters() {
+    fds.fill(-1);
+}
+
+perf_counters::~perf_counters() {}
+
+void perf_counters::start() {}
+
+void perf_counters::stop() {}
+
+perf_values_t perf_counters::read() const {
+    perf_values_t values;
+    values.fill(NAN);
+    return values;
+}
+
+#endif
+
+} // namespace atlaas
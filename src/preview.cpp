@@ -0,0 +1,462 @@
+/*
+ * preview.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cerrno>
+#include <cstdio>           // rename
+#include <cstring>          // strerror
+#include <cmath>            // sqrt, fabs
+#include <fstream>          // ifstream, ofstream
+#include <iterator>         // istreambuf_iterator
+#include <stdexcept>        // runtime_error
+#include <algorithm>        // min, max
+
+#include <sys/stat.h>       // mkdir
+
+#include "atlaas/preview.hpp"
+
+namespace atlaas {
+
+/*
+ * PNG encoding
+ */
+
+static uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> t;
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t n, uint32_t adler) {
+    uint32_t a = adler & 0xffff, b = adler >> 16;
+    while (n > 0) {
+        // largest run without overflow before the modulo
+        size_t len = std::min<size_t>(n, 5552);
+        n -= len;
+        for (const uint8_t* end = data + len; data < end; data++) {
+            a += *data;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value) {
+    out.insert(out.end(), { uint8_t(value >> 24), uint8_t(value >> 16),
+                            uint8_t(value >> 8),  uint8_t(value) });
+}
+
+/**
+ * Append a chunk, `data` being already at the end of `out`
+ */
+static void chunk(std::vector<uint8_t>& out, const char* type, size_t start) {
+    size_t length = out.size() - start;
+    std::vector<uint8_t> head;
+    put32(head, length);
+    head.insert(head.end(), type, type + 4);
+    out.insert(out.begin() + start, head.begin(), head.end());
+    put32(out, crc32(&out[start + 4], length + 4));
+}
+
+void png_encode(const uint8_t* rgba, size_t width, size_t height,
+                std::vector<uint8_t>& png) {
+    static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    const size_t stride = width * 4 + 1; // filter byte + row
+    const size_t raw = stride * height;
+    const size_t max_block = 65535;
+    png.clear();
+    png.reserve(64 + raw + 5 * (raw / max_block + 1));
+    png.insert(png.end(), signature, signature + 8);
+    size_t start = png.size();
+    put32(png, width);
+    put32(png, height);
+    // 8 bits RGBA, deflate, adaptive filters, no interlace
+    png.insert(png.end(), { 8, 6, 0, 0, 0 });
+    chunk(png, "IHDR", start);
+
+    start = png.size();
+    png.insert(png.end(), { 0x78, 0x01 }); // zlib, no compression
+    uint32_t adler = 1;
+    size_t left = raw, row = 0, col = 0;
+    while (left > 0) {
+        size_t n = std::min(left, max_block);
+        left -= n;
+        png.insert(png.end(), { uint8_t(left == 0), uint8_t(n),
+            uint8_t(n >> 8), uint8_t(~n), uint8_t(~n >> 8) });
+        // copy n bytes of the filtered rows
+        while (n > 0) {
+            const uint8_t* src;
+            size_t len;
+            uint8_t none = 0; // filter type
+            if (col == 0) {
+                src = &none;
+                len = 1;
+            } else {
+                src = rgba + row * width * 4 + col - 1;
+                len = std::min(n, stride - col);
+            }
+            png.insert(png.end(), src, src + len);
+            adler = adler32(src, len, adler);
+            n -= len;
+            col += len;
+            if (col == stride) {
+                col = 0;
+                row++;
+            }
+        }
+    }
+    put32(png, adler);
+    chunk(png, "IDAT", start);
+    chunk(png, "IEND", png.size());
+}
+
+static uint32_t get32(const uint8_t* data) {
+    return uint32_t(data[0]) << 24 | uint32_t(data[1]) << 16 |
+           uint32_t(data[2]) << 8  | data[3];
+}
+
+bool png_decode(const std::vector<uint8_t>& png, size_t width,
+                size_t height, uint8_t* rgba) {
+    static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if ( png.size() < 8 || ! std::equal(signature, signature + 8,
+                                        png.begin()) )
+        return false;
+    // chunks, the IDAT ones concatenated
+    std::vector<uint8_t> zlib;
+    bool header = false;
+    for (size_t pos = 8; pos + 12 <= png.size(); ) {
+        const size_t length = get32(&png[pos]);
+        if ( length > png.size() - pos - 12 )
+            return false;
+        const uint8_t* type = &png[pos + 4];
+        const uint8_t* data = &png[pos + 8];
+        if ( std::equal(type, type + 4, "IHDR") ) {
+            // 8 bits RGBA, no interlace
+            header = length == 13 && get32(data) == width &&
+                get32(data + 4) == height && data[8] == 8 && data[9] == 6 &&
+                data[12] == 0;
+        } else if ( std::equal(type, type + 4, "IDAT") ) {
+            zlib.insert(zlib.end(), data, data + length);
+        }
+        pos += length + 12;
+    }
+    if ( ! header || zlib.size() < 2 || zlib[0] != 0x78 )
+        return false;
+    // stored deflate blocks only
+    const size_t stride = width * 4 + 1;
+    std::vector<uint8_t> raw;
+    raw.reserve(stride * height);
+    for (size_t pos = 2; ; ) {
+        if ( pos + 5 > zlib.size() || (zlib[pos] & 0x06) != 0 )
+            return false; // truncated, or compressed
+        const bool last = zlib[pos] & 1;
+        const size_t n = zlib[pos + 1] | zlib[pos + 2] << 8;
+        pos += 5;
+        if ( n > zlib.size() - pos )
+            return false;
+        raw.insert(raw.end(), &zlib[pos], &zlib[pos] + n);
+        pos += n;
+        if (last)
+            break;
+    }
+    if ( raw.size() != stride * height )
+        return false;
+    for (size_t row = 0; row < height; row++) {
+        if ( raw[row * stride] != 0 )
+            return false; // filtered
+        std::copy(&raw[row * stride + 1], &raw[row * stride] + stride,
+                  rgba + row * width * 4);
+    }
+    return true;
+}
+
+/*
+ * Rendering
+ */
+
+static long floor_div(long a, long b) {
+    return (a >= 0) ? a / b : - ((- a + b - 1) / b);
+}
+
+static void make_dirs(const std::string& path) {
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        std::string dir = path.substr(0, pos);
+        if ( mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST )
+            throw std::runtime_error("mkdir " + dir + ": "
+                                     + std::strerror(errno));
+        if (pos == std::string::npos)
+            break;
+    }
+}
+
+/**
+ * Colour ramp: blue, cyan, green, yellow, red
+ */
+static void ramp(float t, uint8_t* rgba) {
+    static const float colors[5][3] = { {0, 0, 255}, {0, 255, 255},
+        {0, 255, 0}, {255, 255, 0}, {255, 0, 0} };
+    t = std::min(1.f, std::max(0.f, t)) * 4;
+    size_t k = std::min<size_t>(t, 3);
+    float u = t - k;
+    for (int c = 0; c < 3; c++)
+        rgba[c] = colors[k][c] * (1 - u) + colors[k + 1][c] * u + 0.5;
+    rgba[3] = 255;
+}
+
+/**
+ * Halve a tile image in a quadrant of another, averaging the colors of
+ * the opaque pixels of each 2x2 square
+ */
+static void downsample(const uint8_t* src, uint8_t* dst) {
+    const size_t half = TILE_SIZE / 2;
+    for (size_t y = 0; y < half; y++)
+    for (size_t x = 0; x < half; x++) {
+        unsigned sum[4] = {0, 0, 0, 0}, count = 0;
+        for (size_t j = 0; j < 2; j++)
+        for (size_t i = 0; i < 2; i++) {
+            const uint8_t* p = src + ((2 * y + j) * TILE_SIZE + 2 * x + i) * 4;
+            sum[3] += p[3];
+            if (p[3] == 0)
+                continue;
+            count++;
+            for (int c = 0; c < 3; c++)
+                sum[c] += p[c];
+        }
+        uint8_t* q = dst + (y * TILE_SIZE + x) * 4;
+        for (int c = 0; c < 3; c++)
+            q[c] = count ? sum[c] / count : 0;
+        q[3] = sum[3] / 4;
+    }
+}
+
+tile_renderer::tile_renderer(const std::string& directory, float z_min,
+                             float z_max, size_t levels, float step) :
+        directory(directory), z_min(z_min), z_max(z_max),
+        levels(std::max<size_t>(levels, 1)), step(step) {}
+
+std::string tile_renderer::path(const tile_id_t& id, size_t layer) const {
+    std::ostringstream path;
+    path << directory << "/" << PREVIEW_NAMES[layer] << "/"
+         << (levels - 1 - id[0]) << "/" << id[1] << "/" << id[2] << ".png";
+    return path.str();
+}
+
+/**
+ * Pixels of a tile from its PNG files, transparent if none
+ */
+void tile_renderer::read(const tile_id_t& id, tile_t& tile) const {
+    std::vector<uint8_t> png;
+    for (size_t layer = 0; layer < N_PREVIEW; layer++) {
+        image_t& image = tile.layers[layer];
+        std::ifstream file(path(id, layer), std::ios::binary);
+        png.assign(std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>());
+        if ( ! png_decode(png, TILE_SIZE, TILE_SIZE, image.data()) )
+            std::fill(image.begin(), image.end(), 0);
+    }
+}
+
+void tile_renderer::write(const tile_id_t& id, const tile_t& tile) const {
+    std::vector<uint8_t> png;
+    for (size_t layer = 0; layer < N_PREVIEW; layer++) {
+        const std::string file_path = path(id, layer);
+        make_dirs( file_path.substr(0, file_path.rfind('/')) );
+        png_encode(tile.layers[layer].data(), TILE_SIZE, TILE_SIZE, png);
+        // atomic for the readers, write aside and rename
+        std::string temp = file_path + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary);
+            file.write((const char*) png.data(), png.size());
+            if ( ! file )
+                throw std::runtime_error("write " + temp);
+        }
+        if ( std::rename(temp.c_str(), file_path.c_str()) != 0 )
+            throw std::runtime_error("rename " + temp + ": "
+                                     + std::strerror(errno));
+    }
+}
+
+size_t tile_renderer::render(const atlaas& source, size_t n_threads) {
+    if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    const sensor_frame_t frame = source.get_frame();
+    const std::vector<char>& changed = source.changed_blocks(state);
+    const long T = TILE_SIZE;
+    // the 3x3 submodels of the window, in the global grid
+    const long sw = source.get_sub_width(), sh = source.get_sub_height();
+    const long ww = 3 * sw, wh = 3 * sh;
+    const long gx0 = (frame.current[0] - 1) * sw,
+               gy0 = (frame.current[1] - 1) * sh;
+    const long bw = (source.get_width() + BLOCK_SIZE - 1)
+                  / BLOCK_SIZE;
+    const float mx = std::fabs(frame.scale_x), my = std::fabs(frame.scale_y);
+
+    // finest tiles over the changed blocks (and their neighbours cells,
+    // for the hillshade)
+    std::set<tile_id_t> dirty;
+    for (size_t block = 0; block < changed.size(); block++) {
+        if ( ! changed[block] )
+            continue;
+        long x0 = (block % bw) * BLOCK_SIZE, y0 = (block / bw) * BLOCK_SIZE;
+        long xa = std::max(0L, x0 - 1),
+             xb = std::min(ww, x0 + long(BLOCK_SIZE) + 1);
+        long ya = std::max(0L, y0 - 1),
+             yb = std::min(wh, y0 + long(BLOCK_SIZE) + 1);
+        if ( xa >= xb || ya >= yb )
+            continue; // out of the submodels
+        for (long ty = floor_div(gy0 + ya, T);
+                  ty <= floor_div(gy0 + yb - 1, T); ty++)
+        for (long tx = floor_div(gx0 + xa, T);
+                  tx <= floor_div(gx0 + xb - 1, T); tx++)
+            dirty.insert({{ 0, tx, ty }});
+    }
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    std::atomic<bool> slid(false);
+    size_t written = 0;
+    for (size_t level = 0; level < levels && ! dirty.empty(); level++) {
+        // allocate the new tiles before going parallel
+        std::vector<std::pair<tile_id_t, tile_t*>> todo;
+        std::vector<char> seed; // new in memory, read back from its PNG
+        for (const auto& id : dirty) {
+            tile_t& tile = tiles[id];
+            seed.push_back( tile.layers[0].empty() );
+            for (auto& image : tile.layers)
+                image.resize(T * T * 4);
+            todo.push_back({ id, &tile });
+        }
+        parallel_jobs(todo.size(), n_threads, [&](size_t job) {
+            try {
+                const tile_id_t& id = todo[job].first;
+                tile_t& tile = *todo[job].second;
+                if ( seed[job] )
+                    read(id, tile);
+                if (level == 0) {
+                    // cells of the tile, in the window
+                    long xa = std::max(0L, id[1] * T - gx0),
+                         xb = std::min(ww, (id[1] + 1) * T - gx0);
+                    long ya = std::max(0L, id[2] * T - gy0),
+                         yb = std::min(wh, (id[2] + 1) * T - gy0);
+                    // plus a cell around, for the gradient
+                    long rx = std::max(0L, xa - 1), ry = std::max(0L, ya - 1);
+                    long rw = std::min(ww, xb + 1) - rx,
+                         rh = std::min(wh, yb + 1) - ry;
+                    cells_info_t cells;
+                    if ( source.read_region(rx, ry, rw, rh, cells)
+                         != frame.current ) {
+                        slid = true; // cells are not at gx0, gy0 anymore
+                        return;
+                    }
+                    auto cell = [&](long x, long y) -> const cell_info_t* {
+                        if ( x < rx || x >= rx + rw || y < ry || y >= ry + rh )
+                            return NULL;
+                        const cell_info_t* c = &cells[(y - ry) * rw + x - rx];
+                        return ((*c)[N_POINTS] > 0) ? c : NULL;
+                    };
+                    for (long y = ya; y < yb; y++)
+                    for (long x = xa; x < xb; x++) {
+                        size_t px = (gx0 + x - id[1] * T)
+                                  + (gy0 + y - id[2] * T) * T;
+                        uint8_t* height = &tile.layers[PREVIEW_HEIGHT][px*4];
+                        uint8_t* shade = &tile.layers[PREVIEW_SHADE][px * 4];
+                        uint8_t* mask = &tile.layers[PREVIEW_VERTICAL][px*4];
+                        const cell_info_t* c = cell(x, y);
+                        if (c == NULL) {
+                            std::fill(height, height + 4, 0);
+                            std::fill(shade,  shade  + 4, 0);
+                            std::fill(mask,   mask   + 4, 0);
+                            continue;
+                        }
+                        float z = (*c)[Z_MEAN];
+                        ramp((z - z_min) / (z_max - z_min), height);
+                        // gradient (east, north), one-sided at the edges
+                        const cell_info_t *w = cell(x - 1, y),
+                                          *e = cell(x + 1, y),
+                                          *n = cell(x, y - 1),
+                                          *s = cell(x, y + 1);
+                        float dx = (!!w + !!e) * mx, dy = (!!n + !!s) * my;
+                        float gx = dx > 0 ? ((e ? (*e)[Z_MEAN] : z)
+                                           - (w ? (*w)[Z_MEAN] : z)) / dx : 0;
+                        float gy = dy > 0 ? ((n ? (*n)[Z_MEAN] : z)
+                                           - (s ? (*s)[Z_MEAN] : z)) / dy : 0;
+                        // light from azimuth 315, 45 degrees high
+                        float light = (0.5f * gx - 0.5f * gy + 0.7071f)
+                                    / std::sqrt(gx * gx + gy * gy + 1);
+                        uint8_t gray = 255 * std::max(0.f, light);
+                        shade[0] = shade[1] = shade[2] = gray;
+                        shade[3] = 255;
+                        bool vertical = (*c)[Z_MAX] - (*c)[Z_MIN] > step;
+                        mask[0] = vertical ? 255 : 0;
+                        mask[1] = mask[2] = 0;
+                        mask[3] = vertical ? 255 : 0;
+                    }
+                } else {
+                    // quadrants of the children in memory
+                    for (long j = 0; j < 2; j++)
+                    for (long i = 0; i < 2; i++) {
+                        tile_id_t child = {{ id[0] - 1, 2 * id[1] + i,
+                                             2 * id[2] + j }};
+                        auto it = tiles.find(child);
+                        if ( it == tiles.end() )
+                            continue;
+                        size_t offset = (j * T / 2 * T + i * T / 2) * 4;
+                        for (size_t layer = 0; layer < N_PREVIEW; layer++)
+                            downsample(it->second.layers[layer].data(),
+                                       tile.layers[layer].data() + offset);
+                    }
+                }
+                if ( ! slid )
+                    write(id, tile);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                error = std::current_exception();
+            }
+        });
+        if (error)
+            std::rethrow_exception(error);
+        if (slid) {
+            // render it all again in the new window next time
+            state = export_state();
+            return written;
+        }
+        written += todo.size();
+        std::set<tile_id_t> parents;
+        for (const auto& id : dirty)
+            parents.insert({{ id[0] + 1, floor_div(id[1], 2),
+                                         floor_div(id[2], 2) }});
+        dirty.swap(parents);
+    }
+
+    // keep the tiles over the window only
+    for (auto it = tiles.begin(); it != tiles.end(); ) {
+        long size = T << (*it).first[0];
+        long tx = (*it).first[1] * size, ty = (*it).first[2] * size;
+        if ( tx + size <= gx0 || tx >= gx0 + ww ||
+             ty + size <= gy0 || ty >= gy0 + wh )
+            it = tiles.erase(it);
+        else
+            ++it;
+    }
+    return written;
+}
+
+} // namespace atlaas
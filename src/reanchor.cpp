@@ -0,0 +1,237 @@
+/*
+ * reanchor.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <atomic>
+#include <thread>
+#include <cerrno>
+#include <cstdio>           // rename, remove
+#include <cstring>          // strerror
+#include <stdexcept>        // runtime_error
+#include <exception>        // exception_ptr
+#include <algorithm>        // fill, min, max
+#include <cmath>            // floor
+
+#include "atlaas/atlaas.hpp"
+#include "atlaas/tile_store.hpp"
+
+namespace atlaas {
+
+/**
+ * Re-anchor saved submodels
+ *
+ * Destination submodels are resampled by inverse mapping: each destination
+ * cell centre is brought back in every overlapping corrected submodel and
+ * the nearest source cell is merged with the cell combine logic. Outputs
+ * are written aside (pending in the tile store) and committed once every
+ * source has been read.
+ *
+ * @param corrections: rigid correction per submodel, in the custom frame
+ * @param n_threads: number of workers, 0 for hardware concurrency
+ */
+void atlaas::reanchor(const corrections_t& corrections, size_t n_threads) {
+    // make sure the files are up to date with the current window
+    save_currents();
+    wait_saves();
+
+    struct source_t {
+        map_id_t id;
+        double cos_yaw, sin_yaw, tx, ty, tz;
+        map_id_t min, max; // range of destination submodels
+    };
+    std::vector<source_t> sources;
+    std::map<map_id_t, bool> targets; // destination -> is corrected
+
+    const double scale_x = map.get_scale_x();
+    const double scale_y = map.get_scale_y();
+    // custom coordinates of the pixel origin of a submodel
+    auto origin = [&](const map_id_t& id) -> point_xy_t {
+        return point_pix2custom(map, double(id[0] - current[0] + 1) * sw,
+                                     double(id[1] - current[1] + 1) * sh);
+    };
+    // submodel containing a point in the custom frame
+    auto locate = [&](double x, double y) -> map_id_t {
+        const point_xy_t& pix = map.point_custom2pix(x, y);
+        return {{ current[0] - 1 + int(std::floor(pix[0] / double(sw))),
+                  current[1] - 1 + int(std::floor(pix[1] / double(sh))) }};
+    };
+
+    for (const auto& corr : corrections) {
+        if ( ! sub_exists(corr.first) )
+            continue; // nothing saved there
+        const pose6d& pose = matrix_to_pose6d(corr.second);
+        source_t src = { corr.first, std::cos(pose[0]), std::sin(pose[0]),
+                         pose[3], pose[4], pose[5], corr.first, corr.first };
+        // corrected footprint
+        const point_xy_t& orig = origin(src.id);
+        for (int corner = 0; corner < 4; corner++) {
+            double x = orig[0] + (corner & 1) * sw * scale_x;
+            double y = orig[1] + (corner >> 1) * sh * scale_y;
+            const map_id_t& id = locate(
+                src.cos_yaw * x - src.sin_yaw * y + src.tx,
+                src.sin_yaw * x + src.cos_yaw * y + src.ty );
+            for (int i = 0; i < 2; i++) {
+                src.min[i] = std::min(src.min[i], id[i]);
+                src.max[i] = std::max(src.max[i], id[i]);
+            }
+        }
+        for (int x = src.min[0]; x <= src.max[0]; x++)
+        for (int y = src.min[1]; y <= src.max[1]; y++)
+            targets[{{x, y}}] = false;
+        sources.push_back(src);
+    }
+    for (const auto& src : sources)
+        targets[src.id] = true; // content moved away
+
+    std::vector<map_id_t> todo;
+    std::vector<char> moved;
+    for (const auto& target : targets) {
+        todo.push_back(target.first);
+        moved.push_back(target.second);
+    }
+
+    // load a saved submodel, empty if none
+    auto load = [&](const map_id_t& id, cell_grid& cells) {
+        atlaas tile;
+        if ( sub_read(id, tile) )
+            cells = std::move(tile.internal);
+        else
+            cells.assign(sw, sh);
+    };
+
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors;
+    std::vector<char> empty(todo.size(), false);
+
+    auto worker = [&](size_t wid) {
+        try {
+            std::map<map_id_t, cell_grid> cache; // loaded sources
+            cell_grid acc;
+            for (size_t job = next++; job < todo.size(); job = next++) {
+                const map_id_t& dst = todo[job];
+                if ( moved[job] )
+                    acc.assign(sw, sh);
+                else
+                    load(dst, acc);
+                const point_xy_t& dorig = origin(dst);
+                for (const auto& src : sources) {
+                    if ( dst[0] < src.min[0] || dst[0] > src.max[0] ||
+                         dst[1] < src.min[1] || dst[1] > src.max[1] )
+                        continue;
+                    if ( ! cache.count(src.id) ) {
+                        if (cache.size() > 8)
+                            cache.clear();
+                        load(src.id, cache[src.id]);
+                    }
+                    const cell_grid& cells = cache[src.id];
+                    const point_xy_t& sorig = origin(src.id);
+                    for (size_t j = 0; j < sh; j++) {
+                        cell_info_t* it = acc.row_write(j);
+                        for (size_t i = 0; i < sw; i++, it++) {
+                            // destination cell centre, back in the source
+                            double x = dorig[0] + (i + 0.5) * scale_x
+                                     - src.tx;
+                            double y = dorig[1] + (j + 0.5) * scale_y
+                                     - src.ty;
+                            double si = ( src.cos_yaw * x + src.sin_yaw * y
+                                        - sorig[0]) / scale_x;
+                            double sj = (-src.sin_yaw * x + src.cos_yaw * y
+                                        - sorig[1]) / scale_y;
+                            if ( si < 0 || si >= sw || sj < 0 || sj >= sh )
+                                continue;
+                            cell_info_t info = cells[ size_t(si) +
+                                                      size_t(sj) * sw ];
+                            if ( info[N_POINTS] < 1 )
+                                continue;
+                            info[Z_MIN]  += src.tz;
+                            info[Z_MAX]  += src.tz;
+                            info[Z_MEAN] += src.tz;
+                            merge(*it, info);
+                        }
+                    }
+                }
+                bool observed = false;
+                for (size_t index = 0; index < acc.size() && ! observed;
+                     index++)
+                    observed = acc[index][N_POINTS] > 0;
+                if ( ! observed ) {
+                    empty[job] = true;
+                    continue;
+                }
+                // write aside, same georeferencing as sub_save
+                atlaas tile;
+                tile.map.copy_meta(map, sw, sh);
+                tile.internal = acc;
+                tile.update();
+                const auto& utm = map.point_pix2utm(
+                    double(dst[0] - current[0]) * sw,
+                    double(dst[1] - current[1]) * sh);
+                tile.map.set_transform(utm[0], utm[1], scale_x, scale_y);
+                sub_write(dst, tile.map, true);
+            }
+        } catch (...) {
+            errors[wid] = std::current_exception();
+        }
+    };
+
+    if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    errors.resize(n_threads);
+    std::vector<std::thread> workers;
+    for (size_t wid = 1; wid < n_threads; wid++)
+        workers.push_back(std::thread(worker, wid));
+    worker(0);
+    for (auto& thread : workers)
+        thread.join();
+    for (const auto& error : errors) {
+        if ( ! error )
+            continue;
+        // the saved submodels are left as they were
+        if (store)
+            store->discard();
+        else for (const auto& id : todo)
+            std::remove( (sub_name(id) + ".reanchor").c_str() );
+        std::rethrow_exception(error);
+    }
+
+    // every source has been read, commit
+    if (store) {
+        for (size_t job = 0; job < todo.size(); job++)
+            if ( empty[job] )
+                store->remove(todo[job], true);
+        store->commit();
+    } else for (size_t job = 0; job < todo.size(); job++) {
+        std::string filepath = sub_name(todo[job]);
+        if ( empty[job] ) {
+            if ( std::remove( filepath.c_str() ) != 0 && errno != ENOENT )
+                throw std::runtime_error("atlaas::reanchor: remove " +
+                    filepath + ": " + std::strerror(errno));
+        } else if ( std::rename( (filepath + ".reanchor").c_str(),
+                                 filepath.c_str() ) != 0 ) {
+            throw std::runtime_error("atlaas::reanchor: rename " +
+                filepath + ".reanchor: " + std::strerror(errno));
+        }
+    }
+    for (const auto& id : todo)
+        _written(id);
+
+    // reload the current window from the corrected submodels
+    std::lock_guard<block_locks> reloading(locks);
+    cell_info_t zeros{}; // value-initialization w/empty initializer
+    internal.fill(zeros);
+    gndinter.fill(zeros);
+    std::fill(vertical.begin(), vertical.end(), false);
+    if (front)
+        front->invalidate();
+    for (int sx = -1; sx <= 1; sx++)
+    for (int sy = -1; sy <= 1; sy++)
+        sub_load(sx, sy);
+    map_sync = false;
+}
+
+} // namespace atlaas
@@ -0,0 +1,99 @@
+/*
+ * region.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <stdexcept>        // out_of_range
+#include <algorithm>        // copy, min, max
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+/**
+ * Read a region of internal, optimistically
+ *
+ * Each block is copied between two reads of its version, and copied again
+ * if a writer went through meanwhile. A slide bumps every block, so the
+ * window read along each block tells whether the region is consistent.
+ */
+map_id_t atlaas::read_region(size_t x, size_t y, size_t w, size_t h,
+                             cells_info_t& cells) const {
+    if ( x + w > width || y + h > height )
+        throw std::out_of_range("atlaas::read_region");
+    cells.resize(w * h);
+    map_id_t window = {{0, 0}};
+    bool consistent = false;
+    while ( ! consistent && w > 0 && h > 0 ) {
+        consistent = true;
+        bool first = true;
+        for (size_t by = y / BLOCK_SIZE; by <= (y + h - 1) / BLOCK_SIZE; by++)
+        for (size_t bx = x / BLOCK_SIZE; bx <= (x + w - 1) / BLOCK_SIZE; bx++) {
+            size_t block = by * bw + bx;
+            size_t x0 = std::max(x, bx * BLOCK_SIZE),
+                   x1 = std::min(x + w, (bx + 1) * BLOCK_SIZE);
+            size_t y0 = std::max(y, by * BLOCK_SIZE),
+                   y1 = std::min(y + h, (by + 1) * BLOCK_SIZE);
+            map_id_t seen;
+            unsigned version;
+            do {
+                version = locks.read_begin(block);
+                seen = current;
+                for (size_t row = y0; row < y1; row++) {
+                    const cell_info_t* it = internal.row(row);
+                    std::copy(it + x0, it + x1,
+                              cells.begin() + (row - y) * w + (x0 - x));
+                }
+            } while ( ! locks.read_end(block, version) );
+            if (first)
+                window = seen;
+            else if (seen != window)
+                consistent = false; // slid in between, read again
+            first = false;
+        }
+    }
+    return window;
+}
+
+/**
+ * Write a region of internal, locking the blocks it covers (in order)
+ *
+ * @returns false if the window is not the given one anymore
+ */
+bool atlaas::write_region(size_t x, size_t y, size_t w, size_t h,
+                          const cells_info_t& cells, const map_id_t& window) {
+    if ( x + w > width || y + h > height || cells.size() != w * h )
+        throw std::out_of_range("atlaas::write_region");
+    if ( w == 0 || h == 0 )
+        return true;
+    std::vector<size_t> blocks;
+    for (size_t by = y / BLOCK_SIZE; by <= (y + h - 1) / BLOCK_SIZE; by++)
+    for (size_t bx = x / BLOCK_SIZE; bx <= (x + w - 1) / BLOCK_SIZE; bx++)
+        blocks.push_back(by * bw + bx);
+    for (size_t block : blocks)
+        locks.lock(block);
+    // copy-on-write once locked, a snapshot taken meanwhile copies these
+    // blocks after the write (as a reader), or before (touch) if seen here
+    std::shared_ptr<snapshot> snap = std::atomic_load(&saving);
+    if (snap)
+        for (size_t block : blocks)
+            snap->touch_locked(block);
+    bool same = (current == window);
+    if (same) {
+        for (size_t row = 0; row < h; row++)
+            std::copy(cells.begin() + row * w, cells.begin() + (row + 1) * w,
+                      internal.row_write(y + row) + x);
+        if (front)
+            front->invalidate();
+        map_sync = false;
+    }
+    for (size_t block : blocks)
+        locks.unlock(block);
+    return same;
+}
+
+} // namespace atlaas
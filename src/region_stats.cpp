@@ -0,0 +1,319 @@
+/*
+ * region_stats.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <thread>
+#include <cmath>            // NAN, INFINITY, floor, fmin, fmax, lround
+#include <stdexcept>        // out_of_range, runtime_error
+#include <algorithm>        // min, max
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+const size_t region_index::LEVELS;
+const size_t region_index::SIDE;
+
+void region_index::reset(const atlaas& map) {
+    width  = map.width;
+    height = map.height;
+    bw = map.bw;
+    bh = map.bh;
+    epoch = map.locks.get_epoch();
+    current = map.get_frame().current;
+    const sums_t zeros = { 0, 0 };
+    stamps.assign(bw * bh, 0);
+    local.assign(bw * bh * SIDE * SIDE, zeros);
+    row_sums.assign(bh * SIDE * (bw + 1), zeros);
+    col_sums.assign(bw * SIDE * (bh + 1), zeros);
+    block_sums.assign((bh + 1) * (bw + 1), zeros);
+    lows.assign(LEVELS, std::vector<float>(width * height, INFINITY));
+    highs.assign(LEVELS, std::vector<float>(width * height, -INFINITY));
+}
+
+/**
+ * A block is up to date while the versions of its 2 x 2 neighbourhood
+ * (the block, right, lower, lower right) are the ones it was computed
+ * from: versions only increase, so their sum (the stamp) does too.
+ */
+void region_index::update(const atlaas& map, size_t n_threads) {
+    if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    if ( epoch != map.locks.get_epoch() ||
+         current != map.get_frame().current ||
+         width != map.width || height != map.height )
+        reset(map);
+
+    std::vector<std::pair<size_t, uint64_t>> stale;
+    std::vector<char> stale_rows(bh, false), stale_cols(bw, false);
+    for (size_t by = 0; by < bh; by++)
+    for (size_t bx = 0; bx < bw; bx++) {
+        uint64_t stamp = 1;
+        for (size_t ny = by; ny <= std::min(bh - 1, by + 1); ny++)
+        for (size_t nx = bx; nx <= std::min(bw - 1, bx + 1); nx++)
+            stamp += map.locks.version(ny * bw + nx);
+        const size_t block = by * bw + bx;
+        if (stamps[block] != stamp) {
+            stale.push_back({ block, stamp });
+            stale_rows[by] = stale_cols[bx] = true;
+        }
+    }
+    if ( stale.empty() )
+        return;
+
+    auto extent = [&](size_t block, size_t& x0, size_t& y0,
+                      size_t& w, size_t& h) {
+        x0 = (block % bw) * BLOCK_SIZE;
+        y0 = (block / bw) * BLOCK_SIZE;
+        w = std::min(BLOCK_SIZE, width  - x0);
+        h = std::min(BLOCK_SIZE, height - y0);
+    };
+
+    // block summed-area tables and squares of one cell
+    parallel_jobs(stale.size(), n_threads, [&](size_t job) {
+        const size_t block = stale[job].first;
+        size_t x0, y0, w, h;
+        extent(block, x0, y0, w, h);
+        cells_info_t cells;
+        map.read_region(x0, y0, w, h, cells);
+        sums_t* sat = &local[block * SIDE * SIDE];
+        for (size_t j = 0; j < BLOCK_SIZE; j++)
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+            sums_t cell = { 0, 0 };
+            if (j < h && i < w) {
+                const cell_info_t& info = cells[j * w + i];
+                const size_t index = (y0 + j) * width + x0 + i;
+                const bool observed = info[N_POINTS] > 0;
+                if (observed)
+                    cell = { 1, info[Z_MEAN] };
+                lows[0][index]  = observed ? info[Z_MIN] :  INFINITY;
+                highs[0][index] = observed ? info[Z_MAX] : -INFINITY;
+            }
+            const sums_t& up = sat[j * SIDE + i + 1];
+            const sums_t& left = sat[(j + 1) * SIDE + i];
+            const sums_t& diag = sat[j * SIDE + i];
+            sat[(j + 1) * SIDE + i + 1] = {
+                cell.count + up.count + left.count - diag.count,
+                cell.sum   + up.sum   + left.sum   - diag.sum };
+        }
+    });
+
+    // running sums along the block rows and columns, and over the blocks
+    auto add = [](const sums_t& a, const sums_t& b) -> sums_t {
+        return { a.count + b.count, a.sum + b.sum };
+    };
+    for (size_t by = 0; by < bh; by++) {
+        if ( ! stale_rows[by] )
+            continue;
+        for (size_t r = 0; r < SIDE; r++) {
+            sums_t* run = &row_sums[(by * SIDE + r) * (bw + 1)];
+            for (size_t bx = 0; bx < bw; bx++)
+                run[bx + 1] = add(run[bx], local[(by * bw + bx) * SIDE * SIDE
+                                                 + r * SIDE + BLOCK_SIZE]);
+        }
+    }
+    for (size_t bx = 0; bx < bw; bx++) {
+        if ( ! stale_cols[bx] )
+            continue;
+        for (size_t c = 0; c < SIDE; c++) {
+            sums_t* run = &col_sums[(bx * SIDE + c) * (bh + 1)];
+            for (size_t by = 0; by < bh; by++)
+                run[by + 1] = add(run[by], local[(by * bw + bx) * SIDE * SIDE
+                                                 + BLOCK_SIZE * SIDE + c]);
+        }
+    }
+    for (size_t by = 0; by < bh; by++)
+    for (size_t bx = 0; bx < bw; bx++) {
+        const sums_t& total = local[(by * bw + bx + 1) * SIDE * SIDE - 1];
+        const sums_t& up = block_sums[by * (bw + 1) + bx + 1];
+        const sums_t& left = block_sums[(by + 1) * (bw + 1) + bx];
+        const sums_t& diag = block_sums[by * (bw + 1) + bx];
+        block_sums[(by + 1) * (bw + 1) + bx + 1] = {
+            total.count + up.count + left.count - diag.count,
+            total.sum   + up.sum   + left.sum   - diag.sum };
+    }
+
+    // squares of 2^k cells from the four squares of 2^(k-1), level by
+    // level as they reach into the neighbour blocks
+    for (size_t level = 1; level < LEVELS; level++) {
+        const size_t half = size_t(1) << (level - 1);
+        const std::vector<float>& low = lows[level - 1];
+        const std::vector<float>& high = highs[level - 1];
+        parallel_jobs(stale.size(), n_threads, [&](size_t job) {
+            size_t x0, y0, w, h;
+            extent(stale[job].first, x0, y0, w, h);
+            for (size_t y = y0; y < y0 + h; y++)
+            for (size_t x = x0; x < x0 + w; x++) {
+                const size_t index = y * width + x;
+                float lo = low[index], hi = high[index];
+                const bool right = x + half < width, down = y + half < height;
+                if (right) {
+                    lo = std::min(lo, low[index + half]);
+                    hi = std::max(hi, high[index + half]);
+                }
+                if (down) {
+                    lo = std::min(lo, low[index + half * width]);
+                    hi = std::max(hi, high[index + half * width]);
+                }
+                if (right && down) {
+                    lo = std::min(lo, low[index + half * width + half]);
+                    hi = std::max(hi, high[index + half * width + half]);
+                }
+                lows[level][index] = lo;
+                highs[level][index] = hi;
+            }
+        });
+    }
+
+    for (const auto& it : stale)
+        stamps[it.first] = it.second;
+}
+
+/**
+ * sums over [0, x) x [0, y): blocks above left, the first rows of the
+ * blocks left in the block row, the first columns of the blocks above in
+ * the block column, and the corner within the block
+ */
+region_index::sums_t region_index::prefix(size_t x, size_t y) const {
+    if (x == 0 || y == 0)
+        return { 0, 0 };
+    const size_t bx = (x - 1) / BLOCK_SIZE, c = x - bx * BLOCK_SIZE;
+    const size_t by = (y - 1) / BLOCK_SIZE, r = y - by * BLOCK_SIZE;
+    const sums_t& blocks = block_sums[by * (bw + 1) + bx];
+    const sums_t& rows = row_sums[(by * SIDE + r) * (bw + 1) + bx];
+    const sums_t& cols = col_sums[(bx * SIDE + c) * (bh + 1) + by];
+    const sums_t& corner = local[(by * bw + bx) * SIDE * SIDE + r * SIDE + c];
+    return { blocks.count + rows.count + cols.count + corner.count,
+             blocks.sum   + rows.sum   + cols.sum   + corner.sum };
+}
+
+region_stats_t region_index::stats(size_t x, size_t y, size_t w,
+                                   size_t h) const {
+    if ( x + w > width || y + h > height )
+        throw std::out_of_range("region_index::stats");
+    region_stats_t result = { w * h, 0, NAN, NAN, NAN };
+    if (w == 0 || h == 0)
+        return result;
+    const sums_t& a = prefix(x, y), & b = prefix(x + w, y),
+                & c = prefix(x, y + h), & d = prefix(x + w, y + h);
+    const double count = d.count - b.count - c.count + a.count;
+    result.observed = std::lround(count);
+    if (result.observed == 0)
+        return result;
+    result.z_mean = (d.sum - b.sum - c.sum + a.sum) / count;
+
+    // largest square fitting in, overlapping at the far edges
+    size_t level = 0, side = 1;
+    while (level + 1 < LEVELS && 2 * side <= std::min(w, h)) {
+        side *= 2;
+        level++;
+    }
+    const std::vector<float>& low = lows[level];
+    const std::vector<float>& high = highs[level];
+    float lo = INFINITY, hi = -INFINITY;
+    for (size_t j = 0; j < h; j += side) {
+        const size_t row = (y + std::min(j, h - side)) * width;
+        for (size_t i = 0; i < w; i += side) {
+            const size_t index = row + x + std::min(i, w - side);
+            lo = std::min(lo, low[index]);
+            hi = std::max(hi, high[index]);
+        }
+    }
+    result.z_min = lo;
+    result.z_max = hi;
+    return result;
+}
+
+void region_index::combine(region_stats_t& total,
+                           const region_stats_t& part) {
+    if (part.observed > 0) {
+        const double n = total.observed + part.observed;
+        total.z_mean = (total.observed > 0 ? total.z_mean * total.observed
+                                             / n : 0)
+                     + part.z_mean * part.observed / n;
+        total.z_min = std::fmin(total.z_min, part.z_min);
+        total.z_max = std::fmax(total.z_max, part.z_max);
+    }
+    total.cells += part.cells;
+    total.observed += part.observed;
+}
+
+void atlaas::update_region_stats(size_t n_threads) {
+    if (!stats_index)
+        throw std::runtime_error("atlaas: region stats are disabled");
+    stats_index->update(*this, n_threads);
+}
+
+region_stats_t atlaas::region_stats(size_t x, size_t y, size_t w,
+                                    size_t h) const {
+    if (!stats_index)
+        throw std::runtime_error("atlaas: region stats are disabled");
+    return stats_index->stats(x, y, w, h);
+}
+
+/**
+ * The rows under the footprint are split in strips, each covered by the
+ * cells of its rows between the extreme abscissae of the footprint within
+ * the strip (vertices in it, and edges crossing its bounds).
+ */
+region_stats_t atlaas::footprint_stats(double x, double y, double yaw,
+                                       double length, double breadth,
+                                       size_t strips) const {
+    if (!stats_index)
+        throw std::runtime_error("atlaas: region stats are disabled");
+    const double ca = std::cos(yaw), sa = std::sin(yaw);
+    const double lx = ca * length / 2,  ly = sa * length / 2;
+    const double bx = -sa * breadth / 2, by = ca * breadth / 2;
+    // corners in order around the footprint, in pixels
+    const std::array<point_xy_t, 4> corners = {{
+        map.point_custom2pix(x + lx + bx, y + ly + by),
+        map.point_custom2pix(x - lx + bx, y - ly + by),
+        map.point_custom2pix(x - lx - bx, y - ly - by),
+        map.point_custom2pix(x + lx - bx, y + ly - by) }};
+    double top = INFINITY, bottom = -INFINITY;
+    for (const auto& corner : corners) {
+        top = std::min(top, corner[1]);
+        bottom = std::max(bottom, corner[1]);
+    }
+    region_stats_t total = { 0, 0, NAN, NAN, NAN };
+    const long r0 = std::max(0L, long(std::floor(top)));
+    const long r1 = std::min(long(height), long(std::floor(bottom)) + 1);
+    if (r0 >= r1)
+        return total; // out of the window
+    const long n = std::max(1L, std::min(long(strips), r1 - r0));
+    for (long strip = 0; strip < n; strip++) {
+        const long ra = r0 + (r1 - r0) * strip / n,
+                   rb = r0 + (r1 - r0) * (strip + 1) / n;
+        double left = INFINITY, right = -INFINITY;
+        for (size_t k = 0; k < corners.size(); k++) {
+            const point_xy_t& p = corners[k];
+            const point_xy_t& q = corners[(k + 1) % corners.size()];
+            if (p[1] >= ra && p[1] <= rb) {
+                left = std::min(left, p[0]);
+                right = std::max(right, p[0]);
+            }
+            for (double line : { double(ra), double(rb) }) {
+                if ( (p[1] - line) * (q[1] - line) > 0 || p[1] == q[1] )
+                    continue;
+                double cross = p[0] + (line - p[1]) * (q[0] - p[0])
+                                                    / (q[1] - p[1]);
+                left = std::min(left, cross);
+                right = std::max(right, cross);
+            }
+        }
+        const long c0 = std::max(0L, long(std::floor(left)));
+        const long c1 = std::min(long(width), long(std::floor(right)) + 1);
+        if (left > right || c0 >= c1)
+            continue;
+        region_index::combine(total, stats_index->stats(c0, ra, c1 - c0,
+                                                        rb - ra));
+    }
+    return total;
+}
+
+} // namespace atlaas
@@ -0,0 +1,186 @@
+/*
+ * sensors.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <algorithm>        // fill, copy, min, max
+#include <limits>           // numeric_limits
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+size_t atlaas::add_sensor(float variance_factor, float noise,
+                          size_t merge_every) {
+    std::unique_ptr<sensor_context> ctx(new sensor_context);
+    ctx->variance_factor = variance_factor;
+    ctx->noise = noise;
+    ctx->merge_every = std::max<size_t>(1, merge_every);
+    for (auto batch : { &ctx->filling, &ctx->ready }) {
+        batch->cells.assign(width, height, blocked_storage);
+        batch->current = current;
+        batch->pose = {{0, 0}};
+        batch->scans = 0;
+    }
+    sensors.push_back( std::move(ctx) );
+    return sensors.size() - 1;
+}
+
+void atlaas::_publish_frame() {
+    std::lock_guard<std::mutex> lock(sensor_frame_mutex);
+    sensor_frame.origin  = map.point_custom2pix(0, 0);
+    sensor_frame.scale_x = map.get_scale_x();
+    sensor_frame.scale_y = map.get_scale_y();
+    sensor_frame.current = current;
+}
+
+void atlaas::_shift_cells(cell_grid& cells, const map_id_t& from,
+                          const map_id_t& to) const {
+    cells.shift(long(to[0] - from[0]) * long(sw),
+                long(to[1] - from[1]) * long(sh));
+}
+
+/**
+ * Accumulate a cloud in the sensor buffer
+ *
+ * Only reads the published window transform, so that the sensor thread
+ * runs concurrently with the mapping thread. If the window slid since the
+ * batch started, the batch is moved to the new window first.
+ */
+void atlaas::accumulate(size_t sensor, points& cloud,
+                        const matrix& transformation) {
+    sensor_context& ctx = *sensors.at(sensor);
+    sensor_context::batch_t& batch = ctx.filling;
+    // transform the cloud from sensor to custom frame
+    transform(cloud, transformation);
+    sensor_frame_t frame;
+    {
+        std::lock_guard<std::mutex> lock(sensor_frame_mutex);
+        frame = sensor_frame;
+    }
+    if (batch.current != frame.current) {
+        if (batch.scans > 0)
+            _shift_cells(batch.cells, batch.current, frame.current);
+        batch.current = frame.current;
+    }
+    switch (aggregate) {
+    case AGGREGATE_MEAN:
+        _accumulate<mean_aggregate>(batch.cells, cloud, frame,
+                                    transformation);
+        break;
+    case AGGREGATE_MIN:
+        _accumulate<min_aggregate>(batch.cells, cloud, frame, transformation);
+        break;
+    case AGGREGATE_MAX:
+        _accumulate<max_aggregate>(batch.cells, cloud, frame, transformation);
+        break;
+    case AGGREGATE_LAST:
+        _accumulate<last_aggregate>(batch.cells, cloud, frame,
+                                    transformation);
+        break;
+    case AGGREGATE_WEIGHTED:
+        _accumulate<weighted_aggregate>(batch.cells, cloud, frame,
+                                        transformation);
+        break;
+    case AGGREGATE_MOMENTS:
+        _accumulate<moments_aggregate>(batch.cells, cloud, frame,
+                                       transformation);
+        break;
+    }
+    batch.pose = {{ transformation[3], transformation[7] }};
+    batch.scans++;
+    // hand the batch over, unless the mapping thread is merging the last
+    if ( batch.scans >= ctx.merge_every && ctx.mutex.try_lock() ) {
+        if (ctx.ready.scans == 0)
+            std::swap(ctx.filling, ctx.ready);
+        ctx.mutex.unlock();
+    }
+}
+
+template <class Aggregate>
+void atlaas::_accumulate(cell_grid& cells, const points& cloud,
+                         const sensor_frame_t& frame, const matrix& sensor) {
+    const double sx = 1.0 / frame.scale_x, sy = 1.0 / frame.scale_y;
+    const double fw = width, fh = height;
+    float weight = 1;
+    for (const auto& point : cloud) {
+        double x = frame.origin[0] + point[0] * sx;
+        double y = frame.origin[1] + point[1] * sy;
+        if ( x < 0 || x >= fw || y < 0 || y >= fh )
+            continue; // point is outside the map
+        if (Aggregate::weighted) {
+            float dx = point[0] - sensor[3],
+                  dy = point[1] - sensor[7],
+                  dz = point[2] - sensor[11];
+            weight = weighted_aggregate::weight(dx * dx + dy * dy + dz * dz);
+        }
+        add_point<Aggregate>(cells, size_t(x) + size_t(y) * width, point[2],
+                             weight);
+    }
+}
+
+/**
+ * Finalize the cells of a scan buffer and combine them in internal (no
+ * vertical/flat state)
+ */
+void atlaas::_combine_cells(cell_grid& inter) {
+    variance_mean(inter); // finalize
+    block_guard guard(locks);
+    size_t index = 0;
+    for (size_t y = 0; y < height; y++) {
+        if ( ! inter.allocated(y) ) {
+            index += width; // no point there
+            continue;
+        }
+        const cell_info_t* src = inter.row(y);
+        cell_info_t* dst = internal.row_write(y);
+        for (size_t x = 0; x < width; x++, src++, dst++, index++) {
+            if ((*src)[N_POINTS] < 1)
+                continue;
+            _enter(guard, index);
+            if (front && (*dst)[N_POINTS] < 1)
+                front->observed(index);
+            merge(*dst, *src);
+            (*dst)[LAST_UPDATE] = get_reference_time();
+        }
+    }
+    map_sync = false;
+}
+
+/**
+ * Merge the batches handed over by the sensors in internal
+ *
+ * For each batch, slide around the latest pose of the sensor, then merge
+ * with the merge policy: vertical/flat state with the sensor parameters
+ * for DYNAMIC_MERGE, plain cell combine for STATIC_MERGE.
+ */
+size_t atlaas::merge_sensors() {
+    size_t merged = 0;
+    cell_info_t zeros{}; // value-initialization w/empty initializer
+    for (auto& ctx : sensors) {
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        sensor_context::batch_t& batch = ctx->ready;
+        if (batch.scans == 0)
+            continue; // nothing handed over
+        slide_to(batch.pose[0], batch.pose[1]);
+        if (batch.current != current) {
+            _shift_cells(batch.cells, batch.current, current);
+            batch.current = current;
+        }
+        if (policy == DYNAMIC_MERGE) {
+            _merge_cells(batch.cells, ctx->variance_factor, ctx->noise);
+        } else {
+            _combine_cells(batch.cells);
+        }
+        batch.cells.fill(zeros);
+        batch.scans = 0;
+        merged++;
+    }
+    return merged;
+}
+
+} // namespace atlaas
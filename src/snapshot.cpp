@@ -0,0 +1,165 @@
+/*
+ * snapshot.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <algorithm>        // copy, min, find
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+snapshot::snapshot(const cell_grid& cells, const block_locks& locks,
+                   size_t width, size_t height,
+                   const std::vector<char>& wanted) :
+        cells(cells), locks(locks), width(width), height(height),
+        bw( (width + BLOCK_SIZE - 1) / BLOCK_SIZE ),
+        blocks( wanted.size() ),
+        pending( new std::atomic<bool>[ wanted.size() ] ) {
+    for (size_t block = 0; block < wanted.size(); block++)
+        pending[block] = wanted[block];
+}
+
+/**
+ * Copy a block from the live cells, once
+ *
+ * As a seqlock reader, regional writers may be writing it, unless the
+ * caller holds the lock of the block (locked). The copy is made outside
+ * of the mutex, a writer copying the block it locked must not wait for a
+ * reader waiting for it; the first copy made is kept.
+ */
+void snapshot::copy(size_t block, bool locked) {
+    size_t x0 = (block % bw) * BLOCK_SIZE;
+    size_t y0 = (block / bw) * BLOCK_SIZE;
+    size_t w  = std::min(BLOCK_SIZE, width  - x0);
+    size_t h  = std::min(BLOCK_SIZE, height - y0);
+    cells_info_t dst(BLOCK_SIZE * BLOCK_SIZE);
+    auto copy_rows = [&]() {
+        for (size_t y = 0; y < h; y++) {
+            const cell_info_t* it = cells.row(y0 + y) + x0;
+            std::copy(it, it + w, dst.begin() + y * BLOCK_SIZE);
+        }
+    };
+    if (locked) {
+        copy_rows();
+    } else {
+        unsigned version;
+        do {
+            version = locks.read_begin(block);
+            copy_rows();
+        } while ( ! locks.read_end(block, version) );
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if ( ! pending[block] )
+        return; // copied meanwhile
+    blocks[block].swap(dst);
+    pending[block] = false;
+}
+
+void snapshot::read(size_t x, size_t y, size_t n, cell_info_t* out) {
+    size_t end = x + n;
+    while (x < end) {
+        size_t block = (y / BLOCK_SIZE) * bw + x / BLOCK_SIZE;
+        size_t len = std::min(end, (x / BLOCK_SIZE + 1) * BLOCK_SIZE) - x;
+        touch(block);
+        auto it = blocks[block].begin()
+                + (y % BLOCK_SIZE) * BLOCK_SIZE + x % BLOCK_SIZE;
+        out = std::copy(it, it + len, out);
+        x += len;
+    }
+}
+
+/**
+ * Snapshot the given submodels and save them in background
+ *
+ * Waits for the previous save to complete, the caller only pays for the
+ * snapshot itself. Blocks are copied when internal is modified (`touch`)
+ * or when the writer reads them, whichever comes first.
+ *
+ * @param subs: submodels relative to the current one
+ */
+void atlaas::save_async(const std::vector<map_id_t>& subs) const {
+    wait_saves();
+
+    struct job_t {
+        map_id_t id;
+        size_t x0, y0; // in internal
+        point_xy_t utm;
+    };
+    std::vector<job_t> jobs;
+    std::vector<char> wanted(bw * bh, false);
+    writing.clear();
+    for (const auto& sid : subs) {
+        job_t job;
+        job.id = {{ current[0] + sid[0], current[1] + sid[1] }};
+        job.x0 = sw * size_t(sid[0] + 1);
+        job.y0 = sh * size_t(sid[1] + 1);
+        job.utm = map.point_pix2utm( double(sid[0]) * sw,
+                                     double(sid[1]) * sh );
+        for (size_t by = job.y0 / BLOCK_SIZE;
+                    by <= (job.y0 + sh - 1) / BLOCK_SIZE; by++)
+        for (size_t bx = job.x0 / BLOCK_SIZE;
+                    bx <= (job.x0 + sw - 1) / BLOCK_SIZE; bx++)
+            wanted[by * bw + bx] = true;
+        writing.push_back(job.id);
+        jobs.push_back(job);
+    }
+
+    std::shared_ptr<snapshot> snap_ptr(
+        new snapshot(internal, locks, width, height, wanted) );
+    std::atomic_store(&saving, snap_ptr);
+    snapshot* snap = snap_ptr.get();
+    std::shared_ptr<gdalwrap::gdal> meta(new gdalwrap::gdal);
+    meta->copy_meta(map, sw, sh);
+    double scale_x = map.get_scale_x(), scale_y = map.get_scale_y();
+    size_t w = sw, h = sh;
+
+    writer = std::thread([=]() {
+        try {
+            atlaas tile;
+            tile.map = *meta;
+            tile.internal.assign(w, h);
+            for (const auto& job : jobs) {
+                for (size_t y = 0; y < h; y++)
+                    snap->read(job.x0, job.y0 + y, w,
+                               tile.internal.row_write(y));
+                tile.update();
+                // update map transform used for merging the pointcloud
+                tile.map.set_transform(job.utm[0], job.utm[1],
+                                       scale_x, scale_y);
+                sub_write(job.id, tile.map);
+            }
+        } catch (...) {
+            writer_error = std::current_exception();
+        }
+    });
+}
+
+void atlaas::wait_saves() const {
+    if ( writer.joinable() )
+        writer.join();
+    std::atomic_store(&saving, std::shared_ptr<snapshot>());
+    writing.clear();
+    if (writer_error) {
+        std::exception_ptr error = writer_error;
+        writer_error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * Copy-on-write of the blocks covering a region of internal
+ */
+void atlaas::touch(size_t x, size_t y, size_t w, size_t h) {
+    if ( ! saving || w == 0 || h == 0 )
+        return;
+    for (size_t by = y / BLOCK_SIZE; by <= (y + h - 1) / BLOCK_SIZE; by++)
+    for (size_t bx = x / BLOCK_SIZE; bx <= (x + w - 1) / BLOCK_SIZE; bx++)
+        saving->touch(by * bw + bx);
+}
+
+} // namespace atlaas
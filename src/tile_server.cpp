@@ -0,0 +1,473 @@
+/*
+ * tile_server.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cstdio>           // sscanf
+#include <cstring>          // memset, strncpy
+#include <cerrno>
+#include <stdexcept>        // length_error, runtime_error
+#include <algorithm>        // fill, min, max
+
+#include <fcntl.h>          // fcntl, O_NONBLOCK
+#include <dirent.h>         // opendir
+#include <poll.h>
+#include <unistd.h>         // read, write, close, unlink
+#include <sys/socket.h>
+#include <sys/un.h>         // sockaddr_un
+
+#include "atlaas/tile_server.hpp"
+
+namespace atlaas {
+
+static void throw_errno(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+/**
+ * Read or write exactly n bytes, false on end of stream or error
+ */
+static bool read_all(int fd, void* buf, size_t n) {
+    char* ptr = static_cast<char*>(buf);
+    while (n > 0) {
+        ssize_t len = ::read(fd, ptr, n);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return false;
+        ptr += len;
+        n   -= len;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void* buf, size_t n) {
+    const char* ptr = static_cast<const char*>(buf);
+    while (n > 0) {
+        ssize_t len = ::write(fd, ptr, n);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return false;
+        ptr += len;
+        n   -= len;
+    }
+    return true;
+}
+
+static sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ( path.size() >= sizeof(addr.sun_path) )
+        throw std::runtime_error("socket path too long: " + path);
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+/*
+ * tile_cache
+ */
+
+tile_cache::tile_cache(const std::string& path, size_t capacity) :
+        directory(path), capacity(capacity), sw(0), sh(0), generation(0) {
+    struct stat info;
+    if ( stat( path.c_str(), &info ) == 0 && S_ISREG(info.st_mode) )
+        store.reset( new tile_store(path, true) );
+    scan();
+}
+
+/**
+ * File modification stamp (ns), 0 if no file
+ */
+static int64_t file_stamp(const std::string& filepath) {
+    struct stat info;
+    if ( stat( filepath.c_str(), &info ) != 0 )
+        return 0;
+    return int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+int64_t tile_cache::stamp(const map_id_t& id) const {
+    if (store)
+        return store->sequence(id);
+    return file_stamp( path(id) );
+}
+
+/**
+ * Bump the generation of a submodel if its file (or record) changed
+ */
+void tile_cache::refresh(const map_id_t& id, int64_t stamp) {
+    auto it = entries.find(id);
+    if ( it == entries.end() ) {
+        if ( stamp == 0 )
+            return; // never seen, no file
+        entry_t entry;
+        entry.stamp = stamp;
+        entry.generation = ++generation;
+        entry.cached = false;
+        entries[id] = entry;
+        return;
+    }
+    entry_t& entry = it->second;
+    if ( entry.stamp == stamp )
+        return;
+    entry.stamp = stamp;
+    entry.generation = ++generation;
+    if ( entry.cached ) {
+        lru.erase( entry.lru );
+        entry.bands.clear();
+        entry.cached = false;
+    }
+}
+
+void tile_cache::scan() {
+    std::map<map_id_t, int64_t> found;
+    if (store) {
+        store->update();
+        for (const auto& id : store->list())
+            found[id] = store->sequence(id);
+    } else {
+        scan_directory(found);
+    }
+    for (const auto& entry : found)
+        refresh(entry.first, entry.second);
+    // removed submodels
+    for (auto& entry : entries)
+        if ( ! found.count(entry.first) )
+            refresh(entry.first, 0);
+}
+
+void tile_cache::scan_directory(std::map<map_id_t, int64_t>& found) const {
+    DIR* dir = opendir( directory.c_str() );
+    if (dir == NULL)
+        throw_errno("opendir " + directory);
+    while (dirent* ent = readdir(dir)) {
+        map_id_t id;
+        if ( std::sscanf(ent->d_name, "atlaas.%dx%d.tif", &id[0], &id[1]) != 2
+             || sub_name(id) != ent->d_name )
+            continue; // not a submodel (or a temporary file)
+        found[id] = file_stamp( path(id) );
+    }
+    closedir(dir);
+}
+
+void tile_cache::evict() {
+    while ( lru.size() > capacity ) {
+        entry_t& entry = entries[ lru.back() ];
+        entry.bands.clear();
+        entry.cached = false;
+        lru.pop_back();
+    }
+}
+
+const gdalwrap::rasters* tile_cache::get(const map_id_t& id) {
+    // only stat the file (or look the record up), cheaper than a scan
+    refresh(id, stamp(id));
+    auto it = entries.find(id);
+    if ( it == entries.end() || it->second.stamp == 0 )
+        return NULL;
+    entry_t& entry = it->second;
+    if ( entry.cached ) {
+        // most recently used
+        lru.splice(lru.begin(), lru, entry.lru);
+        return &entry.bands;
+    }
+    gdalwrap::gdal tile;
+    if (store) {
+        if ( ! store->read(id, tile) )
+            return NULL; // removed meanwhile
+    } else {
+        tile.load( path(id) );
+    }
+    if ( sw == 0 ) {
+        sw = tile.get_width();
+        sh = tile.get_height();
+    }
+    entry.bands = std::move(tile.bands);
+    entry.cached = true;
+    lru.push_front(id);
+    entry.lru = lru.begin();
+    evict();
+    return entries[id].cached ? &entries[id].bands : NULL;
+}
+
+void tile_cache::region(int x, int y, size_t width, size_t height,
+                        std::vector<float>& data) {
+    // before the product can wrap
+    if ( width > TILE_MAX_CELLS || height > TILE_MAX_CELLS ||
+         width * height > TILE_MAX_CELLS )
+        throw std::length_error("tile_cache::region: too many cells");
+    data.assign(N_RASTER * width * height, 0);
+    if (store)
+        store->update(); // the records committed since
+    if ( sw == 0 ) {
+        // submodels size from any submodel
+        scan();
+        for (const auto& entry : entries)
+            if ( get(entry.first) )
+                break;
+        if ( sw == 0 )
+            return; // empty directory
+    }
+    auto floor_div = [](long a, long b) -> long {
+        return (a >= 0) ? a / b : - ((- a + b - 1) / b);
+    };
+    long x1 = x + long(width), y1 = y + long(height);
+    for (long ty = floor_div(y, sh); ty * long(sh) < y1; ty++)
+    for (long tx = floor_div(x, sw); tx * long(sw) < x1; tx++) {
+        const gdalwrap::rasters* bands = get({{ int(tx), int(ty) }});
+        if ( bands == NULL )
+            continue;
+        // intersection in global cells
+        long gx0 = std::max<long>(x, tx * sw),
+             gx1 = std::min<long>(x1, (tx + 1) * sw);
+        long gy0 = std::max<long>(y, ty * sh),
+             gy1 = std::min<long>(y1, (ty + 1) * sh);
+        for (size_t band = 0; band < N_RASTER; band++) {
+            const auto& src = (*bands)[band];
+            float* dst = &data[band * width * height];
+            for (long gy = gy0; gy < gy1; gy++) {
+                auto it = src.begin() + (gy - ty * sh) * sw + (gx0 - tx * sw);
+                std::copy(it, it + (gx1 - gx0),
+                          dst + (gy - y) * width + (gx0 - x));
+            }
+        }
+    }
+}
+
+std::vector<tile_change_t> tile_cache::delta(uint64_t since) const {
+    std::vector<tile_change_t> changes;
+    for (const auto& entry : entries)
+        if ( entry.second.generation > since ) {
+            tile_change_t change = { entry.first[0], entry.first[1],
+                                     entry.second.generation };
+            changes.push_back(change);
+        }
+    return changes;
+}
+
+/*
+ * tile_server
+ */
+
+tile_server::tile_server(const std::string& socket_path,
+                         const std::string& path, size_t cache_size) :
+        cache(path, cache_size), socket_path(socket_path) {
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw_errno("socket");
+    sockaddr_un addr = socket_address(socket_path);
+    unlink( socket_path.c_str() ); // stale socket
+    if ( bind(listen_fd, (sockaddr*) &addr, sizeof(addr)) < 0 ||
+         listen(listen_fd, 16) < 0 ) {
+        close(listen_fd);
+        throw_errno("bind " + socket_path);
+    }
+}
+
+tile_server::~tile_server() {
+    close(listen_fd);
+    unlink( socket_path.c_str() );
+}
+
+/**
+ * Answer a request into the output buffer, false to close the connection
+ * once answered
+ */
+bool tile_server::handle(const tile_request_t& req,
+                         std::vector<char>& output) {
+    auto append = [&output](const void* buf, size_t n) {
+        const char* ptr = static_cast<const char*>(buf);
+        output.insert(output.end(), ptr, ptr + n);
+    };
+    tile_response_t res;
+    std::memset(&res, 0, sizeof(res));
+    res.magic = TILE_MAGIC;
+    res.status = TILE_ERROR;
+    if ( req.magic != TILE_MAGIC ) {
+        append(&res, sizeof(res));
+        return false;
+    }
+    try {
+        if ( req.type == TILE_REGION ) {
+            std::vector<float> data;
+            cache.region(req.x, req.y, req.width, req.height, data);
+            res.status = TILE_OK;
+            res.width = req.width;
+            res.height = req.height;
+            res.n_bands = N_RASTER;
+            res.generation = cache.get_generation();
+            output.reserve(sizeof(res) + data.size() * sizeof(float));
+            append(&res, sizeof(res));
+            append(data.data(), data.size() * sizeof(float));
+            return true;
+        } else if ( req.type == TILE_DELTA ) {
+            cache.scan();
+            const auto& changes = cache.delta(req.since);
+            res.status = TILE_OK;
+            res.count = changes.size();
+            res.generation = cache.get_generation();
+            append(&res, sizeof(res));
+            append(changes.data(), changes.size() * sizeof(tile_change_t));
+            return true;
+        }
+    } catch (const std::exception&) {
+        // answer with an error, keep serving
+    }
+    append(&res, sizeof(res));
+    return true;
+}
+
+/**
+ * Answer the next complete request, one response buffered at a time
+ */
+void tile_server::serve(client_t& client) {
+    if ( ! client.output.empty() || client.closing ||
+         client.input.size() < sizeof(tile_request_t) )
+        return;
+    tile_request_t req;
+    std::memcpy(&req, client.input.data(), sizeof(req));
+    client.input.erase(client.input.begin(),
+                       client.input.begin() + sizeof(req));
+    client.sent = 0;
+    client.closing = ! handle(req, client.output);
+}
+
+/**
+ * Read what is available, false when the client is gone
+ */
+bool tile_server::receive(int fd, client_t& client) {
+    char buf[4096];
+    ssize_t len = ::read(fd, buf, sizeof(buf));
+    if (len == 0)
+        return false;
+    if (len < 0)
+        return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+    client.input.insert(client.input.end(), buf, buf + len);
+    serve(client);
+    return client.output.empty() || flush(fd, client);
+}
+
+/**
+ * Send what the socket takes, false when the client is gone (or done)
+ */
+bool tile_server::flush(int fd, client_t& client) {
+    ssize_t len = send(fd, client.output.data() + client.sent,
+                       client.output.size() - client.sent, MSG_NOSIGNAL);
+    if (len < 0)
+        return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+    client.sent += len;
+    if ( client.sent < client.output.size() )
+        return true;
+    if ( client.closing )
+        return false;
+    std::vector<char>().swap(client.output); // release large regions
+    serve(client); // next request already received
+    return client.output.empty() || flush(fd, client);
+}
+
+void tile_server::run(const volatile bool& stop, int timeout) {
+    std::vector<pollfd> fds;
+    while ( ! stop ) {
+        // read requests only once the previous response is sent
+        fds.resize(1);
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (const auto& client : clients) {
+            pollfd p;
+            p.fd = client.first;
+            p.events = client.second.output.empty() ? POLLIN : POLLOUT;
+            p.revents = 0;
+            fds.push_back(p);
+        }
+        if ( poll(fds.data(), fds.size(), timeout) < 0 ) {
+            if (errno == EINTR)
+                continue;
+            throw_errno("poll");
+        }
+        for (size_t idx = 1; idx < fds.size(); idx++) {
+            const int fd = fds[idx].fd;
+            const short revents = fds[idx].revents;
+            if ( ! revents )
+                continue;
+            client_t& client = clients[fd];
+            bool alive;
+            if ( revents & POLLOUT )
+                alive = flush(fd, client);
+            else if ( revents & POLLIN )
+                alive = receive(fd, client);
+            else
+                alive = false; // hang up, error
+            if ( ! alive ) {
+                close(fd);
+                clients.erase(fd);
+            }
+        }
+        if ( fds[0].revents & POLLIN ) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if ( fd >= 0 && fcntl(fd, F_SETFL, O_NONBLOCK) < 0 )
+                close(fd);
+            else if ( fd >= 0 )
+                clients[fd] = client_t();
+        }
+    }
+    for (const auto& client : clients)
+        close(client.first);
+    clients.clear();
+}
+
+/*
+ * tile_client
+ */
+
+tile_client::tile_client(const std::string& socket_path) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw_errno("socket");
+    sockaddr_un addr = socket_address(socket_path);
+    if ( connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0 ) {
+        close(fd);
+        throw_errno("connect " + socket_path);
+    }
+}
+
+tile_client::~tile_client() {
+    close(fd);
+}
+
+tile_response_t tile_client::request(const tile_request_t& req) {
+    tile_response_t res;
+    if ( ! write_all(fd, &req, sizeof(req)) ||
+         ! read_all(fd, &res, sizeof(res)) )
+        throw std::runtime_error("tile_client: connection lost");
+    if ( res.magic != TILE_MAGIC || res.status != TILE_OK )
+        throw std::runtime_error("tile_client: request failed");
+    return res;
+}
+
+uint64_t tile_client::region(int x, int y, size_t width, size_t height,
+                             std::vector<float>& data) {
+    tile_request_t req = { TILE_MAGIC, TILE_REGION, x, y,
+                           uint32_t(width), uint32_t(height), 0 };
+    tile_response_t res = request(req);
+    data.resize(size_t(res.n_bands) * res.width * res.height);
+    if ( ! read_all(fd, data.data(), data.size() * sizeof(float)) )
+        throw std::runtime_error("tile_client: connection lost");
+    return res.generation;
+}
+
+uint64_t tile_client::delta(uint64_t since,
+                            std::vector<tile_change_t>& changes) {
+    tile_request_t req = { TILE_MAGIC, TILE_DELTA, 0, 0, 0, 0, since };
+    tile_response_t res = request(req);
+    changes.resize(res.count);
+    if ( ! read_all(fd, changes.data(), changes.size() * sizeof(tile_change_t)) )
+        throw std::runtime_error("tile_client: connection lost");
+    return res.generation;
+}
+
+} // namespace atlaas
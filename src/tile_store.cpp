@@ -0,0 +1,625 @@
+/*
+ * tile_store.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cstdio>           // rename, remove, sscanf
+#include <cstring>          // memcpy, memcmp, strerror
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>        // sort, copy
+#include <dirent.h>         // opendir
+#include <fcntl.h>          // open
+#include <unistd.h>         // pread, pwrite, ftruncate, close
+#include <sys/mman.h>       // mmap
+#include <sys/stat.h>       // fstat
+
+#include "atlaas/tile_store.hpp"
+
+namespace atlaas {
+
+const uint32_t STORE_VERSION = 2; // 1: no sparse records
+
+static void store_error(const std::string& what, const std::string& path) {
+    throw std::runtime_error("[tile_store] " + what + " " + path + ": " +
+                             std::strerror(errno));
+}
+
+static void write_all(int fd, const void* data, size_t size, uint64_t offset,
+                      const std::string& path) {
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::pwrite(fd, ptr, size, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            store_error("write", path);
+        }
+        ptr += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+static bool read_all(int fd, void* data, size_t size, uint64_t offset) {
+    char* ptr = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::pread(fd, ptr, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * call rows(offset, count) for the rows of the present blocks of a band,
+ * in the order of a sparse payload
+ */
+template <class Rows>
+static void sparse_rows(size_t width, size_t height,
+                        const uint8_t* present, Rows rows) {
+    const size_t nbx = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const size_t nby = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for (size_t by = 0; by < nby; by++)
+    for (size_t bx = 0; bx < nbx; bx++) {
+        if ( ! present[by * nbx + bx] )
+            continue;
+        const size_t x0 = bx * BLOCK_SIZE;
+        const size_t count = std::min(BLOCK_SIZE, width - x0);
+        for (size_t y = by * BLOCK_SIZE;
+             y < std::min((by + 1) * BLOCK_SIZE, height); y++)
+            rows(y * width + x0, count);
+    }
+}
+
+/**
+ * payload bytes, padded so that records stay 8 bytes aligned
+ */
+static uint64_t padded(uint64_t size) {
+    return (size + 7) & ~uint64_t(7);
+}
+
+static int create_file(const std::string& path, int flags) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | flags, 0644);
+    if (fd < 0)
+        store_error("open", path);
+    store_header_t header = {};
+    std::memcpy(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    header.version = STORE_VERSION;
+    write_all(fd, &header, sizeof(header), 0, path);
+    return fd;
+}
+
+/**
+ * inode of an open file
+ */
+static uint64_t file_inode(int fd, const std::string& path) {
+    struct stat info;
+    if ( ::fstat(fd, &info) < 0 )
+        store_error("stat", path);
+    return info.st_ino;
+}
+
+tile_store::tile_store(const std::string& _filepath, bool _read_only) :
+        filepath(_filepath), read_only(_read_only), fd(-1), inode(0),
+        records(0), mapping(NULL), mapped(0), end(sizeof(store_header_t)),
+        garbage(0) {
+    fd = ::open(filepath.c_str(), read_only ? O_RDONLY : O_RDWR);
+    if (fd < 0) {
+        if (errno != ENOENT || read_only)
+            store_error("open", filepath);
+        fd = create_file(filepath, O_EXCL);
+        inode = file_inode(fd, filepath);
+        return;
+    }
+    inode = file_inode(fd, filepath);
+    store_header_t header;
+    if ( ! read_all(fd, &header, sizeof(header), 0) ||
+         std::memcmp(header.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0 ||
+         header.version < 1 || header.version > STORE_VERSION ) {
+        ::close(fd);
+        throw std::runtime_error("[tile_store] not a tile store " + filepath);
+    }
+    if (header.version < STORE_VERSION && ! read_only) {
+        // about to get sparse records
+        header.version = STORE_VERSION;
+        write_all(fd, &header, sizeof(header), 0, filepath);
+    }
+    scan();
+}
+
+tile_store::~tile_store() {
+    unmap();
+    if (fd >= 0)
+        ::close(fd);
+}
+
+/**
+ * apply the records of the log from `end` on (at open, then as the writer
+ * appends them if read only), the PENDING ones once committed
+ *
+ * The writer then drops the uncommitted pending records and a truncated
+ * tail (interrupted), a reader waits for them to be committed or written.
+ *
+ * @returns whether the index changed
+ */
+bool tile_store::scan() {
+    struct stat info;
+    if ( ::fstat(fd, &info) < 0 )
+        store_error("stat", filepath);
+    const uint64_t size = info.st_size;
+    bool changed = false;
+    store_record_t record;
+    while ( end + sizeof(record) <= size &&
+            read_all(fd, &record, sizeof(record), end) &&
+            record.magic == STORE_RECORD ) {
+        uint64_t bytes = sizeof(record) + padded(record.size);
+        if (end + bytes > size)
+            break;
+        map_id_t id = {{ record.x, record.y }};
+        entry_t entry = { end, bytes, 0 };
+        if (record.type == STORE_COMMIT) {
+            garbage += bytes;
+            for (const auto& it : staged)
+                replace(it.first, it.second);
+            changed = changed || ! staged.empty();
+            staged.clear();
+        } else if (record.type == STORE_REMOVE) {
+            garbage += bytes;
+            entry.bytes = 0;
+        }
+        if (record.type != STORE_COMMIT) {
+            if (record.flags & STORE_PENDING) {
+                auto it = staged.find(id);
+                if (it != staged.end())
+                    garbage += it->second.bytes;
+                staged[id] = entry;
+            } else {
+                replace(id, entry);
+                changed = true;
+            }
+        }
+        end += bytes;
+    }
+    if (read_only)
+        return changed;
+    for (const auto& it : staged)
+        garbage += it.second.bytes;
+    if (end < size && ::ftruncate(fd, end) < 0)
+        store_error("truncate", filepath);
+    // pending records never committed (interrupted), rewritten without
+    // them: the next commit record would apply them otherwise
+    if ( ! staged.empty() ) {
+        staged.clear();
+        compact_locked();
+    }
+    return changed;
+}
+
+bool tile_store::update() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if ( ! read_only )
+        return false; // we are the writer
+    struct stat info;
+    if ( ::stat(filepath.c_str(), &info) == 0 && info.st_ino != inode ) {
+        // compacted (renamed over), the new file from its start
+        int reopened = ::open(filepath.c_str(), O_RDONLY);
+        if (reopened < 0)
+            store_error("open", filepath);
+        unmap();
+        ::close(fd);
+        fd = reopened;
+        inode = file_inode(fd, filepath);
+        end = sizeof(store_header_t);
+        garbage = 0;
+        index.clear();
+        staged.clear();
+        scan();
+        return true;
+    }
+    return scan();
+}
+
+uint64_t tile_store::sequence(const map_id_t& id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(id);
+    return (it == index.end()) ? 0 : it->second.sequence;
+}
+
+void tile_store::writable() const {
+    if (read_only)
+        throw std::runtime_error("[tile_store] read only " + filepath);
+}
+
+void tile_store::append(const store_record_t& record, const void* payload,
+                        entry_t& entry) {
+    entry.offset = end;
+    entry.bytes = sizeof(record) + padded(record.size);
+    write_all(fd, &record, sizeof(record), end, filepath);
+    if (record.size > 0)
+        write_all(fd, payload, record.size, end + sizeof(record), filepath);
+    // the padding too, the last record would look truncated otherwise
+    const uint64_t zeros = 0;
+    if (padded(record.size) > record.size)
+        write_all(fd, &zeros, padded(record.size) - record.size,
+                  end + sizeof(record) + record.size, filepath);
+    end += entry.bytes;
+}
+
+/**
+ * point the index to entry (0 bytes for a removal), the previous record
+ * of the submodel becoming garbage
+ */
+void tile_store::replace(const map_id_t& id, entry_t entry) {
+    entry.sequence = ++records;
+    auto it = index.find(id);
+    if (it != index.end()) {
+        garbage += it->second.bytes;
+        if (entry.bytes == 0)
+            index.erase(it);
+        else
+            it->second = entry;
+    } else if (entry.bytes > 0) {
+        index[id] = entry;
+    }
+}
+
+void tile_store::unmap() const {
+    if (mapping != NULL)
+        ::munmap(const_cast<uint8_t*>(mapping), mapped);
+    mapping = NULL;
+    mapped = 0;
+}
+
+const uint8_t* tile_store::view(uint64_t offset, uint64_t bytes) const {
+    if (offset + bytes > mapped) {
+        unmap();
+        void* ptr = ::mmap(NULL, end, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED)
+            store_error("mmap", filepath);
+        mapping = static_cast<const uint8_t*>(ptr);
+        mapped = end;
+    }
+    return mapping + offset;
+}
+
+bool tile_store::contains(const map_id_t& id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.count(id) > 0;
+}
+
+bool tile_store::read(const map_id_t& id, gdalwrap::gdal& tile) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(id);
+    if (it == index.end())
+        return false;
+    const uint8_t* ptr = view(it->second.offset, it->second.bytes);
+    store_record_t record;
+    std::memcpy(&record, ptr, sizeof(record));
+    tile.set_size(record.n_bands, record.width, record.height);
+    tile.set_transform(record.utm_x, record.utm_y,
+                       record.scale_x, record.scale_y);
+    if (record.n_bands == MAP_NAMES.size())
+        tile.names = MAP_NAMES;
+    const size_t band_size = size_t(record.width) * record.height;
+    ptr += sizeof(record);
+    if ( ! (record.flags & STORE_SPARSE) ) {
+        for (auto& band : tile.bands) {
+            std::memcpy(band.data(), ptr, band_size * sizeof(float));
+            ptr += band_size * sizeof(float);
+        }
+        return true;
+    }
+    const size_t n_blocks = ((record.width + BLOCK_SIZE - 1) / BLOCK_SIZE) *
+                            ((record.height + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    const uint8_t* present = ptr;
+    ptr += (n_blocks + 3) & ~size_t(3);
+    for (auto& band : tile.bands) {
+        std::fill(band.begin(), band.end(), 0);
+        sparse_rows(record.width, record.height, present,
+                    [&](size_t offset, size_t count) {
+            std::memcpy(&band[offset], ptr, count * sizeof(float));
+            ptr += count * sizeof(float);
+        });
+    }
+    return true;
+}
+
+void tile_store::write(const map_id_t& id, const gdalwrap::gdal& tile,
+                       bool pending) {
+    const size_t width = tile.get_width(), height = tile.get_height();
+    const size_t band_size = width * height;
+    // blocks with a value in any band, the others are left out
+    const size_t nbx = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const size_t nby = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<uint8_t> present(nbx * nby, false);
+    for (const auto& band : tile.bands)
+        for (size_t y = 0; y < height; y++)
+            for (size_t x = 0; x < width; x++)
+                if (band[y * width + x] != 0)
+                    present[(y / BLOCK_SIZE) * nbx + x / BLOCK_SIZE] = true;
+    const bool sparse = std::find(present.begin(), present.end(), false)
+                        != present.end();
+    std::vector<float> payload;
+    if (sparse) {
+        // mask, 4 bytes aligned, then the rows of the present blocks
+        present.resize((present.size() + 3) & ~size_t(3), false);
+        payload.resize(present.size() / sizeof(float));
+        std::memcpy(payload.data(), present.data(), present.size());
+        for (const auto& band : tile.bands)
+            sparse_rows(width, height, present.data(),
+                        [&](size_t offset, size_t count) {
+                payload.insert(payload.end(), band.begin() + offset,
+                               band.begin() + offset + count);
+            });
+    } else {
+        payload.reserve(tile.bands.size() * band_size);
+        for (const auto& band : tile.bands)
+            payload.insert(payload.end(), band.begin(), band.end());
+    }
+    writable();
+    store_record_t record = {};
+    record.magic = STORE_RECORD;
+    record.type = STORE_TILE;
+    record.flags = (pending ? STORE_PENDING : 0) |
+                   (sparse ? STORE_SPARSE : 0);
+    record.x = id[0];
+    record.y = id[1];
+    record.width = tile.get_width();
+    record.height = tile.get_height();
+    record.n_bands = tile.bands.size();
+    record.utm_x = tile.get_utm_pose_x();
+    record.utm_y = tile.get_utm_pose_y();
+    record.scale_x = tile.get_scale_x();
+    record.scale_y = tile.get_scale_y();
+    record.size = payload.size() * sizeof(float);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entry_t entry;
+    append(record, payload.data(), entry);
+    stage(id, entry, pending);
+}
+
+void tile_store::remove(const map_id_t& id, bool pending) {
+    writable();
+    std::lock_guard<std::mutex> lock(mutex);
+    if ( ! pending && index.count(id) == 0 )
+        return;
+    store_record_t record = {};
+    record.magic = STORE_RECORD;
+    record.type = STORE_REMOVE;
+    record.flags = pending ? STORE_PENDING : 0;
+    record.x = id[0];
+    record.y = id[1];
+    entry_t entry;
+    append(record, NULL, entry);
+    garbage += entry.bytes;
+    entry.bytes = 0;
+    stage(id, entry, pending);
+}
+
+void tile_store::stage(const map_id_t& id, const entry_t& entry,
+                       bool pending) {
+    if ( ! pending ) {
+        replace(id, entry);
+        compact_if_stale();
+        return;
+    }
+    auto it = staged.find(id);
+    if (it != staged.end())
+        garbage += it->second.bytes;
+    staged[id] = entry;
+}
+
+void tile_store::commit() {
+    writable();
+    std::lock_guard<std::mutex> lock(mutex);
+    if ( staged.empty() )
+        return;
+    // the pending records reach the disk before the commit record
+    if ( ::fdatasync(fd) < 0 )
+        store_error("sync", filepath);
+    store_record_t record = {};
+    record.magic = STORE_RECORD;
+    record.type = STORE_COMMIT;
+    entry_t entry;
+    append(record, NULL, entry);
+    if ( ::fdatasync(fd) < 0 )
+        store_error("sync", filepath);
+    garbage += entry.bytes;
+    for (const auto& it : staged)
+        replace(it.first, it.second);
+    staged.clear();
+    compact_if_stale();
+}
+
+void tile_store::discard() {
+    writable();
+    std::lock_guard<std::mutex> lock(mutex);
+    if ( staged.empty() )
+        return;
+    staged.clear();
+    // rewritten without them, the next commit would apply them otherwise
+    compact_locked();
+}
+
+void tile_store::compact_if_stale() {
+    if ( staged.empty() && garbage > end / 2 )
+        compact_locked();
+}
+
+void tile_store::compact() {
+    writable();
+    std::lock_guard<std::mutex> lock(mutex);
+    if ( ! staged.empty() )
+        throw std::runtime_error("[tile_store] compact with pending writes");
+    compact_locked();
+}
+
+/**
+ * copy the live records to a new file, then rename it over, so that an
+ * interruption leaves either the old or the new file
+ */
+void tile_store::compact_locked() {
+    const std::string tmppath = filepath + ".compact";
+    int out = create_file(tmppath, O_TRUNC);
+    uint64_t offset = sizeof(store_header_t);
+    std::map<map_id_t, entry_t> compacted;
+    try {
+        for (const auto& it : index) {
+            const uint8_t* ptr = view(it.second.offset, it.second.bytes);
+            store_record_t record;
+            std::memcpy(&record, ptr, sizeof(record));
+            record.flags &= ~STORE_PENDING; // committed
+            write_all(out, &record, sizeof(record), offset, tmppath);
+            write_all(out, ptr + sizeof(record),
+                      it.second.bytes - sizeof(record),
+                      offset + sizeof(record), tmppath);
+            compacted[it.first] = { offset, it.second.bytes,
+                                    it.second.sequence };
+            offset += it.second.bytes;
+        }
+        if ( ::fdatasync(out) < 0 )
+            store_error("sync", tmppath);
+        if ( std::rename(tmppath.c_str(), filepath.c_str()) != 0 )
+            store_error("rename", tmppath);
+    } catch (...) {
+        ::close(out);
+        std::remove(tmppath.c_str());
+        throw;
+    }
+    unmap();
+    ::close(fd);
+    fd = out;
+    inode = file_inode(fd, filepath);
+    end = offset;
+    garbage = 0;
+    index.swap(compacted);
+}
+
+std::vector<map_id_t> tile_store::list() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<map_id_t> ids;
+    for (const auto& it : index)
+        ids.push_back(it.first);
+    return ids;
+}
+
+void atlaas::set_tile_store(const std::string& filepath) {
+    wait_saves(); // the writer might be writing with the previous backend
+    if ( filepath.empty() )
+        store.reset();
+    else
+        store = std::make_shared<tile_store>(filepath);
+}
+
+bool atlaas::sub_exists(const map_id_t& id) const {
+    if (store)
+        return store->contains(id);
+    return file_exists( sub_name(id) );
+}
+
+bool atlaas::sub_read(const map_id_t& id, atlaas& tile) const {
+    if (store) {
+        tile.map.copy_meta(map, sw, sh);
+        if ( ! store->read(id, tile.map) )
+            return false;
+        tile._fill_internal();
+        return true;
+    }
+    std::string filepath = sub_name(id);
+    if ( ! file_exists( filepath ) )
+        return false;
+    tile.init(filepath);
+    return true;
+}
+
+void atlaas::sub_write(const map_id_t& id, const gdalwrap::gdal& tile,
+                       bool pending) const {
+    if (store)
+        store->write(id, tile, pending);
+    else
+        tile.save( sub_name(id) + (pending ? ".reanchor" : "") );
+    if ( ! pending )
+        _written(id);
+}
+
+void atlaas::_written(const map_id_t& id) const {
+    std::lock_guard<std::mutex> lock(written_mutex);
+    written[id] = ++written_seq;
+}
+
+std::vector<map_id_t> atlaas::tiles_written(uint64_t& since) const {
+    std::lock_guard<std::mutex> lock(written_mutex);
+    std::vector<map_id_t> ids;
+    for (const auto& it : written)
+        if (it.second > since)
+            ids.push_back(it.first);
+    since = written_seq;
+    return ids;
+}
+
+std::vector<map_id_t> atlaas::saved_tiles() const {
+    if (store)
+        return store->list();
+    std::vector<map_id_t> ids;
+    DIR* dir = opendir(".");
+    if (dir == NULL)
+        store_error("opendir", ".");
+    while (dirent* ent = readdir(dir)) {
+        map_id_t id;
+        if ( std::sscanf(ent->d_name, "atlaas.%dx%d.tif", &id[0], &id[1]) != 2
+             || sub_name(id) != ent->d_name )
+            continue; // not a submodel (or a temporary file)
+        ids.push_back(id);
+    }
+    closedir(dir);
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+bool atlaas::load_tile(const map_id_t& id, cells_info_t& cells) const {
+    atlaas tile;
+    if ( ! sub_read(id, tile) )
+        return false;
+    cells.resize(sw * sh);
+    for (size_t y = 0; y < sh; y++) {
+        const cell_info_t* it = tile.internal.row(y);
+        std::copy(it, it + sw, cells.begin() + y * sw);
+    }
+    return true;
+}
+
+void atlaas::save_tile(const map_id_t& id, const cells_info_t& cells) {
+    if ( cells.size() != sw * sh )
+        throw std::out_of_range("atlaas::save_tile");
+    wait_saves(); // a background save of the same submodel would win
+    // same georeferencing as sub_save
+    atlaas tile;
+    tile.map.copy_meta(map, sw, sh);
+    tile.internal.assign(sw, sh);
+    for (size_t y = 0; y < sh; y++)
+        std::copy(cells.begin() + y * sw, cells.begin() + (y + 1) * sw,
+                  tile.internal.row_write(y));
+    tile.update();
+    const auto& utm = map.point_pix2utm(double(id[0] - current[0]) * sw,
+                                        double(id[1] - current[1]) * sh);
+    tile.map.set_transform(utm[0], utm[1], map.get_scale_x(),
+                           map.get_scale_y());
+    sub_write(id, tile.map);
+    int sx = id[0] - current[0], sy = id[1] - current[1];
+    if ( sx >= -1 && sx <= 1 && sy >= -1 && sy <= 1 )
+        write_region(sw * size_t(sx + 1), sh * size_t(sy + 1), sw, sh,
+                     cells, current);
+}
+
+} // namespace atlaas
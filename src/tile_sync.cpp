@@ -0,0 +1,452 @@
+/*
+ * tile_sync.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <algorithm>        // equal, max, min
+#include <cerrno>
+#include <cstring>          // memcpy, strerror
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <unistd.h>         // read, write
+
+#include "atlaas/tile_sync.hpp"
+
+namespace atlaas {
+
+static const uint32_t SYNC_MAGIC = 0x59535441; // "ATSY"
+static const uint32_t SYNC_VERSION = 2;
+// largest message, the length comes from the peer
+static const uint64_t SYNC_MAX_MESSAGE = uint64_t(1) << 30;
+static const size_t SYNC_CHUNK = 1 << 20;
+
+void fd_transport::write(const void* data, size_t size) {
+    const char* ptr = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, ptr, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw std::runtime_error(std::string("[tile_sync] write: ") +
+                                     std::strerror(errno));
+        ptr += n;
+        size -= n;
+    }
+}
+
+void fd_transport::read(void* data, size_t size) {
+    char* ptr = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::read(fd, ptr, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw std::runtime_error(std::string("[tile_sync] read: ") +
+                (n == 0 ? "connection closed" : std::strerror(errno)));
+        ptr += n;
+        size -= n;
+    }
+}
+
+/**
+ * Message buffer, integers little-endian (floats by their bits), and
+ * unsigned LEB128 varints for the small counts
+ */
+struct sync_buffer {
+    std::vector<uint8_t> data;
+    size_t pos;
+
+    sync_buffer() : pos(0) {}
+
+    void put(uint64_t value, size_t bytes) {
+        for (size_t k = 0; k < bytes; k++)
+            data.push_back(value >> (8 * k));
+    }
+    void put_varint(uint64_t value) {
+        for (; value >= 0x80; value >>= 7)
+            data.push_back(uint8_t(value) | 0x80);
+        data.push_back(value);
+    }
+    void put_float(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put(bits, 4);
+    }
+
+    uint64_t get(size_t bytes) {
+        if (pos + bytes > data.size())
+            throw std::runtime_error("[tile_sync] truncated message");
+        uint64_t value = 0;
+        for (size_t k = 0; k < bytes; k++)
+            value |= uint64_t(data[pos++]) << (8 * k);
+        return value;
+    }
+    uint64_t get_varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint64_t byte = get(1);
+            value |= (byte & 0x7f) << shift;
+            if ( ! (byte & 0x80) )
+                return value;
+        }
+        throw std::runtime_error("[tile_sync] bad varint");
+    }
+    float get_float() {
+        uint32_t bits = get(4);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    /**
+     * length prefixed message
+     */
+    void send(sync_transport& link) const {
+        if (data.size() > SYNC_MAX_MESSAGE)
+            throw std::runtime_error("[tile_sync] message too large");
+        uint8_t size[8];
+        for (size_t k = 0; k < 8; k++)
+            size[k] = uint64_t(data.size()) >> (8 * k);
+        link.write(size, sizeof(size));
+        link.write(data.data(), data.size());
+    }
+    void receive(sync_transport& link) {
+        uint8_t size[8];
+        link.read(size, sizeof(size));
+        uint64_t bytes = 0;
+        for (size_t k = 0; k < 8; k++)
+            bytes |= uint64_t(size[k]) << (8 * k);
+        if (bytes > SYNC_MAX_MESSAGE)
+            throw std::runtime_error("[tile_sync] message too large");
+        // grown as it arrives, not on the word of the peer
+        data.clear();
+        while (data.size() < bytes) {
+            size_t done = data.size();
+            data.resize(done + std::min<uint64_t>(bytes - done, SYNC_CHUNK));
+            link.read(data.data() + done, data.size() - done);
+        }
+        pos = 0;
+    }
+};
+
+static void write_generations(sync_buffer& buf, const generations_t& gens) {
+    buf.put_varint(gens.size());
+    for (const auto& gen : gens) {
+        buf.put_varint(gen.first);
+        buf.put_varint(gen.second);
+    }
+}
+
+static generations_t read_generations(sync_buffer& buf) {
+    generations_t gens;
+    for (uint64_t n = buf.get_varint(); n > 0; n--) {
+        uint32_t robot = buf.get_varint();
+        gens[robot] = buf.get_varint();
+    }
+    return gens;
+}
+
+/**
+ * what cell `now` holds in addition to `base`, the pooled N_POINTS, mean
+ * and variance inverted (min, max and time those of now), or now itself
+ * if it does not hold more points (replaced by the vertical/flat state)
+ *
+ * @returns false if nothing was added
+ */
+static bool added(const cell_info_t& now, const cell_info_t& base,
+                  cell_info_t& delta) {
+    if ( now[N_POINTS] < 1 ||
+         std::equal(now.begin(), now.begin() + N_RASTER, base.begin()) )
+        return false;
+    delta = now;
+    if ( base[N_POINTS] < 1 || now[N_POINTS] <= base[N_POINTS] )
+        return true;
+    float n_base = base[N_POINTS], n_pts = now[N_POINTS];
+    float n_delta = n_pts - n_base;
+    float mean = (now[Z_MEAN] * n_pts - base[Z_MEAN] * n_base) / n_delta;
+    float d_mean = mean - base[Z_MEAN];
+    float m2 = moments_aggregate::deviations(now)
+             - moments_aggregate::deviations(base)
+             - d_mean * d_mean * n_base * n_delta / n_pts;
+    m2 = std::max(0.0f, m2);
+    delta[N_POINTS] = n_delta;
+    delta[W_SUM] = n_delta;
+    delta[Z_MEAN] = mean;
+    delta[VARIANCE] = (n_delta > 2) ? m2 / (n_delta - 1) : m2;
+    return true;
+}
+
+static uint64_t digest(const cells_info_t& cells) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (const auto& cell : cells) {
+        const uint8_t* ptr = reinterpret_cast<const uint8_t*>(cell.data());
+        for (size_t k = 0; k < N_RASTER * sizeof(float); k++)
+            hash = (hash ^ ptr[k]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * runs of empty and known cells, the known ones with their N_RASTER bands
+ */
+static void put_cells(sync_buffer& buf, const cells_info_t& cells) {
+    size_t idx = 0;
+    while (idx < cells.size()) {
+        size_t start = idx;
+        while (idx < cells.size() && cells[idx][N_POINTS] < 1)
+            idx++;
+        buf.put_varint(idx - start);
+        start = idx;
+        while (idx < cells.size() && cells[idx][N_POINTS] >= 1)
+            idx++;
+        buf.put_varint(idx - start);
+        for (size_t k = start; k < idx; k++)
+            for (size_t band = 0; band < N_RASTER; band++)
+                buf.put_float(cells[k][band]);
+    }
+}
+
+static void get_cells(sync_buffer& buf, cells_info_t& cells) {
+    cell_info_t zeros{}; // value-initialization w/empty initializer
+    std::fill(cells.begin(), cells.end(), zeros);
+    size_t idx = 0;
+    while (idx < cells.size()) {
+        idx += buf.get_varint();
+        size_t known = buf.get_varint();
+        if (idx + known > cells.size())
+            throw std::runtime_error("[tile_sync] bad tile");
+        for (; known > 0; known--, idx++) {
+            for (size_t band = 0; band < N_RASTER; band++)
+                cells[idx][band] = buf.get_float();
+            cells[idx][W_SUM] = cells[idx][N_POINTS];
+        }
+    }
+}
+
+tile_sync::tile_sync(atlaas& _map, uint32_t _robot) : map(_map),
+        robot(_robot), seen(0) {}
+
+cells_info_t tile_sync::pooled(const tile_state_t& state) {
+    cells_info_t cells(map.get_sub_width() * map.get_sub_height(),
+                       cell_info_t{});
+    for (const auto& layer : state.layers)
+        for (size_t idx = 0; idx < cells.size(); idx++)
+            if (layer.second[idx][N_POINTS] >= 1)
+                map.merge(cells[idx], layer.second[idx]);
+    return cells;
+}
+
+/**
+ * fold the changes of the tiles written since the previous exchange in
+ * our layer, and bump our generation
+ */
+void tile_sync::refresh() {
+    const std::vector<map_id_t>& ids = (seen == 0)
+        ? map.saved_tiles() : map.tiles_written(seen);
+    if (seen == 0)
+        map.tiles_written(seen); // the ones above included
+    cells_info_t cells;
+    cell_info_t delta;
+    for (const auto& id : ids) {
+        if ( ! map.load_tile(id, cells) )
+            continue;
+        uint64_t hash = digest(cells);
+        tile_state_t& state = tiles[id];
+        if ( ! state.generations.empty() && state.digest == hash )
+            continue; // as we left it
+        const cells_info_t& base = pooled(state);
+        cells_info_t& layer = state.layers[robot];
+        layer.resize(cells.size(), cell_info_t{});
+        for (size_t idx = 0; idx < cells.size(); idx++)
+            if ( added(cells[idx], base[idx], delta) )
+                map.merge(layer[idx], delta);
+        state.generations[robot]++;
+        // the tile is the merge of the layers, on every peer
+        const cells_info_t& merged = pooled(state);
+        state.digest = digest(merged);
+        if (state.digest != hash)
+            map.save_tile(id, merged);
+    }
+}
+
+void tile_sync::send_summary(sync_transport& link) const {
+    sync_buffer buf;
+    buf.put(SYNC_MAGIC, 4);
+    buf.put(SYNC_VERSION, 4);
+    buf.put(map.get_sub_width(), 4);
+    buf.put(map.get_sub_height(), 4);
+    buf.put_varint(tiles.size());
+    for (const auto& tile : tiles) {
+        buf.put(uint32_t(tile.first[0]), 4);
+        buf.put(uint32_t(tile.first[1]), 4);
+        write_generations(buf, tile.second.generations);
+    }
+    buf.send(link);
+}
+
+std::map<map_id_t, generations_t>
+tile_sync::receive_summary(sync_transport& link) const {
+    sync_buffer buf;
+    buf.receive(link);
+    if ( buf.get(4) != SYNC_MAGIC || buf.get(4) != SYNC_VERSION )
+        throw std::runtime_error("[tile_sync] not a tile sync peer");
+    if ( buf.get(4) != map.get_sub_width() ||
+         buf.get(4) != map.get_sub_height() )
+        throw std::runtime_error("[tile_sync] submodel size mismatch");
+    std::map<map_id_t, generations_t> peer;
+    for (uint64_t n = buf.get_varint(); n > 0; n--) {
+        map_id_t id;
+        id[0] = int32_t(buf.get(4));
+        id[1] = int32_t(buf.get(4));
+        peer[id] = read_generations(buf);
+    }
+    return peer;
+}
+
+/**
+ * the layers of generations the peer has not seen
+ */
+void tile_sync::send_tiles(sync_transport& link,
+                           const std::map<map_id_t, generations_t>& peer) {
+    struct layer_t {
+        map_id_t id;
+        uint32_t robot;
+        uint64_t generation;
+        const cells_info_t* cells;
+    };
+    std::vector<layer_t> layers;
+    for (const auto& tile : tiles) {
+        auto it = peer.find(tile.first);
+        for (const auto& gen : tile.second.generations) {
+            if (it != peer.end()) {
+                auto has = it->second.find(gen.first);
+                if (has != it->second.end() && has->second >= gen.second)
+                    continue; // seen
+            }
+            layers.push_back({ tile.first, gen.first, gen.second,
+                               &tile.second.layers.at(gen.first) });
+        }
+    }
+    sync_buffer buf;
+    buf.put_varint(layers.size());
+    for (const auto& layer : layers) {
+        buf.put(uint32_t(layer.id[0]), 4);
+        buf.put(uint32_t(layer.id[1]), 4);
+        buf.put_varint(layer.robot);
+        buf.put_varint(layer.generation);
+        put_cells(buf, *layer.cells);
+    }
+    buf.send(link);
+}
+
+/**
+ * replace the layers older than the ones received, and save the tiles
+ * they change
+ */
+size_t tile_sync::receive_tiles(sync_transport& link) {
+    sync_buffer buf;
+    buf.receive(link);
+    const size_t n_cells = map.get_sub_width() * map.get_sub_height();
+    cells_info_t cells(n_cells);
+    std::set<map_id_t> changed;
+    for (uint64_t n = buf.get_varint(); n > 0; n--) {
+        map_id_t id;
+        id[0] = int32_t(buf.get(4));
+        id[1] = int32_t(buf.get(4));
+        uint32_t from = buf.get_varint();
+        uint64_t generation = buf.get_varint();
+        get_cells(buf, cells);
+        tile_state_t& state = tiles[id];
+        auto it = state.generations.find(from);
+        if (it != state.generations.end() && it->second >= generation)
+            continue; // already merged
+        state.generations[from] = generation;
+        state.layers[from] = cells;
+        changed.insert(id);
+    }
+    for (const auto& id : changed) {
+        tile_state_t& state = tiles[id];
+        const cells_info_t& merged = pooled(state);
+        state.digest = digest(merged);
+        map.save_tile(id, merged);
+    }
+    return changed.size();
+}
+
+size_t tile_sync::exchange(sync_transport& link, bool initiator) {
+    map.save_currents();
+    map.wait_saves();
+    refresh();
+    std::map<map_id_t, generations_t> peer;
+    size_t received;
+    if (initiator) {
+        send_summary(link);
+        peer = receive_summary(link);
+        send_tiles(link, peer);
+        received = receive_tiles(link);
+    } else {
+        peer = receive_summary(link);
+        send_summary(link);
+        received = receive_tiles(link);
+        // the peer summary was made before, it has its own layers already
+        send_tiles(link, peer);
+    }
+    return received;
+}
+
+void tile_sync::save(const std::string& filepath) const {
+    sync_buffer buf;
+    buf.put(SYNC_MAGIC, 4);
+    buf.put(SYNC_VERSION, 4);
+    buf.put_varint(tiles.size());
+    for (const auto& tile : tiles) {
+        buf.put(uint32_t(tile.first[0]), 4);
+        buf.put(uint32_t(tile.first[1]), 4);
+        buf.put(tile.second.digest, 8);
+        write_generations(buf, tile.second.generations);
+        buf.put_varint(tile.second.layers.size());
+        for (const auto& layer : tile.second.layers) {
+            buf.put_varint(layer.first);
+            put_cells(buf, layer.second);
+        }
+    }
+    std::ofstream file(filepath, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(buf.data.data()),
+               buf.data.size());
+    if ( ! file )
+        throw std::runtime_error("[tile_sync] cannot write " + filepath);
+}
+
+void tile_sync::load(const std::string& filepath) {
+    std::ifstream file(filepath, std::ios::binary);
+    if ( ! file )
+        throw std::runtime_error("[tile_sync] cannot read " + filepath);
+    sync_buffer buf;
+    buf.data.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+    if ( buf.get(4) != SYNC_MAGIC || buf.get(4) != SYNC_VERSION )
+        throw std::runtime_error("[tile_sync] not a sync state " + filepath);
+    tiles.clear();
+    seen = 0; // scan every tile
+    const size_t n_cells = map.get_sub_width() * map.get_sub_height();
+    for (uint64_t n = buf.get_varint(); n > 0; n--) {
+        map_id_t id;
+        id[0] = int32_t(buf.get(4));
+        id[1] = int32_t(buf.get(4));
+        tile_state_t& state = tiles[id];
+        state.digest = buf.get(8);
+        state.generations = read_generations(buf);
+        for (uint64_t k = buf.get_varint(); k > 0; k--) {
+            cells_info_t& layer = state.layers[buf.get_varint()];
+            layer.resize(n_cells);
+            get_cells(buf, layer);
+        }
+    }
+}
+
+} // namespace atlaas
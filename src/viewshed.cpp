@@ -0,0 +1,145 @@
+/*
+ * viewshed.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <atomic>
+#include <thread>
+#include <cmath>            // ceil, sqrt, fabs, isnan
+#include <algorithm>        // min, max
+
+#include "atlaas/atlaas.hpp"
+
+namespace atlaas {
+
+/**
+ * Rays per job of the sweep
+ */
+static const size_t VIEWSHED_RAYS = 64;
+
+/**
+ * Radial sweep (R2): a ray is cast from the sensor to every cell of the
+ * border of the area in range, walking one cell per step and keeping the
+ * steepest slope met so far. A cell is visible if a ray reaches it above
+ * that slope. Rays are independent, swept in parallel; cells only ever
+ * become visible, so rays crossing the same cell do not conflict.
+ */
+size_t atlaas::viewshed(const point_xyz_t& sensor, double range,
+                        std::vector<char>& visible, int band,
+                        size_t n_threads) const {
+    visible.assign(width * height, false);
+    const point_xy_t& pix = map.point_custom2pix(sensor[0], sensor[1]);
+    if ( pix[0] < 0 || pix[0] >= width || pix[1] < 0 || pix[1] >= height )
+        return 0; // sensor out of the window
+    const long ox = pix[0], oy = pix[1];
+    const double mx = std::fabs(map.get_scale_x()),
+                 my = std::fabs(map.get_scale_y());
+    if ( range <= 0 )
+        range = std::max(width * mx, height * my);
+    // area in range, clipped to the window
+    const long rx = std::ceil(range / mx), ry = std::ceil(range / my);
+    const long x0 = std::max(0L, ox - rx), x1 = std::min(long(width)  - 1,
+                                                         ox + rx);
+    const long y0 = std::max(0L, oy - ry), y1 = std::min(long(height) - 1,
+                                                         oy + ry);
+    const size_t w = x1 - x0 + 1, h = y1 - y0 + 1;
+    if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // heights of the area, compact for the sweep (NaN if unknown), read
+    // per block as a seqlock reader
+    std::vector<float> z(w * h);
+    const size_t bx0 = x0 / BLOCK_SIZE, bx1 = x1 / BLOCK_SIZE;
+    const size_t by0 = y0 / BLOCK_SIZE, by1 = y1 / BLOCK_SIZE;
+    const size_t nbx = bx1 - bx0 + 1;
+    parallel_jobs(nbx * (by1 - by0 + 1), n_threads, [&](size_t job) {
+        size_t bx = bx0 + job % nbx, by = by0 + job / nbx;
+        size_t block = by * bw + bx;
+        long xa = std::max<long>(x0, bx * BLOCK_SIZE),
+             xb = std::min<long>(x1 + 1, (bx + 1) * BLOCK_SIZE);
+        long ya = std::max<long>(y0, by * BLOCK_SIZE),
+             yb = std::min<long>(y1 + 1, (by + 1) * BLOCK_SIZE);
+        unsigned version;
+        do {
+            version = locks.read_begin(block);
+            for (long y = ya; y < yb; y++) {
+                const cell_info_t* it = internal.row(y) + xa;
+                float* out = &z[(y - y0) * w + (xa - x0)];
+                for (long x = xa; x < xb; x++, it++, out++)
+                    *out = ((*it)[N_POINTS] > 0) ? (*it)[band] : NAN;
+            }
+        } while ( ! locks.read_end(block, version) );
+    });
+
+    // border cells of the area, clockwise from the top-left corner
+    std::vector<std::array<long, 2>> targets;
+    for (long x = x0; x <= x1; x++)
+        targets.push_back({{ x, y0 }});
+    for (long y = y0 + 1; y <= y1; y++)
+        targets.push_back({{ x1, y }});
+    for (long x = x1 - 1; x >= x0 && y1 > y0; x--)
+        targets.push_back({{ x, y1 }});
+    for (long y = y1 - 1; y > y0 && x1 > x0; y--)
+        targets.push_back({{ x0, y }});
+
+    std::unique_ptr<std::atomic<char>[]> seen(new std::atomic<char>[w * h]);
+    for (size_t idx = 0; idx < w * h; idx++)
+        seen[idx].store(false, std::memory_order_relaxed);
+    seen[(oy - y0) * w + (ox - x0)].store(true, std::memory_order_relaxed);
+    const float sz = sensor[2];
+    const size_t jobs = (targets.size() + VIEWSHED_RAYS - 1) / VIEWSHED_RAYS;
+    parallel_jobs(jobs, n_threads, [&](size_t job) {
+        size_t end = std::min(targets.size(), (job + 1) * VIEWSHED_RAYS);
+        for (size_t ray = job * VIEWSHED_RAYS; ray < end; ray++) {
+            long dx = targets[ray][0] - ox, dy = targets[ray][1] - oy;
+            long steps = std::max(std::labs(dx), std::labs(dy));
+            if (steps == 0)
+                continue; // the sensor cell, on the border, already seen
+            // per step, in cells and meters
+            double sx = double(dx) / steps, sy = double(dy) / steps;
+            double ds = std::sqrt(sx * mx * sx * mx + sy * my * sy * my);
+            steps = std::min(steps, long(range / ds));
+            // from the sensor cell centre, relative to the area
+            double fx = ox - x0 + 0.5, fy = oy - y0 + 0.5;
+            float dist = 0, horizon = -std::numeric_limits<float>::max();
+            float last = NAN; // height of the last known cell
+            for (long k = 1; k <= steps; k++) {
+                fx += sx;
+                fy += sy;
+                dist += ds;
+                size_t idx = size_t(fy) * w + size_t(fx);
+                float height = z[idx];
+                if ( std::isnan(height) )
+                    height = last; // unknown, as flat as the last known
+                if ( std::isnan(height) ) {
+                    seen[idx].store(true, std::memory_order_relaxed);
+                    continue; // nothing known to hide it yet
+                }
+                last = height;
+                // slope above the horizon, without dividing every step
+                float rise = height - sz;
+                if ( rise >= horizon * dist ) {
+                    seen[idx].store(true, std::memory_order_relaxed);
+                    horizon = rise / dist;
+                }
+            }
+        }
+    });
+
+    size_t count = 0;
+    for (size_t y = 0; y < h; y++) {
+        auto out = visible.begin() + (y0 + y) * width + x0;
+        for (size_t x = 0; x < w; x++, out++)
+            if ( seen[y * w + x].load(std::memory_order_relaxed) ) {
+                *out = true;
+                count++;
+            }
+    }
+    return count;
+}
+
+} // namespace atlaas
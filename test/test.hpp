@@ -0,0 +1,89 @@
+/*
+ * test.hpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#ifndef ATLAAS_TEST_HPP
+#define ATLAAS_TEST_HPP
+
+#include <cstdio>           // remove
+#include <cstdlib>          // mkdtemp
+#include <dirent.h>         // opendir
+#include <iostream>
+#include <stdexcept>        // runtime_error
+#include <string>
+#include <unistd.h>         // chdir, rmdir
+
+#include "atlaas/atlaas.hpp"
+
+namespace test {
+
+static int failures = 0;
+
+#define CHECK(cond) do { if ( !(cond) ) { \
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond \
+              << " failed" << std::endl; \
+    test::failures++; } } while (0)
+
+/**
+ * scratch working directory (submodels, logs), removed with its files
+ */
+class scratch {
+    std::string cwd;
+    std::string path;
+public:
+    scratch() {
+        char tmpdir[] = "/tmp/atlaas-test.XXXXXX";
+        char buffer[4096];
+        if ( mkdtemp(tmpdir) == NULL || getcwd(buffer, sizeof(buffer)) == NULL
+             || chdir(tmpdir) != 0 )
+            throw std::runtime_error("cannot create a scratch directory");
+        cwd = buffer;
+        path = tmpdir;
+    }
+    ~scratch() {
+        if ( chdir(cwd.c_str()) != 0 )
+            return;
+        if (DIR* dir = opendir(path.c_str())) {
+            while (dirent* ent = readdir(dir))
+                std::remove( (path + "/" + ent->d_name).c_str() );
+            closedir(dir);
+        }
+        rmdir(path.c_str());
+    }
+};
+
+/**
+ * window of `size` cells (3x3 submodels), a meter per cell
+ */
+inline void init(atlaas::atlaas& map, size_t size) {
+    const double utm_x = 377016, utm_y = 4824583;
+    map.init(size, size, 1, utm_x + size / 2.0, utm_y - size / 2.0,
+             utm_x, utm_y, 31);
+}
+
+/**
+ * cells of a region, a `value` mean height observed once
+ */
+inline atlaas::cells_info_t region(size_t w, size_t h, float value) {
+    atlaas::cell_info_t cell;
+    cell.fill(0);
+    cell[atlaas::N_POINTS] = 1;
+    cell[atlaas::Z_MIN] = cell[atlaas::Z_MAX] = value;
+    cell[atlaas::Z_MEAN] = value;
+    return atlaas::cells_info_t(w * h, cell);
+}
+
+inline int report(const char* name) {
+    if (failures)
+        std::cerr << name << ": " << failures << " failure(s)" << std::endl;
+    return failures ? 1 : 0;
+}
+
+} // namespace test
+
+#endif // ATLAAS_TEST_HPP
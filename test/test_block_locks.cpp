@@ -0,0 +1,100 @@
+/*
+ * test_block_locks.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <atomic>
+#include <map>
+#include <thread>
+
+#include "test.hpp"
+
+/**
+ * regions written and read from other threads while the mapping thread
+ * merges point clouds and saves the window in background, if blocked the
+ * bands are allocated meanwhile
+ */
+static void run(bool blocked) {
+    const size_t size = 384; // 6x6 blocks
+    atlaas::atlaas map;
+    map.set_blocked_storage(blocked);
+    test::init(map, size);
+    map.set_merge_policy(atlaas::STATIC_MERGE); // straight in internal
+
+    // points in the left two thirds of the window
+    atlaas::points cloud(20000), moved;
+    uint32_t seed = 42;
+    auto uniform = [&]() {
+        seed = seed * 1664525 + 1013904223;
+        return float(seed >> 8) / float(1 << 24);
+    };
+    for (auto& point : cloud)
+        point = {{ (uniform() - 0.5f) * size * 2 / 3 - size / 6.0f,
+                   (uniform() - 0.5f) * size, uniform() }};
+
+    // `shared` overlaps the merged cells, `checked` is ours only
+    const size_t sx = 100, sy = 100, sw = 100, sh = 100;
+    const size_t cx = 288, cy = 32, cw = 96, ch = 128;
+    atlaas::cells_info_t cells;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, cells);
+
+    std::atomic<bool> done(false);
+    std::atomic<int> written(0);
+    std::thread writer([&]() {
+        for (int value = 1; !done; value++) {
+            map.write_region(sx, sy, sw, sh,
+                             test::region(sw, sh, value), window);
+            map.write_region(cx, cy, cw, ch,
+                             test::region(cw, ch, value), window);
+            written = value;
+        }
+    });
+    std::atomic<int> torn(0);
+    std::thread reader([&]() {
+        atlaas::cells_info_t read;
+        std::map<size_t, float> blocks; // first value read per block
+        while (!done) {
+            map.read_region(cx, cy, cw, ch, read);
+            blocks.clear();
+            for (size_t idx = 0; idx < read.size(); idx++) {
+                const size_t x = cx + idx % cw, y = cy + idx / cw;
+                const size_t block = (y / atlaas::BLOCK_SIZE) * 6
+                                   + x / atlaas::BLOCK_SIZE;
+                const float value = read[idx][atlaas::Z_MEAN];
+                if ( ! blocks.insert( {block, value} ).second &&
+                     blocks[block] != value )
+                    torn++;
+            }
+        }
+    });
+
+    for (size_t run = 0; run < 200; run++) {
+        moved = cloud;
+        map.merge(moved, atlaas::pose6d_to_matrix(0, 0, 0, 0, 0, 0));
+        map.save_currents(); // waits for the previous one
+    }
+    map.wait_saves();
+    done = true;
+    writer.join();
+    reader.join();
+
+    CHECK( written > 0 );
+    // a write is not atomic, but each block of it is
+    CHECK( torn == 0 );
+    map.read_region(cx, cy, cw, ch, cells);
+    bool last = true;
+    for (const auto& cell : cells)
+        last = last && cell[atlaas::Z_MEAN] == written;
+    CHECK( last );
+}
+
+int main() {
+    test::scratch dir;
+    run(false);
+    run(true);
+    return test::report("block_locks");
+}
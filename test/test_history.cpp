@@ -0,0 +1,68 @@
+/*
+ * test_history.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include "atlaas/history.hpp"
+#include "test.hpp"
+
+static bool uniform(const atlaas::cells_info_t& cells, float value) {
+    for (const auto& cell : cells)
+        if ( cell[atlaas::Z_MEAN] != value )
+            return false;
+    return ! cells.empty();
+}
+
+/**
+ * versions share the blocks that did not change in between
+ */
+int main() {
+    test::scratch dir;
+    const size_t size = 384; // 6x6 blocks
+    atlaas::atlaas map;
+    test::init(map, size);
+    atlaas::cells_info_t cells;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, cells);
+    map.write_region(0, 0, size, size, test::region(size, size, 1), window);
+
+    atlaas::map_history history;
+    CHECK( history.commit(map, 10) == 36 );
+    CHECK( history.commit(map, 11) == 0 ); // nothing changed
+    CHECK( history.get_blocks() == 36 );
+    // one block, then four (a region across their corner)
+    map.write_region(0, 0, 10, 10, test::region(10, 10, 2), window);
+    CHECK( history.commit(map, 12) == 1 );
+    map.write_region(60, 60, 10, 10, test::region(10, 10, 3), window);
+    CHECK( history.commit(map, 13) == 4 );
+    CHECK( history.get_blocks() == 36 + 1 + 4 );
+    CHECK( history.size() == 4 );
+
+    // each version reads as the window was
+    history.read_region(history.find(11.5), 0, 0, 10, 10, cells);
+    CHECK( uniform(cells, 1) );
+    history.read_region(history.find(12), 0, 0, 10, 10, cells);
+    CHECK( uniform(cells, 2) );
+    history.read_region(history.find(12), 60, 60, 10, 10, cells);
+    CHECK( uniform(cells, 1) );
+    history.read_region(history.find(100), 60, 60, 10, 10, cells);
+    CHECK( uniform(cells, 3) );
+    bool before = false;
+    try {
+        history.find(9);
+    } catch (const std::out_of_range&) {
+        before = true;
+    }
+    CHECK( before );
+
+    // dropping the old versions releases the blocks only they held
+    history.set_retention(2, 0);
+    CHECK( history.size() == 2 && history.get_time(0) == 12 );
+    CHECK( history.get_blocks() == 36 + 4 );
+    history.set_retention(0, 0.5);
+    CHECK( history.size() == 1 && history.get_blocks() == 36 );
+    return test::report("history");
+}
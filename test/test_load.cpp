@@ -0,0 +1,92 @@
+/*
+ * test_load.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cmath>
+
+#include <gdal.h>
+#include <cpl_vsi.h>
+
+#include "test.hpp"
+
+static const char* MAP = "/vsimem/test_load.tif";
+static const int SIZE = 20;
+
+/**
+ * in-memory map of SIZE x SIZE cells of 1m, its top-left corner at the
+ * custom origin, Z_MEAN = x + 100 y (in pixels), all observed once
+ */
+static void create() {
+    GDALAllRegister();
+    GDALDatasetH ds = GDALCreate(GDALGetDriverByName("GTiff"), MAP, SIZE,
+                                 SIZE, atlaas::N_RASTER, GDT_Float32, NULL);
+    double gt[6] = { 1000, 1, 0, 2000, 0, -1 };
+    GDALSetGeoTransform(ds, gt);
+    GDALSetMetadataItem(ds, "CUSTOM_X_ORIGIN", "1000", NULL);
+    GDALSetMetadataItem(ds, "CUSTOM_Y_ORIGIN", "2000", NULL);
+    std::vector<float> data(SIZE * SIZE);
+    for (int band = 0; band < atlaas::N_RASTER; band++) {
+        for (int idx = 0; idx < SIZE * SIZE; idx++)
+            data[idx] = (band == atlaas::N_POINTS) ? 1 :
+                        (band == atlaas::Z_MEAN) ? idx % SIZE + 100 *
+                                                   (idx / SIZE) : 0;
+        GDALRasterBandH rb = GDALGetRasterBand(ds, band + 1);
+        GDALSetDescription(rb, atlaas::MAP_NAMES[band].c_str());
+        CHECK( GDALRasterIO(rb, GF_Write, 0, 0, SIZE, SIZE, data.data(),
+                            SIZE, SIZE, GDT_Float32, 0, 0) == CE_None );
+    }
+    GDALClose(ds);
+}
+
+/**
+ * load a region shifted by (dx, dy) cells of `scale` meters from the map:
+ * the cells within the raster have the pixel under their centre, the ones
+ * (even partly) out of it are unknown
+ */
+static bool shifted(double dx, double dy, double scale) {
+    atlaas::atlaas map;
+    const double x0 = dx * scale, y1 = - dy * scale;
+    const double size = 3 * 8 * scale; // 3x3 submodels of 8 cells
+    map.init(MAP, {{ x0, y1 - size, x0 + size, y1 }}, scale, 2);
+    bool ok = true;
+    for (long j = 0; j < 24; j++)
+    for (long i = 0; i < 24; i++) {
+        const atlaas::cell_info_t& cell = map.get_internal()[j * 24 + i];
+        // cell corners, in pixels of the raster
+        const double xa = x0 + i * scale, xb = xa + scale;
+        const double ya = - y1 + j * scale, yb = ya + scale;
+        if ( xa < 0 || ya < 0 || xb > SIZE || yb > SIZE ) {
+            ok = ok && cell[atlaas::N_POINTS] == 0;
+            continue;
+        }
+        // nearest: the pixel under the centre (either one on the border)
+        const double cx = (xa + xb) / 2, cy = (ya + yb) / 2;
+        bool found = false;
+        for (double px : { std::floor(cx), std::ceil(cx) - 1 })
+        for (double py : { std::floor(cy), std::ceil(cy) - 1 })
+            found = found || cell[atlaas::Z_MEAN] == float(px + 100 * py);
+        ok = ok && found && cell[atlaas::N_POINTS] == 1;
+    }
+    return ok;
+}
+
+/**
+ * regions over the edges of the raster, by fractions of a cell
+ */
+int main() {
+    test::scratch dir;
+    create();
+    CHECK( shifted(0, 0, 1) );
+    CHECK( shifted(-4.25, -3.5, 1) );
+    CHECK( shifted(-0.5, 7.25, 1) );
+    CHECK( shifted(2.75, -1.5, 1) );
+    CHECK( shifted(-1.5, -2.5, 2) );
+    CHECK( shifted(-0.25, 0.5, 0.5) );
+    VSIUnlink(MAP);
+    return test::report("load");
+}
@@ -0,0 +1,108 @@
+/*
+ * test_moments.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "test.hpp"
+
+static uint32_t seed = 42;
+
+static float uniform() {
+    seed = seed * 1664525 + 1013904223;
+    return float(seed >> 8) / float(1 << 24);
+}
+
+/**
+ * window cells after merging the cloud with the moments, merge policy
+ */
+static atlaas::cells_info_t merged(atlaas::points cloud,
+                                   atlaas::merge_policy_t policy) {
+    atlaas::atlaas map;
+    test::init(map, 96);
+    map.set_merge_policy(policy);
+    map.set_aggregate(atlaas::AGGREGATE_MOMENTS);
+    map.merge(cloud, atlaas::pose6d_to_matrix(0, 0, 0, 0, 0, 0));
+    return map.get_internal();
+}
+
+/**
+ * same bits, but for LAST_UPDATE
+ */
+static bool identical(const atlaas::cells_info_t& a,
+                      const atlaas::cells_info_t& b) {
+    if ( a.size() != b.size() )
+        return false;
+    for (size_t index = 0; index < a.size(); index++)
+        for (int band : {atlaas::N_POINTS, atlaas::Z_MAX, atlaas::Z_MIN,
+                         atlaas::Z_MEAN, atlaas::VARIANCE})
+            if ( std::memcmp(&a[index][band], &b[index][band],
+                             sizeof(float)) != 0 )
+                return false;
+    return true;
+}
+
+/**
+ * mean and variance from the exact sums do not depend on the order of the
+ * points, and match a two-pass computation within the quantum
+ */
+int main() {
+    test::scratch dir;
+    // 8x8 cells of 1m around the custom origin, 64 points each
+    atlaas::points cloud;
+    for (int y = 0; y < 8; y++)
+    for (int x = 0; x < 8; x++)
+    for (int k = 0; k < 64; k++)
+        cloud.push_back({{ x + 0.5f, y + 0.5f,
+                           100 + x * 0.1f + (uniform() - 0.5f) * y }});
+    atlaas::points shuffled(cloud);
+    std::reverse(shuffled.begin(), shuffled.end());
+    for (size_t i = shuffled.size() - 1; i > 0; i--)
+        std::swap(shuffled[i], shuffled[size_t(uniform() * (i + 1))]);
+
+    for (auto policy : {atlaas::STATIC_MERGE, atlaas::DYNAMIC_MERGE}) {
+        const atlaas::cells_info_t cells = merged(cloud, policy);
+        CHECK( identical(cells, merged(shuffled, policy)) );
+
+        bool close = true;
+        for (int y = 0; y < 8; y++)
+        for (int x = 0; x < 8; x++) {
+            double sum = 0, m2 = 0;
+            const size_t first = (y * 8 + x) * 64;
+            for (size_t k = first; k < first + 64; k++)
+                sum += cloud[k][2];
+            const double mean = sum / 64;
+            for (size_t k = first; k < first + 64; k++)
+                m2 += (cloud[k][2] - mean) * (cloud[k][2] - mean);
+            // custom origin in the middle of the window, y up
+            const atlaas::cell_info_t& cell = cells[(47 - y) * 96 + 48
+                                                    + x];
+            close = close && cell[atlaas::N_POINTS] == 64 &&
+                std::fabs(cell[atlaas::Z_MEAN] - mean) < 1e-3 &&
+                std::fabs(cell[atlaas::VARIANCE] - m2 / 63) < 1e-3;
+        }
+        CHECK( close );
+    }
+
+    // the sums move with the cells
+    atlaas::cell_grid grid;
+    grid.assign(96, 96, true);
+    for (float z : {1.0f, 2.0f, 4.0f})
+        atlaas::add_point<atlaas::moments_aggregate>(grid, 10 * 96 + 10, z,
+                                                     1);
+    grid.shift(5, -3);
+    atlaas::cell_info_t info = grid[13 * 96 + 5];
+    atlaas::finalize_cell<atlaas::moments_aggregate>(grid, 13 * 96 + 5,
+                                                     info);
+    CHECK( info[atlaas::N_POINTS] == 3 );
+    CHECK( std::fabs(info[atlaas::Z_MEAN] - 7 / 3.0) < 1e-3 );
+    CHECK( std::fabs(info[atlaas::VARIANCE] - 7 / 3.0) < 1e-3 );
+    return test::report("moments");
+}
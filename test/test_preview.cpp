@@ -0,0 +1,79 @@
+/*
+ * test_preview.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <fstream>
+#include <iterator>
+
+#include "atlaas/preview.hpp"
+#include "test.hpp"
+
+/**
+ * pixels of a layer of the finest tile [0,0], empty if unreadable
+ */
+static std::vector<uint8_t> finest(const std::string& layer) {
+    std::ifstream file("preview/" + layer + "/3/0/0.png", std::ios::binary);
+    std::vector<uint8_t> png((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+    std::vector<uint8_t> rgba(atlaas::TILE_SIZE * atlaas::TILE_SIZE * 4);
+    if ( ! atlaas::png_decode(png, atlaas::TILE_SIZE, atlaas::TILE_SIZE,
+                              rgba.data()) )
+        rgba.clear();
+    return rgba;
+}
+
+/**
+ * whether the pixels [x0, x1) x [0, rows) of the image are all opaque
+ */
+static bool opaque(const std::vector<uint8_t>& rgba, size_t x0, size_t x1,
+                   size_t rows) {
+    for (size_t y = 0; y < rows; y++)
+        for (size_t x = x0; x < x1; x++)
+            if ( rgba[(y * atlaas::TILE_SIZE + x) * 4 + 3] != 255 )
+                return false;
+    return true;
+}
+
+/**
+ * the parts of a tile out of the window keep their pixels, for a tile not
+ * in memory too (a renderer restarted after a slide)
+ */
+int main() {
+    test::scratch dir;
+    // PNG round trip
+    std::vector<uint8_t> rgba(300 * 200 * 4), back(rgba.size()), png;
+    for (size_t idx = 0; idx < rgba.size(); idx++)
+        rgba[idx] = idx * 7919 >> 3;
+    atlaas::png_encode(rgba.data(), 300, 200, png);
+    CHECK( atlaas::png_decode(png, 300, 200, back.data()) && back == rgba );
+    CHECK( ! atlaas::png_decode(png, 200, 300, back.data()) );
+    png.resize(png.size() / 2);
+    CHECK( ! atlaas::png_decode(png, 300, 200, back.data()) );
+
+    // window [-64, 128) of the global grid, tile [0,0] gets [0, 128)
+    atlaas::atlaas map;
+    test::init(map, 192);
+    atlaas::cells_info_t cells;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, cells);
+    map.write_region(0, 0, 192, 192, test::region(192, 192, 1), window);
+    {
+        atlaas::tile_renderer renderer("preview", 0, 2);
+        CHECK( renderer.render(map, 2) > 0 );
+    }
+    CHECK( opaque(finest("height"), 0, 128, 128) );
+    // slide west, the window [-128, 64) renders [0, 64) of the tile again
+    map.slide_to(-70, 0);
+    CHECK( map.get_frame().current[0] == -1 );
+    atlaas::tile_renderer renderer("preview", 0, 2);
+    CHECK( renderer.render(map, 2) > 0 );
+    for (const auto& layer : {"height", "shade"}) {
+        const std::vector<uint8_t>& image = finest(layer);
+        CHECK( ! image.empty() && opaque(image, 0, 128, 128) );
+    }
+    return test::report("preview");
+}
@@ -0,0 +1,195 @@
+/*
+ * test_region_stats.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cmath>
+#include <stdexcept>
+
+#include "test.hpp"
+
+static const long SIZE = 210; // blocks cut by the window edges
+
+static uint32_t seed = 42;
+
+static float uniform() {
+    seed = seed * 1664525 + 1013904223;
+    return float(seed >> 8) / float(1 << 24);
+}
+
+static long pick(long n) {
+    return std::min<long>(n - 1, uniform() * n);
+}
+
+/**
+ * random cells over [x, x + w) x [y, y + h) of the window, a fifth of
+ * them unobserved
+ */
+static void scatter(atlaas::atlaas& map, long x, long y, long w, long h) {
+    atlaas::cells_info_t cells = test::region(w, h, 0);
+    for (auto& cell : cells) {
+        if ( uniform() < 0.2 ) {
+            cell.fill(0);
+            continue;
+        }
+        cell[atlaas::Z_MEAN] = 10 * uniform() - 5;
+        cell[atlaas::Z_MIN] = cell[atlaas::Z_MEAN] - uniform();
+        cell[atlaas::Z_MAX] = cell[atlaas::Z_MEAN] + uniform();
+    }
+    atlaas::cells_info_t read;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, read);
+    map.write_region(x, y, w, h, cells, window);
+}
+
+/**
+ * statistics of the cells `inside` the window, scanning them all
+ */
+template <class Inside>
+static atlaas::region_stats_t scan(const atlaas::cells_info_t& cells,
+                                   Inside inside) {
+    atlaas::region_stats_t stats = { 0, 0, NAN, NAN, NAN };
+    double sum = 0;
+    for (long y = 0; y < SIZE; y++)
+    for (long x = 0; x < SIZE; x++) {
+        if ( ! inside(x, y) )
+            continue;
+        stats.cells++;
+        const atlaas::cell_info_t& cell = cells[y * SIZE + x];
+        if ( cell[atlaas::N_POINTS] <= 0 )
+            continue;
+        stats.observed++;
+        sum += cell[atlaas::Z_MEAN];
+        stats.z_min = std::fmin(stats.z_min, cell[atlaas::Z_MIN]);
+        stats.z_max = std::fmax(stats.z_max, cell[atlaas::Z_MAX]);
+    }
+    if (stats.observed)
+        stats.z_mean = sum / stats.observed;
+    return stats;
+}
+
+static bool same(const atlaas::region_stats_t& a,
+                 const atlaas::region_stats_t& b) {
+    if ( a.cells != b.cells || a.observed != b.observed )
+        return false;
+    if ( a.observed == 0 )
+        return std::isnan(a.z_mean) && std::isnan(b.z_mean);
+    return a.z_min == b.z_min && a.z_max == b.z_max &&
+           std::fabs(a.z_mean - b.z_mean) < 1e-4;
+}
+
+/**
+ * random rectangles, many of them on the window edges, against a scan;
+ * the ones crossing the edges refused
+ */
+static bool rectangles(const atlaas::atlaas& map) {
+    atlaas::cells_info_t cells;
+    map.read_region(0, 0, SIZE, SIZE, cells);
+    bool ok = true;
+    for (int k = 0; k < 300; k++) {
+        long x = pick(SIZE), y = pick(SIZE);
+        long w = 1 + pick(SIZE - x), h = 1 + pick(SIZE - y);
+        if (k % 3 == 0)
+            w = SIZE - x; // to the right edge
+        if (k % 5 == 0)
+            y = 0;        // from the top edge
+        const atlaas::region_stats_t expected = scan(cells,
+            [&](long i, long j) {
+                return i >= x && i < x + w && j >= y && j < y + h;
+            });
+        ok = ok && same(map.region_stats(x, y, w, h), expected);
+    }
+    ok = ok && same(map.region_stats(0, 0, SIZE, SIZE),
+                    scan(cells, [](long, long) { return true; }));
+    for (const auto& bad : { std::array<long, 4>{{ 0, 0, SIZE + 1, 1 }},
+                             std::array<long, 4>{{ SIZE - 4, 7, 5, 5 }},
+                             std::array<long, 4>{{ 3, SIZE - 1, 1, 2 }} }) {
+        bool refused = false;
+        try {
+            map.region_stats(bad[0], bad[1], bad[2], bad[3]);
+        } catch (const std::out_of_range&) {
+            refused = true;
+        }
+        ok = ok && refused;
+    }
+    return ok;
+}
+
+/**
+ * random footprints, many of them crossing the window edges, against a
+ * scan of the cells under them: the cover holds all the cells whose
+ * centre is in the footprint, and no cell farther from it than a strip
+ */
+static bool footprints(const atlaas::atlaas& map) {
+    atlaas::cells_info_t cells;
+    map.read_region(0, 0, SIZE, SIZE, cells);
+    const atlaas::sensor_frame_t frame = map.get_frame();
+    bool ok = true;
+    for (int k = 0; k < 200; k++) {
+        // centre anywhere over the window and a bit around, in pixels
+        const double px = (1.2 * uniform() - 0.1) * SIZE,
+                     py = (1.2 * uniform() - 0.1) * SIZE;
+        const double x = (px - frame.origin[0]) * frame.scale_x,
+                     y = (py - frame.origin[1]) * frame.scale_y;
+        const double yaw = 2 * M_PI * uniform();
+        const double length = 1 + 40 * uniform(), breadth = 1 + 20 * uniform();
+        const size_t strips = 1 + pick(8);
+        // distance out of the footprint of a cell centre, in meters
+        auto outside = [&](long i, long j) -> double {
+            const double cx = (i + 0.5 - frame.origin[0]) * frame.scale_x - x,
+                         cy = (j + 0.5 - frame.origin[1]) * frame.scale_y - y;
+            const double along = std::fabs(cx * std::cos(yaw)
+                                           + cy * std::sin(yaw)),
+                         across = std::fabs(- cx * std::sin(yaw)
+                                            + cy * std::cos(yaw));
+            return std::max(along - length / 2, across - breadth / 2);
+        };
+        const atlaas::region_stats_t& under = scan(cells,
+            [&](long i, long j) { return outside(i, j) <= 0; });
+        const atlaas::region_stats_t& got = map.footprint_stats(x, y, yaw,
+            length, breadth, strips);
+        // rows of the footprint per strip, and the diagonal of a cell
+        const double margin = std::ceil((length + breadth) / strips) + 1.5;
+        const atlaas::region_stats_t& near = scan(cells,
+            [&](long i, long j) { return outside(i, j) <= margin; });
+        ok = ok && got.cells >= under.cells && got.cells <= near.cells &&
+             got.observed >= under.observed &&
+             got.observed <= near.observed;
+        if ( under.observed > 0 )
+            ok = ok && got.z_min <= under.z_min && got.z_max >= under.z_max
+                    && got.z_min >= near.z_min && got.z_max <= near.z_max;
+    }
+    return ok;
+}
+
+/**
+ * region and footprint statistics match a scan of the cells, after
+ * updates of a few blocks and after a slide
+ */
+int main() {
+    test::scratch dir;
+    atlaas::atlaas map;
+    test::init(map, SIZE);
+    map.set_region_stats(true);
+    scatter(map, 0, 0, SIZE, SIZE);
+    map.update_region_stats(4);
+    CHECK( rectangles(map) );
+    CHECK( footprints(map) );
+    // a few blocks changed, recomputed with their neighbours
+    scatter(map, 50, 100, 30, 90);
+    scatter(map, SIZE - 7, 0, 7, 7);
+    map.update_region_stats(4);
+    CHECK( rectangles(map) );
+    CHECK( footprints(map) );
+    // slide east, the east submodels new
+    map.slide_to(SIZE / 2 - 10, 0);
+    CHECK( map.get_frame().current[0] == 1 );
+    scatter(map, 2 * SIZE / 3, 0, SIZE / 3, SIZE);
+    map.update_region_stats(4);
+    CHECK( rectangles(map) );
+    CHECK( footprints(map) );
+    return test::report("region_stats");
+}
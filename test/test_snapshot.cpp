@@ -0,0 +1,45 @@
+/*
+ * test_snapshot.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include "test.hpp"
+
+/**
+ * a background save writes the window as it was when it started, even
+ * if the cells are modified meanwhile (copy-on-write)
+ */
+int main() {
+    test::scratch dir;
+    const size_t size = 384, sub = size / 3;
+    atlaas::atlaas map;
+    test::init(map, size);
+    atlaas::cells_info_t cells;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, cells);
+
+    for (int run = 1; run <= 10; run++) {
+        // centre submodel, then the whole window modified while saving
+        CHECK( map.write_region(sub, sub, sub, sub,
+                                test::region(sub, sub, run), window) );
+        map.save_currents();
+        CHECK( map.write_region(0, 0, size, size,
+                                test::region(size, size, -run), window) );
+        map.wait_saves();
+
+        CHECK( map.load_tile({{0, 0}}, cells) );
+        CHECK( cells.size() == sub * sub );
+        bool saved = true;
+        for (const auto& cell : cells)
+            saved = saved && cell[atlaas::Z_MEAN] == run
+                          && cell[atlaas::N_POINTS] == 1;
+        CHECK( saved );
+        // and the window keeps the last write
+        map.read_region(sub, sub, sub, sub, cells);
+        CHECK( cells[0][atlaas::Z_MEAN] == -run );
+    }
+    return test::report("snapshot");
+}
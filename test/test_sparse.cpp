@@ -0,0 +1,126 @@
+/*
+ * test_sparse.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <memory>
+#include <functional>
+#include <stdexcept>
+
+#include "atlaas/tile_store.hpp"
+#include "test.hpp"
+
+/**
+ * tile with a single block observed (saved sparse)
+ */
+static gdalwrap::gdal make_tile() {
+    gdalwrap::gdal tile;
+    tile.set_size(atlaas::N_RASTER, 200, 150); // 4x3 blocks
+    tile.set_transform(377016, 4824583, 0.5, -0.5);
+    for (size_t band = 0; band < tile.bands.size(); band++)
+        for (size_t y = 130; y < 150; y++)
+            for (size_t x = 150; x < 200; x++)
+                tile.bands[band][y * 200 + x] = band + x + y * 1e-3f;
+    return tile;
+}
+
+static bool holds(const atlaas::tile_store& store,
+                  const atlaas::map_id_t& id) {
+    gdalwrap::gdal tile;
+    return store.read(id, tile) && tile.bands == make_tile().bands;
+}
+
+static bool throws(const std::function<void()>& call) {
+    try {
+        call();
+    } catch (const std::logic_error&) {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * sparse records in the tile store, and bands of internal allocated on
+ * first write (blocked storage)
+ */
+int main() {
+    test::scratch dir;
+    const atlaas::map_id_t a = {{0, 0}}, b = {{1, 0}};
+    {
+        // the sparse record last in the file
+        std::unique_ptr<atlaas::tile_store> store(
+            new atlaas::tile_store("tiles.atl"));
+        store->write(a, make_tile());
+        store->write(b, make_tile());
+        CHECK( holds(*store, a) && holds(*store, b) );
+        store.reset(new atlaas::tile_store("tiles.atl"));
+        CHECK( holds(*store, a) && holds(*store, b) );
+        store->remove(a);
+        store->compact();
+        store.reset(new atlaas::tile_store("tiles.atl"));
+        CHECK( ! store->contains(a) && holds(*store, b) );
+    }
+
+    const size_t size = 384, band = atlaas::BLOCK_SIZE * size;
+    atlaas::atlaas map;
+    map.set_blocked_storage(true);
+    map.set_tile_store("map.atl");
+    test::init(map, size);
+    CHECK( map.get_internal_grid().get_allocated() == 0 );
+    atlaas::cells_info_t cells;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, cells);
+    map.write_region(200, 10, 10, 10, test::region(10, 10, 5), window);
+    CHECK( map.get_internal_grid().get_allocated() == band );
+    map.write_region(200, 60, 10, 10, test::region(10, 10, 6), window);
+    CHECK( map.get_internal_grid().get_allocated() == 2 * band );
+    // absent bands read as zeros
+    map.read_region(0, 300, 10, 10, cells);
+    bool zeros = true;
+    for (const auto& cell : cells)
+        zeros = zeros && cell[atlaas::N_POINTS] == 0;
+    CHECK( zeros );
+
+    // saved sparse, and loaded back as is
+    map.save_currents();
+    map.wait_saves();
+    atlaas::atlaas other;
+    other.set_blocked_storage(true);
+    other.set_tile_store("map.atl");
+    test::init(other, size);
+    CHECK( other.get_internal_grid().get_allocated() == 2 * band );
+    other.read_region(200, 60, 10, 10, cells);
+    CHECK( cells[0][atlaas::Z_MEAN] == 6 && cells[99][atlaas::Z_MEAN] == 6 );
+    other.read_region(200, 10, 10, 10, cells);
+    CHECK( cells[0][atlaas::Z_MEAN] == 5 && cells[99][atlaas::Z_MEAN] == 5 );
+
+    // reads and shifts never allocate, only writes do
+    atlaas::cell_grid grid;
+    grid.assign(size, size, true);
+    CHECK( grid.row(100)[10][atlaas::N_POINTS] == 0 );
+    CHECK( grid[size * size - 1][atlaas::N_POINTS] == 0 );
+    grid.shift(size / 3, size / 3);
+    CHECK( grid.get_allocated() == 0 );
+    grid.at_write(10)[atlaas::N_POINTS] = 1;
+    grid.row_write(atlaas::BLOCK_SIZE + 1); // allocated, nothing observed
+    CHECK( grid.get_allocated() == 2 * band );
+    grid.shift(0, -10);
+    CHECK( grid.get_allocated() == band );
+    CHECK( grid[10 * size + 10][atlaas::N_POINTS] == 1 );
+    grid.trim();
+    CHECK( grid.get_allocated() == band );
+
+    // contiguous unless blocked
+    CHECK( throws([&]() { map.get_internal(); }) );
+    atlaas::atlaas dense;
+    test::init(dense, size);
+    dense.write_region(200, 10, 10, 10, test::region(10, 10, 5),
+                       dense.read_region(0, 0, 1, 1, cells));
+    dense.get_internal(cells);
+    CHECK( dense.get_internal() == cells );
+    CHECK( dense.get_internal()[10 * size + 200][atlaas::Z_MEAN] == 5 );
+    return test::report("sparse");
+}
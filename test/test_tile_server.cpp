@@ -0,0 +1,158 @@
+/*
+ * test_tile_server.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <thread>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "atlaas/tile_server.hpp"
+#include "test.hpp"
+
+/**
+ * Z_MEAN of the top-left cell, and whether the region is uniform
+ */
+static float z_mean(const std::vector<float>& data, size_t cells) {
+    const float* band = &data[atlaas::Z_MEAN * cells];
+    for (size_t idx = 1; idx < cells; idx++)
+        if (band[idx] != band[0])
+            return -1;
+    return band[0];
+}
+
+static bool changed(const std::vector<atlaas::tile_change_t>& changes,
+                    int x, int y) {
+    for (const auto& change : changes)
+        if (change.x == x && change.y == y)
+            return true;
+    return false;
+}
+
+/**
+ * a tile store served while the map writes (and compacts) it
+ */
+static void serve_store() {
+    atlaas::atlaas map;
+    map.set_tile_store("map.atl");
+    test::init(map, 192); // submodels of 64 cells, the current one [0,0]
+    atlaas::cells_info_t cells;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, cells);
+    map.write_region(64, 64, 10, 10, test::region(10, 10, 5), window);
+    map.save_currents();
+    map.wait_saves();
+
+    atlaas::tile_server server("store.sock", "map.atl");
+    volatile bool stop = false;
+    std::thread serving([&]() { server.run(stop, 50); });
+    {
+        atlaas::tile_client client("store.sock");
+        std::vector<float> data;
+        std::vector<atlaas::tile_change_t> changes;
+        uint64_t generation = client.delta(0, changes);
+        CHECK( changed(changes, 0, 0) && changed(changes, -1, -1) );
+        client.region(0, 0, 10, 10, data);
+        CHECK( z_mean(data, 100) == 5 );
+        // saved again, the store compacted on the way
+        for (int value = 6; value < 10; value++) {
+            map.write_region(64, 64, 10, 10, test::region(10, 10, value),
+                             window);
+            map.save_currents();
+            map.wait_saves();
+            client.region(0, 0, 10, 10, data);
+            CHECK( z_mean(data, 100) == value );
+            generation = client.delta(generation, changes);
+            CHECK( changed(changes, 0, 0) );
+        }
+        CHECK( client.delta(generation, changes) == generation );
+        CHECK( changes.empty() );
+    }
+    stop = true;
+    serving.join();
+}
+
+/**
+ * raw connection to the server, for the clients that misbehave
+ */
+static int connect_raw(const char* path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0 )
+        return -1;
+    return fd;
+}
+
+/**
+ * clients sending half a request, or not reading a large response, do not
+ * hold the others (the alarm fails the test if they do)
+ */
+static void stalled_clients(const char* path) {
+    int partial = connect_raw(path);
+    int stalled = connect_raw(path);
+    CHECK( partial >= 0 && stalled >= 0 );
+    atlaas::tile_request_t req = { atlaas::TILE_MAGIC, atlaas::TILE_REGION,
+                                   0, 0, 1024, 1024, 0 };
+    CHECK( write(partial, &req, sizeof(req) / 2) > 0 );
+    // ~32MB answered, far above the socket buffers
+    for (int k = 0; k < 2; k++)
+        CHECK( write(stalled, &req, sizeof(req)) == sizeof(req) );
+    alarm(10);
+    {
+        atlaas::tile_client client(path);
+        std::vector<float> data;
+        for (int k = 0; k < 3; k++)
+            client.region(0, 0, 4, 4, data);
+        CHECK( data.size() == atlaas::N_RASTER * 4 * 4 );
+    }
+    // the rest of the request, then answered
+    CHECK( write(partial, (char*) &req + sizeof(req) / 2,
+                 sizeof(req) - sizeof(req) / 2) > 0 );
+    atlaas::tile_response_t res;
+    CHECK( read(partial, &res, sizeof(res)) == sizeof(res) );
+    CHECK( res.status == atlaas::TILE_OK && res.width == 1024 );
+    alarm(0);
+    close(partial);
+    close(stalled);
+}
+
+/**
+ * regions served, and the oversized ones refused before allocating
+ */
+int main() {
+    test::scratch dir;
+    serve_store();
+    atlaas::tile_server server("tiles.sock", ".");
+    volatile bool stop = false;
+    std::thread serving([&]() { server.run(stop, 50); });
+    {
+        atlaas::tile_client client("tiles.sock");
+        std::vector<float> data;
+        client.region(-10, -10, 20, 30, data);
+        CHECK( data.size() == atlaas::N_RASTER * 20 * 30 );
+        // 2^32 cells, as many wrapping to 0 on 32 bits
+        bool refused = false;
+        try {
+            client.region(0, 0, 1 << 16, 1 << 16, data);
+        } catch (const std::runtime_error&) {
+            refused = true;
+        }
+        CHECK( refused );
+        // and the connection still served
+        client.region(0, 0, 2, 2, data);
+        CHECK( data.size() == atlaas::N_RASTER * 2 * 2 );
+    }
+    stalled_clients("tiles.sock");
+    stop = true;
+    serving.join();
+    return test::report("tile_server");
+}
@@ -0,0 +1,104 @@
+/*
+ * test_tile_store.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <memory>
+#include <sys/stat.h>       // stat
+#include <unistd.h>         // truncate
+
+#include "atlaas/tile_store.hpp"
+#include "test.hpp"
+
+static const std::string path = "tiles.atl";
+
+/**
+ * dense tile, every cell set from `value`
+ */
+static gdalwrap::gdal make_tile(float value) {
+    gdalwrap::gdal tile;
+    tile.set_size(atlaas::N_RASTER, 100, 70);
+    tile.set_transform(377016 + value, 4824583, 0.5, -0.5);
+    for (size_t band = 0; band < tile.bands.size(); band++)
+        for (size_t idx = 0; idx < tile.bands[band].size(); idx++)
+            tile.bands[band][idx] = value + band + idx * 1e-3f;
+    return tile;
+}
+
+static bool holds(const atlaas::tile_store& store, const atlaas::map_id_t& id,
+                  float value) {
+    gdalwrap::gdal tile, expected = make_tile(value);
+    return store.read(id, tile) && tile.bands == expected.bands &&
+           tile.get_utm_pose_x() == expected.get_utm_pose_x() &&
+           tile.get_scale_x() == expected.get_scale_x();
+}
+
+static off_t file_size() {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+int main() {
+    test::scratch dir;
+    const atlaas::map_id_t a = {{0, 0}}, b = {{-1, 2}}, c = {{3, -4}};
+    std::unique_ptr<atlaas::tile_store> store(new atlaas::tile_store(path));
+    CHECK( store->list().empty() );
+    store->write(a, make_tile(1));
+    store->write(b, make_tile(2));
+    CHECK( holds(*store, a, 1) && holds(*store, b, 2) );
+    CHECK( ! store->contains(c) );
+
+    // reopen
+    store.reset(new atlaas::tile_store(path));
+    CHECK( store->list() == std::vector<atlaas::map_id_t>({b, a}) );
+    CHECK( holds(*store, a, 1) && holds(*store, b, 2) );
+
+    // pending, not there before the commit, dropped without it (among
+    // enough live tiles not to be compacted away)
+    for (int k = 0; k < 8; k++)
+        store->write({{10, k}}, make_tile(k));
+    store->write(c, make_tile(3), true);
+    store->remove(a, true);
+    CHECK( ! store->contains(c) && holds(*store, a, 1) );
+    store.reset(new atlaas::tile_store(path));
+    CHECK( ! store->contains(c) && holds(*store, a, 1) );
+    // even once another commit follows them in the log
+    store->write(b, make_tile(2), true);
+    store->commit();
+    store.reset(new atlaas::tile_store(path));
+    CHECK( ! store->contains(c) && holds(*store, a, 1) );
+    store->write(c, make_tile(3), true);
+    store->remove(a, true);
+    store->commit();
+    CHECK( holds(*store, c, 3) && ! store->contains(a) );
+    store.reset(new atlaas::tile_store(path));
+    CHECK( holds(*store, c, 3) && ! store->contains(a) );
+    CHECK( holds(*store, b, 2) );
+
+    // overwritten tiles are compacted away as the file grows
+    const off_t before = file_size();
+    for (int run = 0; run < 20; run++)
+        store->write(b, make_tile(10 + run));
+    CHECK( file_size() < 4 * before );
+    store->compact();
+    CHECK( file_size() <= before );
+    CHECK( holds(*store, b, 29) && holds(*store, c, 3) );
+    store.reset(new atlaas::tile_store(path));
+    CHECK( holds(*store, b, 29) && holds(*store, c, 3) );
+
+    // an interrupted write is dropped, the records before are kept
+    store->write(a, make_tile(4));
+    store.reset();
+    CHECK( ::truncate(path.c_str(), file_size() - 100) == 0 );
+    store.reset(new atlaas::tile_store(path));
+    CHECK( ! store->contains(a) );
+    CHECK( holds(*store, b, 29) && holds(*store, c, 3) );
+    store->write(a, make_tile(5));
+    store.reset(new atlaas::tile_store(path));
+    CHECK( holds(*store, a, 5) && holds(*store, b, 29) );
+    return test::report("tile_store");
+}
@@ -0,0 +1,135 @@
+/*
+ * test_tile_sync.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <sys/socket.h>     // socketpair
+#include <thread>
+#include <unistd.h>         // close
+
+#include "atlaas/tile_sync.hpp"
+#include "test.hpp"
+
+static const size_t size = 192, sub = size / 3;
+
+/**
+ * cells observed at `time`
+ */
+static atlaas::cells_info_t region(size_t w, size_t h, float value,
+                                   float time) {
+    atlaas::cells_info_t cells = test::region(w, h, value);
+    for (auto& cell : cells)
+        cell[atlaas::LAST_UPDATE] = time;
+    return cells;
+}
+
+static void write(atlaas::atlaas& map, size_t x, size_t y, size_t w,
+                  size_t h, float value, float time) {
+    atlaas::cells_info_t cells;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, cells);
+    map.write_region(x, y, w, h, region(w, h, value, time), window);
+}
+
+/**
+ * exchange over a socketpair, the first map initiates
+ * @returns the number of tiles the second one received
+ */
+static size_t exchange(atlaas::tile_sync& a, atlaas::tile_sync& b) {
+    int fds[2];
+    if ( ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 )
+        throw std::runtime_error("socketpair");
+    atlaas::fd_transport link_a(fds[0]), link_b(fds[1]);
+    std::exception_ptr error;
+    std::thread initiator([&]() {
+        try {
+            a.exchange(link_a, true);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    });
+    size_t received = b.exchange(link_b, false);
+    initiator.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+    if (error)
+        std::rethrow_exception(error);
+    return received;
+}
+
+static atlaas::cell_info_t cell(atlaas::atlaas& map, size_t x, size_t y) {
+    atlaas::cells_info_t cells;
+    map.read_region(x, y, 1, 1, cells);
+    return cells[0];
+}
+
+static float mean(atlaas::atlaas& map, size_t x, size_t y) {
+    const atlaas::cell_info_t& info = cell(map, x, y);
+    return info[atlaas::N_POINTS] == 1 ? info[atlaas::Z_MEAN] : -1;
+}
+
+/**
+ * two robots synchronize their tiles, then a tile changed on both sides
+ */
+int main() {
+    test::scratch dir;
+    atlaas::atlaas map1, map2;
+    map1.set_tile_store("robot1.atl");
+    map2.set_tile_store("robot2.atl");
+    test::init(map1, size);
+    test::init(map2, size);
+    atlaas::tile_sync sync1(map1, 1), sync2(map2, 2);
+
+    // each its own submodel
+    write(map1, 0, 0, sub, sub, 1, 10);
+    write(map2, 2 * sub, 0, sub, sub, 2, 10);
+    exchange(sync1, sync2);
+    CHECK( mean(map1, 2 * sub, 0) == 2 && mean(map2, 0, 0) == 1 );
+    CHECK( mean(map1, 0, 0) == 1 && mean(map2, 2 * sub, 0) == 2 );
+    CHECK( sync1.get_generations({{-1, -1}}) ==
+           sync2.get_generations({{-1, -1}}) );
+
+    // nothing new, nothing sent
+    CHECK( exchange(sync1, sync2) == 0 );
+
+    // the same submodel on both sides: the cells observed by both are
+    // pooled, the ones they had in common are not counted twice
+    write(map1, sub, sub, 10, 10, 3, 20);
+    write(map2, sub + 5, sub, 10, 10, 4, 30);
+    CHECK( exchange(sync1, sync2) == 1 );
+    for (int run = 0; run < 2; run++) {
+        for (auto* map : {&map1, &map2}) {
+            CHECK( mean(*map, sub, sub) == 3 );
+            CHECK( mean(*map, sub + 14, sub) == 4 );
+            const atlaas::cell_info_t& both = cell(*map, sub + 5, sub);
+            CHECK( both[atlaas::N_POINTS] == 2 );
+            CHECK( both[atlaas::Z_MEAN] == 3.5 );
+            CHECK( mean(*map, 0, 0) == 1 ); // one point, as before
+        }
+        atlaas::cells_info_t tile1, tile2;
+        CHECK( map1.load_tile({{0, 0}}, tile1) );
+        CHECK( map2.load_tile({{0, 0}}, tile2) );
+        CHECK( tile1 == tile2 );
+        // the same layers again, from a reloaded state: merged once
+        sync2.save("robot2.sync");
+        atlaas::tile_sync again(map2, 2);
+        again.load("robot2.sync");
+        CHECK( exchange(sync1, again) == 0 );
+        CHECK( exchange(again, sync1) == 0 );
+    }
+
+    // then a cell observed again by robot 1, on top of what it received
+    atlaas::cell_info_t more = cell(map1, sub + 14, sub);
+    atlaas::mean_aggregate::add(more, 6, 1);
+    atlaas::cells_info_t cells;
+    map1.write_region(sub + 14, sub, 1, 1, {more},
+                      map1.read_region(0, 0, 1, 1, cells));
+    CHECK( exchange(sync1, sync2) == 1 );
+    const atlaas::cell_info_t& pooled = cell(map2, sub + 14, sub);
+    CHECK( pooled[atlaas::N_POINTS] == 2 );
+    CHECK( pooled[atlaas::Z_MEAN] == 5 );
+    return test::report("tile_sync");
+}
@@ -0,0 +1,97 @@
+/*
+ * test_viewshed.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <cmath>
+#include <limits>
+
+#include "test.hpp"
+
+static const long SIZE = 48;
+
+/**
+ * how far (in meters) the line of sight from the sensor (at the centre of
+ * the cell (sx, sy), height sz) to the top of the cell (tx, ty) passes
+ * above the cells in between: visible if positive, dense sampling
+ */
+static float clearance(const std::vector<float>& z, long sx, long sy,
+                       float sz, long tx, long ty) {
+    const double dx = tx - sx, dy = ty - sy;
+    const double length = std::sqrt(dx * dx + dy * dy);
+    const float target = (z[ty * SIZE + tx] - sz) / length;
+    float horizon = - std::numeric_limits<float>::max();
+    const long samples = length * 20;
+    for (long k = 1; k < samples; k++) {
+        const double t = double(k) / samples;
+        const long x = std::floor(sx + 0.5 + t * dx),
+                   y = std::floor(sy + 0.5 + t * dy);
+        if ( (x == sx && y == sy) || (x == tx && y == ty) )
+            continue;
+        horizon = std::max<float>(horizon,
+                                  (z[y * SIZE + x] - sz) / (t * length));
+    }
+    return (target - horizon) * length;
+}
+
+/**
+ * a wall hides the ground right behind it, not a tower behind it nor the
+ * ground farther, as a brute-force line of sight check
+ */
+int main() {
+    test::scratch dir;
+    atlaas::atlaas map;
+    test::init(map, SIZE);
+    // sensor 2m above the centre of the cell (10, 24), over a bowl (the
+    // ground is not on the edge of its own shadow, as a flat one would be)
+    const long sx = 10, sy = 24;
+    const float sz = 2;
+    std::vector<float> z(SIZE * SIZE);
+    for (long y = 0; y < SIZE; y++)
+    for (long x = 0; x < SIZE; x++)
+        z[y * SIZE + x] = 0.01 * ((x - sx) * (x - sx) + (y - sy) * (y - sy));
+    for (long y = 0; y < SIZE; y++)
+        z[y * SIZE + 20] += 2;     // wall
+    z[24 * SIZE + 33] += 5;        // tower behind it
+    atlaas::cells_info_t cells = test::region(SIZE, SIZE, 0);
+    for (size_t idx = 0; idx < cells.size(); idx++)
+        cells[idx][atlaas::Z_MAX] = cells[idx][atlaas::Z_MEAN] = z[idx];
+    atlaas::cells_info_t read;
+    const atlaas::map_id_t window = map.read_region(0, 0, 1, 1, read);
+    map.write_region(0, 0, SIZE, SIZE, cells, window);
+
+    std::vector<char> visible;
+    const size_t count = map.viewshed({{ float(sx - SIZE / 2 + 0.5),
+        float(SIZE / 2 - 1 - sy + 0.5), sz }}, 0, visible, atlaas::Z_MAX, 4);
+    CHECK( visible.size() == size_t(SIZE * SIZE) );
+    std::vector<char> brute(SIZE * SIZE, true);
+    size_t seen = 0, hidden = 0;
+    for (long y = 0; y < SIZE; y++)
+    for (long x = 0; x < SIZE; x++) {
+        seen += visible[y * SIZE + x];
+        if ( x != sx || y != sy )
+            brute[y * SIZE + x] = clearance(z, sx, sy, sz, x, y) > 0;
+        hidden += ! brute[y * SIZE + x];
+    }
+    CHECK( seen == count && hidden > 200 );
+    // the sweep walks rays a cell at a time: it may differ on the edge of
+    // a shadow, as one of the neighbours then
+    size_t wrong = 0;
+    for (long y = 0; y < SIZE; y++)
+    for (long x = 0; x < SIZE; x++) {
+        bool edge = false;
+        for (long j = std::max(0L, y - 1); j <= std::min(SIZE - 1, y + 1); j++)
+        for (long i = std::max(0L, x - 1); i <= std::min(SIZE - 1, x + 1); i++)
+            edge = edge || brute[j * SIZE + i] == visible[y * SIZE + x];
+        wrong += ! edge;
+    }
+    CHECK( wrong == 0 );
+    // the ground right behind the wall, behind the tower, not the tower
+    CHECK( ! visible[24 * SIZE + 22] && ! visible[24 * SIZE + 40] );
+    CHECK( visible[24 * SIZE + 33] && visible[10 * SIZE + 40] );
+    return test::report("viewshed");
+}
@@ -0,0 +1,189 @@
+/*
+ * atlaas_bench.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <chrono>
+#include <cmath>            // isnan
+#include <cstdio>           // remove
+#include <cstdlib>          // atoi, mkdtemp
+#include <functional>
+#include <iostream>
+#include <unistd.h>         // rmdir
+
+#include "atlaas/atlaas.hpp"
+#include "atlaas/perf_counters.hpp"
+
+struct bench_case {
+    std::string name;
+    size_t points;  // per run, 0 if the case does not take points
+    size_t cells;   // of the window
+    size_t runs;
+    double seconds; // all runs
+    atlaas::perf_values_t counters; // all runs
+};
+
+/**
+ * run `body` (after `setup`, which is not measured) `runs` times
+ */
+static bench_case measure(const std::string& name, size_t points,
+                          size_t cells, size_t runs,
+                          atlaas::perf_counters* perf,
+                          const std::function<void(size_t)>& setup,
+                          const std::function<void(size_t)>& body) {
+    bench_case result = { name, points, cells, runs, 0, {} };
+    result.counters.fill(0);
+    for (size_t run = 0; run < runs; run++) {
+        setup(run);
+        auto start = std::chrono::steady_clock::now();
+        if (perf)
+            perf->start();
+        body(run);
+        if (perf)
+            perf->stop();
+        result.seconds += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        if (perf) {
+            const atlaas::perf_values_t& values = perf->read();
+            for (int counter = 0; counter < atlaas::N_PERF; counter++)
+                result.counters[counter] += values[counter];
+        } else {
+            result.counters.fill(NAN);
+        }
+    }
+    return result;
+}
+
+static void json_number(std::ostream& os, double value) {
+    if ( std::isnan(value) || std::isinf(value) )
+        os << "null";
+    else
+        os << value;
+}
+
+static void json_case(std::ostream& os, const bench_case& c) {
+    const double runs = c.runs;
+    const double points = c.points ? runs * c.points : NAN;
+    const double cells = runs * c.cells;
+    os << "    {\"name\": \"" << c.name << "\", \"runs\": " << c.runs
+       << ", \"points\": " << c.points << ", \"cells\": " << c.cells
+       << ",\n     \"seconds\": ";
+    json_number(os, c.seconds / runs);
+    os << ", \"ns_per_point\": ";
+    json_number(os, 1e9 * c.seconds / points);
+    os << ", \"ns_per_cell\": ";
+    json_number(os, 1e9 * c.seconds / cells);
+    os << ",\n     \"counters\": {";
+    for (int counter = 0; counter < atlaas::N_PERF; counter++) {
+        os << (counter ? ",\n" : "\n") << "       \""
+           << atlaas::PERF_NAMES[counter] << "\": {\"total\": ";
+        json_number(os, c.counters[counter] / runs);
+        os << ", \"per_point\": ";
+        json_number(os, c.counters[counter] / points);
+        os << ", \"per_cell\": ";
+        json_number(os, c.counters[counter] / cells);
+        os << "}";
+    }
+    os << "\n     }}";
+}
+
+int main(int argc, char * argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "-h") {
+        std::cerr << "usage: " << argv[0]
+                  << " [points=100000] [runs=10] [size=60] [perf=1]"
+                  << std::endl << "benchmark merge, update, viewshed and"
+                  << " slide_to, JSON on the standard output" << std::endl;
+        return 1;
+    }
+    size_t n_points = (argc > 1) ? std::atoi(argv[1]) : 100000;
+    size_t runs = (argc > 2) ? std::atoi(argv[2]) : 10;
+    double size = (argc > 3) ? std::atof(argv[3]) : 60;
+    bool use_perf = (argc > 4) ? std::atoi(argv[4]) : true;
+
+    // submodels go to a scratch tile store
+    char tmpdir[] = "/tmp/atlaas-bench.XXXXXX";
+    if ( mkdtemp(tmpdir) == NULL ) {
+        std::cerr << "cannot create a scratch directory" << std::endl;
+        return 1;
+    }
+    const std::string store_path = std::string(tmpdir) + "/tiles.atl";
+
+    // counters are opened first, to be inherited by the library threads
+    std::unique_ptr<atlaas::perf_counters> perf;
+    if (use_perf) {
+        perf.reset(new atlaas::perf_counters);
+        bool any = false;
+        for (int counter = 0; counter < atlaas::N_PERF; counter++)
+            any = any || perf->available(counter);
+        if (!any) {
+            std::cerr << "perf_event_open: no counter available (see "
+                      << "/proc/sys/kernel/perf_event_paranoid)" << std::endl;
+            perf.reset();
+        }
+    }
+
+    // deterministic cloud around the sensor, a few meters high ground
+    atlaas::points cloud(n_points), moved;
+    uint32_t seed = 42;
+    auto uniform = [&]() {
+        seed = seed * 1664525 + 1013904223;
+        return float(seed >> 8) / float(1 << 24);
+    };
+    for (auto& point : cloud) {
+        float x = (uniform() - 0.5) * size, y = (uniform() - 0.5) * size;
+        point = {{ x, y, float(0.5 * std::sin(x / 3) * std::cos(y / 5)
+                             + 0.05 * uniform()) }};
+    }
+
+    // sensor at the custom origin, in the middle of the window
+    const double utm_x = 377016, utm_y = 4824583;
+    atlaas::atlaas map;
+    map.set_tile_store(store_path); // before init, which loads submodels
+    map.init(size, size, 0.1, utm_x + size / 2, utm_y - size / 2,
+             utm_x, utm_y, 31);
+    const size_t cells = map.get_internal_grid().size();
+    const double step = size / 3; // submodel size, meters
+    std::vector<bench_case> cases;
+
+    cases.push_back( measure("merge", n_points, cells, runs, perf.get(),
+        [&](size_t) { moved = cloud; },
+        [&](size_t run) {
+            map.merge(moved, atlaas::pose6d_to_matrix(0.01 * run, 0, 0,
+                                                      0, 0, 1));
+        }) );
+
+    cases.push_back( measure("update", 0, cells, runs, perf.get(),
+        [&](size_t) {},
+        [&](size_t) { map.update(); }) );
+
+    // whole window in range, from a meter above the custom origin
+    std::vector<char> visible;
+    cases.push_back( measure("viewshed", 0, cells, runs, perf.get(),
+        [&](size_t) {},
+        [&](size_t) { map.viewshed({{ 0, 0, 1 }}, 0, visible); }) );
+
+    // one slide per run, including its background save
+    cases.push_back( measure("slide_to", 0, cells, runs, perf.get(),
+        [&](size_t) {},
+        [&](size_t run) {
+            map.slide_to(step * (run + 1), 0);
+            map.wait_saves();
+        }) );
+
+    std::cout << "{\n  \"perf\": " << (perf ? "true" : "false")
+              << ",\n  \"cases\": [\n";
+    for (size_t idx = 0; idx < cases.size(); idx++) {
+        json_case(std::cout, cases[idx]);
+        std::cout << (idx + 1 < cases.size() ? ",\n" : "\n");
+    }
+    std::cout << "  ]\n}" << std::endl;
+
+    map.set_tile_store("");
+    std::remove(store_path.c_str());
+    rmdir(tmpdir);
+    return 0;
+}
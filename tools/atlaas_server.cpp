@@ -0,0 +1,39 @@
+/*
+ * atlaas_server.cpp
+ *
+ * Atlas at LAAS
+ *
+ * author:  Pierrick Koch <pierrick.koch@laas.fr>
+ * created: 2026-10-18
+ * license: BSD
+ */
+#include <csignal>
+#include <cstdlib>          // atoi
+#include <iostream>
+
+#include "atlaas/tile_server.hpp"
+
+static volatile bool stop = false;
+
+static void on_signal(int) {
+    stop = true;
+}
+
+int main(int argc, char * argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0]
+                  << " socket_path [tiles_directory_or_store=.]"
+                  << " [cache_size=64]" << std::endl;
+        return 1;
+    }
+    std::string path = (argc > 2) ? argv[2] : ".";
+    size_t cache_size = (argc > 3) ? std::atoi(argv[3]) : 64;
+
+    std::signal(SIGINT,  on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::signal(SIGPIPE, SIG_IGN); // clients may leave anytime
+
+    atlaas::tile_server server(argv[1], path, cache_size);
+    server.run(stop);
+    return 0;
+}